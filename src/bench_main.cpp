@@ -0,0 +1,1178 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include "handmade.hpp"
+#include "handmade_render.hpp"
+#include "handmade_audio.hpp"
+#include "work_queue.hpp"
+#include "input_recording.hpp"
+#include "handmade_profiler.hpp"
+
+/*
+ * Headless driver for gameUpdateAndRender.  Loads game.so the same way the
+ * platform layer does, feeds it a recorded game_state.bin/game_input.bin pair
+ * and runs it as fast as possible with no SDL, vsync or texture upload in the
+ * way.
+ *
+ * usage: bench [-n frames] [-w width] [-h height] [-t threads] [-csv file] [-kernels] [-audio] [-verify] [-profile] [-overlay] [-quads] [-layout rgba|argb|abgr|bgra]
+ *
+ *   -t        worker threads for the render queue, 0 renders on the calling
+ *             thread only (default: one per extra core)
+ *   -kernels  also time every render kernel variant at the given size, and
+ *             the rectangle and sprite fill rate of every draw kernel variant
+ *   -audio    time the old per-sample sinf path against the oscillator bank
+ *             at several voice counts, in samples per second on one core,
+ *             then time a frame of the sample voice mixer per kernel variant
+ *   -verify   check every kernel variant matches the scalar reference byte for
+ *             byte over random sizes, pitches and offsets, and that input
+ *             recordings play back and seek exactly, then exit
+ *   -profile  run with the profiler attached, print its per-frame table, write
+ *             the whole run to bench_trace.json and time an empty TIMED_BLOCK
+ *   -overlay  draw the debug overlay every frame, fed with the bench's own
+ *             frame times
+ *   -quads    draw a scene of rotated, scaled textured quads per kernel
+ *             variant and print the cost per quad and per pixel
+ *   -layout   channel order of the buffer the game and kernels draw into
+ *             (default: rgba)
+ */
+
+#define BENCH_DEFAULT_FRAMES 1000
+#define BENCH_FRAME_SECONDS (1.f / 60.f)
+#define BENCH_TRACE_PATH "bench_trace.json"
+#define PROFILE_COST_BLOCKS 1000000
+#define PROFILE_COST_BATCH 4096 //blocks between collections, well inside a ring
+
+typedef void GameUpdateAndRenderFunc(GameMemory* memory, OffScreenBuffer *buffer, GameSoundOutput* sb, const InputContext* ci, real32_t secsSinceLastFrame);
+
+enum BenchSeriesType {
+    BenchSeries_GameUpdateAndRender,
+    BenchSeries_RenderWeirdGradient,
+    BenchSeries_OutputSound,
+    BenchSeries_DrawDebugOverlay,
+    BenchSeries_Count
+};
+
+static const char* benchSeriesNames[BenchSeries_Count] = {
+    "gameUpdateAndRender",
+    "renderWeirdGradient",
+    "outputSound",
+    "drawDebugOverlay",
+};
+
+//NOTE: The TIMED_BLOCK each series is read from, the first one is timed
+//      around the whole call instead
+static const char* benchSeriesSites[BenchSeries_Count] = {
+    nullptr,
+    "renderTiled",
+    "outputSound",
+    "drawDebugOverlay",
+};
+
+static const char* simdLevelNames[SimdLevel_Count] = {
+    "scalar",
+    "sse2",
+    "avx2",
+};
+
+struct BenchSeries {
+    uint64_t* nanoseconds = nullptr;
+    uint64_t* cycles = nullptr;
+};
+
+struct BenchOptions {
+    uint32_t numFrames = BENCH_DEFAULT_FRAMES;
+    uint32_t width = SCREEN_WIDTH;
+    uint32_t height = SCREEN_HEIGHT;
+    uint32_t workerCount = getDefaultWorkerCount();
+    const char* csvPath = nullptr;
+    bool timeKernels = false;
+    bool timeAudio = false;
+    bool verifyKernels = false;
+    bool profile = false;
+    bool drawOverlay = false;
+    bool timeQuads = false;
+    PixelLayout layout = PixelLayout_RGBA;
+};
+
+static void printGeneralErrorAndExit(const char* message) {
+    fprintf(stderr, "Fatal Error: %s\n", message);
+    exit(1);
+}
+
+static GameUpdateAndRenderFunc* loadGameCode() {
+    void* gameLib = dlopen(GAME_LIB_PATH, RTLD_NOW);
+
+    if(!gameLib) {
+        printGeneralErrorAndExit(dlerror());
+    }
+
+    void* gameUpdateAndRenderPtr = dlsym(gameLib, "gameUpdateAndRender");
+
+    if(!gameUpdateAndRenderPtr) {
+        printGeneralErrorAndExit(dlerror());
+    }
+
+    return (GameUpdateAndRenderFunc*)gameUpdateAndRenderPtr;
+}
+
+static void* allocateOrDie(uint64_t size) {
+    void* ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if(ret == MAP_FAILED) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+
+    return ret;
+}
+
+//NOTE: Where the platform maps game memory in internal builds, so pointers
+//      in a saved state point at the same things here
+static void* allocateGameMemoryOrDie(uint64_t size) {
+    void* ret = mmap((void*)GAME_MEMORY_BASE_ADDRESS, size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if(ret == MAP_FAILED || ret != (void*)GAME_MEMORY_BASE_ADDRESS) {
+        fprintf(stderr, "Warning: could not map game memory at %p\n", (void*)GAME_MEMORY_BASE_ADDRESS);
+        if(ret != MAP_FAILED) {
+            munmap(ret, size);
+        }
+        ret = allocateOrDie(size);
+    }
+
+    return ret;
+}
+
+static void parseOptions(BenchOptions* options, int argc, char** argv) {
+    for(int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+
+        if(!strcmp(argv[i], "-n") && hasValue) {
+            options->numFrames = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-w") && hasValue) {
+            options->width = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-h") && hasValue) {
+            options->height = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-t") && hasValue) {
+            options->workerCount = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-csv") && hasValue) {
+            options->csvPath = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-kernels")) {
+            options->timeKernels = true;
+        }
+        else if(!strcmp(argv[i], "-audio")) {
+            options->timeAudio = true;
+        }
+        else if(!strcmp(argv[i], "-verify")) {
+            options->verifyKernels = true;
+        }
+        else if(!strcmp(argv[i], "-profile")) {
+            options->profile = true;
+        }
+        else if(!strcmp(argv[i], "-overlay")) {
+            options->drawOverlay = true;
+        }
+        else if(!strcmp(argv[i], "-quads")) {
+            options->timeQuads = true;
+        }
+        else if(!strcmp(argv[i], "-layout") && hasValue) {
+            i++;
+            uint32_t layout = 0;
+            while(layout < PixelLayout_Count && strcmp(argv[i], pixelLayoutNames[layout])) {
+                layout++;
+            }
+
+            if(layout == PixelLayout_Count) {
+                printGeneralErrorAndExit("Unknown pixel layout, use rgba, argb, abgr or bgra");
+            }
+            options->layout = (PixelLayout)layout;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n frames] [-w width] [-h height] [-t threads] [-csv file] [-kernels] [-audio] [-verify] [-profile] [-overlay] [-quads] [-layout rgba|argb|abgr|bgra]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if(options->numFrames == 0 || options->width == 0 || options->height == 0) {
+        printGeneralErrorAndExit("Frames, width and height must be non-zero");
+    }
+}
+
+//NOTE: Same file layout beginRecording writes: the whole game memory block
+static void loadGameState(void* memoryBlock, uint64_t memorySize) {
+    FILE* stateFile;
+
+    if((stateFile = fopen(GAME_STATE_PATH, "rb"))) {
+        if(fread(memoryBlock, memorySize, 1, stateFile) != 1) {
+            fprintf(stderr, "Warning: %s is truncated, starting from a fresh state\n", GAME_STATE_PATH);
+            memset(memoryBlock, 0, memorySize);
+        }
+
+        fclose(stateFile);
+    }
+    else {
+        fprintf(stderr, "Warning: no %s, starting from a fresh state\n", GAME_STATE_PATH);
+    }
+}
+
+static int compareU64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t* sorted, uint32_t count, uint32_t pct) {
+    uint32_t index = (uint32_t)(((uint64_t)count * pct) / 100);
+    return sorted[(index < count) ? index : count - 1];
+}
+
+static void printSummaryLine(const char* name, const char* unit, uint64_t* values, uint32_t count) {
+    uint64_t total = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        total += values[i];
+    }
+
+    qsort(values, count, sizeof(uint64_t), compareU64);
+
+    printf("%-20s %-6s %12llu %12llu %12llu %12llu %12llu\n", name, unit,
+            (unsigned long long)(total / count),
+            (unsigned long long)values[0],
+            (unsigned long long)percentile(values, count, 50),
+            (unsigned long long)percentile(values, count, 99),
+            (unsigned long long)values[count - 1]);
+}
+
+#define VERIFY_ITERATIONS 2000
+#define VERIFY_MAX_WIDTH 300
+#define VERIFY_MAX_HEIGHT 8
+#define VERIFY_MAX_PADDING_PIXELS 17
+#define VERIFY_SENTINEL 0xCD
+#define VERIFY_MIXER_ITERATIONS 200
+#define MIXER_SOURCE_LENGTH 4801 //odd so runs split at every alignment
+#define VERIFY_INPUT_FRAMES 5000
+#define VERIFY_INPUT_SEEKS 500
+#define VERIFY_INPUT_PATH "/tmp/bench_verify_input.bin"
+#define VERIFY_DRAW_ITERATIONS 2000
+#define VERIFY_DRAW_MARGIN 24 //how far primitives may stick out of the buffer
+#define VERIFY_BITMAP_MAX_WIDTH 40
+#define VERIFY_BITMAP_MAX_HEIGHT 12
+
+//NOTE: Small xorshift so -verify is reproducible from run to run
+static uint32_t nextRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static bool verifyRenderKernels() {
+    //room for the largest pitch times the largest height plus a start offset
+    uint64_t bufferSize = (VERIFY_MAX_WIDTH + VERIFY_MAX_PADDING_PIXELS) * sizeof(Pixel) * VERIFY_MAX_HEIGHT + 64;
+    uint8_t* reference = (uint8_t*)allocateOrDie(bufferSize);
+    uint8_t* candidate = (uint8_t*)allocateOrDie(bufferSize);
+    uint32_t rng = 0x1234567;
+    uint32_t failures = 0;
+
+    for(uint32_t i = 0; i < VERIFY_ITERATIONS; i++) {
+        OffScreenBuffer ref;
+        ref.width = 1 + nextRandom(&rng) % VERIFY_MAX_WIDTH;
+        ref.height = 1 + nextRandom(&rng) % VERIFY_MAX_HEIGHT;
+        ref.pitch = (ref.width + nextRandom(&rng) % VERIFY_MAX_PADDING_PIXELS) * sizeof(Pixel);
+        uint32_t startOffset = (nextRandom(&rng) % 16) * sizeof(Pixel);
+        int blueOffset = (int)nextRandom(&rng) - INT32_MAX / 2;
+        int greenOffset = (int)nextRandom(&rng) - INT32_MAX / 2;
+        ref.layout = (PixelLayout)(nextRandom(&rng) % PixelLayout_Count);
+
+        memset(reference, VERIFY_SENTINEL, bufferSize);
+        ref.pixels = (Pixel*)(reference + startOffset);
+        getRenderWeirdGradient(SimdLevel_Scalar, ref.layout)(&ref, blueOffset, greenOffset);
+
+        for(uint32_t k = SimdLevel_Scalar + 1; k < SimdLevel_Count; k++) {
+            if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+                continue;
+            }
+
+            OffScreenBuffer cand = ref;
+            memset(candidate, VERIFY_SENTINEL, bufferSize);
+            cand.pixels = (Pixel*)(candidate + startOffset);
+            getRenderWeirdGradient((SimdLevel)k, cand.layout)(&cand, blueOffset, greenOffset);
+
+            //compare the whole allocation so writes into the pitch padding show up too
+            if(memcmp(reference, candidate, bufferSize) != 0) {
+                fprintf(stderr, "renderWeirdGradient %s differs from scalar: layout %s width %u height %u pitch %u offset %u blue %d green %d\n",
+                        simdLevelNames[k], pixelLayoutNames[ref.layout], ref.width, ref.height, ref.pitch, startOffset, blueOffset, greenOffset);
+                failures++;
+            }
+        }
+    }
+
+    munmap(reference, bufferSize);
+    munmap(candidate, bufferSize);
+
+    printf("verify: %u iterations, %u failures%s\n", VERIFY_ITERATIONS, failures,
+            cpuSupportsAVX2() ? "" : " (avx2 not supported, skipped)");
+
+    return failures == 0;
+}
+
+//NOTE: A coordinate with a random fraction that may be off either edge
+static real32_t randomEdge(uint32_t* rng, uint32_t limit) {
+    int32_t whole = (int32_t)(nextRandom(rng) % (limit + 2 * VERIFY_DRAW_MARGIN)) - VERIFY_DRAW_MARGIN;
+    return whole + (nextRandom(rng) % 8) * .125f;
+}
+
+//NOTE: Starts both buffers from the same random pixels so blending has
+//      something to blend with.  Source pixels are random too, not
+//      premultiplied, which also covers the saturating add.
+static bool verifyDrawKernels() {
+    uint64_t bufferSize = (VERIFY_MAX_WIDTH + VERIFY_MAX_PADDING_PIXELS) * sizeof(Pixel) * VERIFY_MAX_HEIGHT + 64;
+    uint64_t bitmapSize = (VERIFY_BITMAP_MAX_WIDTH + VERIFY_MAX_PADDING_PIXELS) * sizeof(Pixel) * VERIFY_BITMAP_MAX_HEIGHT;
+    uint8_t* original = (uint8_t*)allocateOrDie(bufferSize);
+    uint8_t* reference = (uint8_t*)allocateOrDie(bufferSize);
+    uint8_t* candidate = (uint8_t*)allocateOrDie(bufferSize);
+    Pixel* bitmapPixels = (Pixel*)allocateOrDie(bitmapSize);
+    uint8_t* textureMemory = (uint8_t*)allocateOrDie(2 * bitmapSize);
+    MemoryArena textureArena;
+    uint32_t rng = 0x7654321;
+    uint32_t failures = 0;
+
+    for(uint32_t i = 0; i < VERIFY_DRAW_ITERATIONS; i++) {
+        OffScreenBuffer ref;
+        ref.width = 1 + nextRandom(&rng) % VERIFY_MAX_WIDTH;
+        ref.height = 1 + nextRandom(&rng) % VERIFY_MAX_HEIGHT;
+        ref.pitch = (ref.width + nextRandom(&rng) % VERIFY_MAX_PADDING_PIXELS) * sizeof(Pixel);
+        uint32_t startOffset = (nextRandom(&rng) % 16) * sizeof(Pixel);
+        ref.layout = (PixelLayout)(nextRandom(&rng) % PixelLayout_Count);
+
+        LoadedBitmap bitmap;
+        bitmap.width = 1 + nextRandom(&rng) % VERIFY_BITMAP_MAX_WIDTH;
+        bitmap.height = 1 + nextRandom(&rng) % VERIFY_BITMAP_MAX_HEIGHT;
+        bitmap.pitch = (bitmap.width + nextRandom(&rng) % VERIFY_MAX_PADDING_PIXELS) * sizeof(Pixel);
+        bitmap.pixels = bitmapPixels;
+        for(uint64_t p = 0; p < bitmapSize / sizeof(Pixel); p++) {
+            bitmapPixels[p].value = nextRandom(&rng);
+        }
+
+        initializeArena(&textureArena, textureMemory, 2 * bitmapSize);
+        TiledTexture texture = tileTexture(&textureArena, &bitmap);
+
+        real32_t minX = randomEdge(&rng, ref.width);
+        real32_t minY = randomEdge(&rng, ref.height);
+        real32_t maxX = randomEdge(&rng, ref.width);
+        real32_t maxY = randomEdge(&rng, ref.height);
+        Pixel color;
+        color.value = nextRandom(&rng);
+        if(nextRandom(&rng) % 4 == 0) {
+            color.value |= 0xFF << getAlphaShift(ref.layout);
+        }
+        V2 quadOrigin = {randomEdge(&rng, ref.width), randomEdge(&rng, ref.height)};
+        V2 xAxis = {maxX - minX, (maxY - minY) * .25f};
+        V2 yAxis = {(minX - maxX) * .5f, maxY - minY + randomEdge(&rng, ref.height)};
+
+        for(uint64_t b = 0; b < bufferSize; b++) {
+            original[b] = (uint8_t)nextRandom(&rng);
+        }
+
+        DrawSpanKernels scalar = getDrawSpanKernels(SimdLevel_Scalar, ref.layout);
+        memcpy(reference, original, bufferSize);
+        ref.pixels = (Pixel*)(reference + startOffset);
+        drawRectangle(&ref, &scalar, minX, minY, maxX, maxY, color);
+        drawBitmap(&ref, &scalar, &bitmap, minX, minY);
+        drawQuad(&ref, &scalar, &texture, quadOrigin, xAxis, yAxis);
+
+        for(uint32_t k = SimdLevel_Scalar + 1; k < SimdLevel_Count; k++) {
+            if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+                continue;
+            }
+
+            DrawSpanKernels kernels = getDrawSpanKernels((SimdLevel)k, ref.layout);
+            OffScreenBuffer cand = ref;
+            memcpy(candidate, original, bufferSize);
+            cand.pixels = (Pixel*)(candidate + startOffset);
+            drawRectangle(&cand, &kernels, minX, minY, maxX, maxY, color);
+            drawBitmap(&cand, &kernels, &bitmap, minX, minY);
+            drawQuad(&cand, &kernels, &texture, quadOrigin, xAxis, yAxis);
+
+            if(memcmp(reference, candidate, bufferSize) != 0) {
+                fprintf(stderr, "draw kernels %s differ from scalar: layout %s width %u height %u pitch %u offset %u rect %.3f %.3f %.3f %.3f color %08x bitmap %ux%u quad %.3f %.3f %.3f %.3f %.3f %.3f\n",
+                        simdLevelNames[k], pixelLayoutNames[ref.layout], ref.width, ref.height, ref.pitch, startOffset, minX, minY, maxX, maxY, color.value,
+                        bitmap.width, bitmap.height, quadOrigin.x, quadOrigin.y, xAxis.x, xAxis.y, yAxis.x, yAxis.y);
+                failures++;
+            }
+        }
+    }
+
+    munmap(original, bufferSize);
+    munmap(reference, bufferSize);
+    munmap(candidate, bufferSize);
+    munmap(bitmapPixels, bitmapSize);
+    munmap(textureMemory, 2 * bitmapSize);
+
+    printf("verify draw: %u iterations, %u failures%s\n", VERIFY_DRAW_ITERATIONS, failures,
+            cpuSupportsAVX2() ? "" : " (avx2 not supported, skipped)");
+
+    return failures == 0;
+}
+
+//NOTE: Fills every voice with noise, volume, pan and a start position drawn from rng
+static void randomMixerVoices(MixerVoices* voices, int16_t* source, uint32_t count, uint32_t* rng) {
+    for(uint32_t i = 0; i < MIXER_SOURCE_LENGTH; i++) {
+        source[i] = (int16_t)nextRandom(rng);
+    }
+
+    voices->count = count;
+    for(uint32_t v = 0; v < count; v++) {
+        voices->source[v] = source;
+        voices->sourceLength[v] = 1 + nextRandom(rng) % MIXER_SOURCE_LENGTH;
+        voices->position[v] = nextRandom(rng) % voices->sourceLength[v];
+        voices->volume[v] = (nextRandom(rng) % 1000) / 1000.f;
+        voices->pan[v] = (nextRandom(rng) % 2001) / 1000.f - 1.f;
+    }
+}
+
+static bool verifyMixerKernels() {
+    const uint32_t maxSamples = 2000;
+    MixerVoices* reference = (MixerVoices*)allocateOrDie(sizeof(MixerVoices));
+    MixerVoices* scratch = (MixerVoices*)allocateOrDie(sizeof(MixerVoices));
+    MixerVoices* candidate = (MixerVoices*)allocateOrDie(sizeof(MixerVoices));
+    int16_t* source = (int16_t*)allocateOrDie(MIXER_SOURCE_LENGTH * sizeof(int16_t));
+    Sample* referenceSamples = (Sample*)allocateOrDie(maxSamples * sizeof(Sample));
+    Sample* candidateSamples = (Sample*)allocateOrDie(maxSamples * sizeof(Sample));
+    OscillatorBank* bank = (OscillatorBank*)allocateOrDie(sizeof(OscillatorBank));
+    uint32_t rng = 0x7654321;
+    uint32_t failures = 0;
+
+    for(uint32_t i = 0; i < VERIFY_MIXER_ITERATIONS; i++) {
+        uint32_t numSamples = 1 + nextRandom(&rng) % maxSamples;
+        randomMixerVoices(reference, source, 1 + nextRandom(&rng) % 64, &rng);
+        *bank = {};
+
+        for(uint32_t k = SimdLevel_Scalar + 1; k < SimdLevel_Count; k++) {
+            if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+                continue;
+            }
+
+            //each run mixes from the same start positions; up to 64 full scale
+            //noise voices also make sure the packs have to saturate
+            memcpy(scratch, reference, sizeof(MixerVoices));
+            memcpy(candidate, reference, sizeof(MixerVoices));
+            memset((void*)referenceSamples, VERIFY_SENTINEL, maxSamples * sizeof(Sample));
+            memset((void*)candidateSamples, VERIFY_SENTINEL, maxSamples * sizeof(Sample));
+
+            mixSoundOutput(bank, scratch, mixRunScalar, referenceSamples, numSamples);
+            mixSoundOutput(bank, candidate, getMixRun((SimdLevel)k), candidateSamples, numSamples);
+
+            if(memcmp(referenceSamples, candidateSamples, maxSamples * sizeof(Sample)) != 0 ||
+                    memcmp(scratch->position, candidate->position, sizeof(scratch->position)) != 0) {
+                fprintf(stderr, "mixRun %s differs from scalar: %u voices %u samples\n",
+                        simdLevelNames[k], reference->count, numSamples);
+                failures++;
+            }
+        }
+    }
+
+    munmap(reference, sizeof(MixerVoices));
+    munmap(scratch, sizeof(MixerVoices));
+    munmap(candidate, sizeof(MixerVoices));
+    munmap(source, MIXER_SOURCE_LENGTH * sizeof(int16_t));
+    munmap(referenceSamples, maxSamples * sizeof(Sample));
+    munmap(candidateSamples, maxSamples * sizeof(Sample));
+    munmap(bank, sizeof(OscillatorBank));
+
+    printf("verify mixer: %u iterations, %u failures\n", VERIFY_MIXER_ITERATIONS, failures);
+
+    return failures == 0;
+}
+
+//NOTE: Mostly idle frames with the odd press and stick move, like a real session
+static void randomInputFrame(InputContext* input, uint32_t* rng) {
+    for(uint32_t c = 0; c < MAX_CONTROLLERS; c++) {
+        ControllerInput* controller = &input->controllers[c];
+
+        for(uint32_t b = 0; b < NUM_BUTTONS; b++) {
+            ButtonState* button = &controller->buttons[b];
+            button->halfTransitionCount = 0;
+
+            if(nextRandom(rng) % 64 == 0) {
+                button->halfTransitionCount = 1 + nextRandom(rng) % 3;
+                button->isEndedDown ^= button->halfTransitionCount & 1;
+            }
+        }
+
+        if(nextRandom(rng) % 8 == 0) {
+            //same mapping the platform uses for stick readings
+            int16_t x = (int16_t)nextRandom(rng);
+            int16_t y = (int16_t)nextRandom(rng);
+            controller->avgX = (x > 0) ? x / 32767.0 : x / 32768.0;
+            controller->avgY = (y > 0) ? y / 32767.0 : y / 32768.0;
+            controller->isAnalog = true;
+        }
+    }
+}
+
+static bool isSameInput(const InputContext* a, const InputContext* b) {
+    for(uint32_t c = 0; c < MAX_CONTROLLERS; c++) {
+        const ControllerInput* ca = &a->controllers[c];
+        const ControllerInput* cb = &b->controllers[c];
+
+        if(ca->isAnalog != cb->isAnalog || ca->avgX != cb->avgX || ca->avgY != cb->avgY) {
+            return false;
+        }
+
+        for(uint32_t bt = 0; bt < NUM_BUTTONS; bt++) {
+            if(ca->buttons[bt].halfTransitionCount != cb->buttons[bt].halfTransitionCount ||
+                    ca->buttons[bt].isEndedDown != cb->buttons[bt].isEndedDown) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool verifyInputRecording() {
+    InputContext* frames = (InputContext*)allocateOrDie(VERIFY_INPUT_FRAMES * sizeof(InputContext));
+    InputRecorder* recorder = new InputRecorder;
+    InputPlayer player;
+    uint32_t rng = 0x2468ACE;
+    uint32_t failures = 0;
+
+    InputContext input;
+    for(uint32_t i = 0; i < VERIFY_INPUT_FRAMES; i++) {
+        randomInputFrame(&input, &rng);
+        memcpy((void*)&frames[i], &input, sizeof(InputContext));
+    }
+
+    if(!beginInputRecording(recorder, VERIFY_INPUT_PATH)) {
+        printGeneralErrorAndExit("Could not create input recording");
+    }
+
+    for(uint32_t i = 0; i < VERIFY_INPUT_FRAMES; i++) {
+        if(!recordInputFrame(recorder, &frames[i])) {
+            printGeneralErrorAndExit("Could not record input frame");
+        }
+    }
+
+    if(!stopInputRecording(recorder) || !openInputPlayback(&player, VERIFY_INPUT_PATH)) {
+        printGeneralErrorAndExit("Could not write input recording");
+    }
+
+    //two passes to check it loops back to the start
+    for(uint32_t i = 0; i < 2 * VERIFY_INPUT_FRAMES; i++) {
+        playInputFrame(&player, &input);
+
+        if(!isSameInput(&input, &frames[i % VERIFY_INPUT_FRAMES])) {
+            fprintf(stderr, "input recording differs at frame %u\n", i % VERIFY_INPUT_FRAMES);
+            failures++;
+        }
+    }
+
+    for(uint32_t i = 0; i < VERIFY_INPUT_SEEKS; i++) {
+        uint32_t frame = nextRandom(&rng) % VERIFY_INPUT_FRAMES;
+        playInputFrame(&player, &input);
+
+        if(!seekInputPlayback(&player, frame)) {
+            fprintf(stderr, "input recording could not seek to frame %u\n", frame);
+            failures++;
+            continue;
+        }
+
+        playInputFrame(&player, &input);
+        if(!isSameInput(&input, &frames[frame])) {
+            fprintf(stderr, "input recording differs after seeking to frame %u\n", frame);
+            failures++;
+        }
+    }
+
+    uint64_t fileSize = player.fileSize;
+    closeInputPlayback(&player);
+    unlink(VERIFY_INPUT_PATH);
+    releaseInputRecorder(recorder);
+    delete recorder;
+    munmap(frames, VERIFY_INPUT_FRAMES * sizeof(InputContext));
+
+    printf("verify input: %u frames, %lluB recorded (%lluB raw), %u seeks, %u failures\n",
+            VERIFY_INPUT_FRAMES, (unsigned long long)fileSize,
+            (unsigned long long)VERIFY_INPUT_FRAMES * sizeof(InputContext), VERIFY_INPUT_SEEKS, failures);
+
+    return failures == 0;
+}
+
+static void timeRenderKernels(OffScreenBuffer* osb, uint32_t numFrames) {
+    uint64_t* nanoseconds = (uint64_t*)calloc(numFrames, sizeof(uint64_t));
+    uint64_t* cycles = (uint64_t*)calloc(numFrames, sizeof(uint64_t));
+
+    if(!nanoseconds || !cycles) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+
+    printf("\nrenderWeirdGradient kernels (best: %s)\n", simdLevelNames[getBestSimdLevel()]);
+
+    for(uint32_t k = 0; k < SimdLevel_Count; k++) {
+        if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+            continue;
+        }
+
+        RenderWeirdGradientFunc* kernel = getRenderWeirdGradient((SimdLevel)k, osb->layout);
+
+        for(uint32_t frame = 0; frame < numFrames; frame++) {
+            uint64_t startNanoseconds = debugGetNanoseconds();
+            uint64_t startCycles = __rdtsc();
+
+            kernel(osb, frame, frame * 2);
+
+            cycles[frame] = __rdtsc() - startCycles;
+            nanoseconds[frame] = debugGetNanoseconds() - startNanoseconds;
+        }
+
+        printSummaryLine(simdLevelNames[k], "ns", nanoseconds, numFrames);
+        printSummaryLine(simdLevelNames[k], "cycles", cycles, numFrames);
+    }
+
+    free(nanoseconds);
+    free(cycles);
+}
+
+#define FILL_RATE_SPRITES 256
+#define FILL_RATE_SPRITE_SIZE 64
+
+enum FillRateTest {
+    FillRate_OpaqueRectangle,
+    FillRate_BlendedRectangle,
+    FillRate_Sprites,
+    FillRate_Count
+};
+
+static const char* fillRateNames[FillRate_Count] = {
+    "opaque rectangle",
+    "blended rectangle",
+    "sprites",
+};
+
+//NOTE: Fill rate per draw kernel variant, from the median frame.  Rectangles
+//      cover the whole buffer; sprites are FILL_RATE_SPRITES half transparent
+//      discs at subpixel positions, all inside the buffer so every pixel of
+//      every sprite counts.
+static void timeDrawKernels(OffScreenBuffer* osb, uint32_t numFrames) {
+    uint64_t* nanoseconds = (uint64_t*)calloc(numFrames, sizeof(uint64_t));
+    real32_t* spritePositions = (real32_t*)calloc(2 * FILL_RATE_SPRITES, sizeof(real32_t));
+    Pixel* spritePixels = (Pixel*)calloc(FILL_RATE_SPRITE_SIZE * FILL_RATE_SPRITE_SIZE, sizeof(Pixel));
+
+    if(!nanoseconds || !spritePositions || !spritePixels) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+
+    LoadedBitmap sprite;
+    sprite.width = FILL_RATE_SPRITE_SIZE;
+    sprite.height = FILL_RATE_SPRITE_SIZE;
+    sprite.pitch = FILL_RATE_SPRITE_SIZE * sizeof(Pixel);
+    sprite.pixels = spritePixels;
+    for(uint32_t y = 0; y < FILL_RATE_SPRITE_SIZE; y++) {
+        for(uint32_t x = 0; x < FILL_RATE_SPRITE_SIZE; x++) {
+            int32_t dx = 2 * x + 1 - FILL_RATE_SPRITE_SIZE;
+            int32_t dy = 2 * y + 1 - FILL_RATE_SPRITE_SIZE;
+            uint32_t alpha = (dx * dx + dy * dy < FILL_RATE_SPRITE_SIZE * FILL_RATE_SPRITE_SIZE) ? 160 : 0;
+            spritePixels[y * FILL_RATE_SPRITE_SIZE + x] = packPixel(osb->layout, alpha, alpha / 2, 0, alpha);
+        }
+    }
+
+    uint32_t rng = 0x2468ace;
+    for(uint32_t i = 0; i < FILL_RATE_SPRITES; i++) {
+        spritePositions[2 * i] = (nextRandom(&rng) % (osb->width - FILL_RATE_SPRITE_SIZE + 1)) + .25f;
+        spritePositions[2 * i + 1] = (nextRandom(&rng) % (osb->height - FILL_RATE_SPRITE_SIZE + 1)) + .25f;
+    }
+
+    Pixel opaque = packPixel(osb->layout, 0x20, 0x40, 0x80, 0xFF);
+    Pixel blended = packPixel(osb->layout, 0x10, 0x20, 0x40, 0x80);
+
+    uint64_t pixels[FillRate_Count] = {
+        (uint64_t)osb->width * osb->height,
+        (uint64_t)osb->width * osb->height,
+        (uint64_t)FILL_RATE_SPRITES * FILL_RATE_SPRITE_SIZE * FILL_RATE_SPRITE_SIZE,
+    };
+    real64_t scalarRate[FillRate_Count] = {};
+
+    printf("\ndraw kernels, megapixels per second (median frame)\n");
+
+    for(uint32_t k = 0; k < SimdLevel_Count; k++) {
+        if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+            continue;
+        }
+
+        DrawSpanKernels kernels = getDrawSpanKernels((SimdLevel)k, osb->layout);
+
+        for(uint32_t test = 0; test < FillRate_Count; test++) {
+            for(uint32_t frame = 0; frame < numFrames; frame++) {
+                uint64_t startNanoseconds = debugGetNanoseconds();
+
+                switch(test) {
+                    case FillRate_OpaqueRectangle:
+                        drawRectangle(osb, &kernels, 0.f, 0.f, (real32_t)osb->width, (real32_t)osb->height, opaque);
+                        break;
+                    case FillRate_BlendedRectangle:
+                        drawRectangle(osb, &kernels, 0.f, 0.f, (real32_t)osb->width, (real32_t)osb->height, blended);
+                        break;
+                    default:
+                        for(uint32_t i = 0; i < FILL_RATE_SPRITES; i++) {
+                            drawBitmap(osb, &kernels, &sprite, spritePositions[2 * i], spritePositions[2 * i + 1]);
+                        }
+                        break;
+                }
+
+                nanoseconds[frame] = debugGetNanoseconds() - startNanoseconds;
+            }
+
+            qsort(nanoseconds, numFrames, sizeof(uint64_t), compareU64);
+            uint64_t median = percentile(nanoseconds, numFrames, 50);
+            real64_t rate = (real64_t)pixels[test] * 1000.0 / (median ? median : 1);
+            if(k == SimdLevel_Scalar) {
+                scalarRate[test] = rate;
+            }
+
+            printf("%-20s %-18s %10.1f MP/s %6.2fx scalar\n", simdLevelNames[k], fillRateNames[test], rate,
+                    scalarRate[test] > 0.0 ? rate / scalarRate[test] : 0.0);
+        }
+    }
+
+    free(nanoseconds);
+    free(spritePositions);
+    free(spritePixels);
+}
+
+#define QUAD_SCENE_COUNT 4096
+#define QUAD_SCENE_MAX_FRAMES 100 //the scalar scene is slow, -n past this is ignored
+#define QUAD_SCENE_MIN_SIZE 8
+#define QUAD_SCENE_MAX_SIZE 40
+#define QUAD_TEXTURE_SIZE 64
+
+//NOTE: QUAD_SCENE_COUNT quads at random angles and scales, all inside the
+//      buffer.  Pixels are the summed quad areas, which is what the
+//      rasterizer covers give or take the edges.
+static void timeQuadScene(OffScreenBuffer* osb, uint32_t numFrames) {
+    if(osb->width < 2 * QUAD_SCENE_MAX_SIZE || osb->height < 2 * QUAD_SCENE_MAX_SIZE) {
+        fprintf(stderr, "Warning: buffer too small for the quad scene\n");
+        return;
+    }
+
+    numFrames = (numFrames < QUAD_SCENE_MAX_FRAMES) ? numFrames : QUAD_SCENE_MAX_FRAMES;
+    uint64_t* nanoseconds = (uint64_t*)calloc(numFrames, sizeof(uint64_t));
+    V2* quads = (V2*)calloc(3 * QUAD_SCENE_COUNT, sizeof(V2));
+    Pixel* bitmapPixels = (Pixel*)calloc(QUAD_TEXTURE_SIZE * QUAD_TEXTURE_SIZE, sizeof(Pixel));
+    uint64_t textureMemorySize = QUAD_TEXTURE_SIZE * QUAD_TEXTURE_SIZE * sizeof(Pixel) + CACHE_LINE_SIZE;
+    void* textureMemory = allocateOrDie(textureMemorySize);
+
+    if(!nanoseconds || !quads || !bitmapPixels) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+
+    //checkerboard with a transparent corner, premultiplied
+    LoadedBitmap bitmap;
+    bitmap.width = QUAD_TEXTURE_SIZE;
+    bitmap.height = QUAD_TEXTURE_SIZE;
+    bitmap.pitch = QUAD_TEXTURE_SIZE * sizeof(Pixel);
+    bitmap.pixels = bitmapPixels;
+    for(uint32_t y = 0; y < QUAD_TEXTURE_SIZE; y++) {
+        for(uint32_t x = 0; x < QUAD_TEXTURE_SIZE; x++) {
+            uint8_t alpha = (x + y < QUAD_TEXTURE_SIZE / 2) ? 0 : 224;
+            uint8_t shade = ((x / 8 + y / 8) & 1) ? alpha : alpha / 4;
+            bitmapPixels[y * QUAD_TEXTURE_SIZE + x] = packPixel(osb->layout, shade, alpha / 2, alpha - shade, alpha);
+        }
+    }
+
+    MemoryArena textureArena;
+    initializeArena(&textureArena, textureMemory, textureMemorySize);
+    TiledTexture texture = tileTexture(&textureArena, &bitmap);
+
+    uint32_t rng = 0x13579bd;
+    real64_t totalArea = 0.0;
+    for(uint32_t i = 0; i < QUAD_SCENE_COUNT; i++) {
+        real32_t angle = (nextRandom(&rng) % 1024) * (2.f * pi32 / 1024.f);
+        real32_t width = (real32_t)(QUAD_SCENE_MIN_SIZE + nextRandom(&rng) % (QUAD_SCENE_MAX_SIZE - QUAD_SCENE_MIN_SIZE));
+        real32_t height = (real32_t)(QUAD_SCENE_MIN_SIZE + nextRandom(&rng) % (QUAD_SCENE_MAX_SIZE - QUAD_SCENE_MIN_SIZE));
+        real32_t centreX = QUAD_SCENE_MAX_SIZE + (real32_t)(nextRandom(&rng) % (osb->width - 2 * QUAD_SCENE_MAX_SIZE));
+        real32_t centreY = QUAD_SCENE_MAX_SIZE + (real32_t)(nextRandom(&rng) % (osb->height - 2 * QUAD_SCENE_MAX_SIZE));
+
+        V2* quad = &quads[3 * i];
+        quad[1] = {cosf(angle) * width, sinf(angle) * width};
+        quad[2] = {-sinf(angle) * height, cosf(angle) * height};
+        quad[0] = {centreX - .5f * (quad[1].x + quad[2].x), centreY - .5f * (quad[1].y + quad[2].y)};
+        totalArea += width * height;
+    }
+
+    printf("\ntextured quads, %u quads, %.0f pixels, %u frames (median frame)\n", QUAD_SCENE_COUNT, totalArea, numFrames);
+    printf("%-20s %12s %12s %12s %12s\n", "", "ms/frame", "ns/quad", "ns/pixel", "MP/s");
+
+    real64_t scalarNanoseconds = 0.0;
+    for(uint32_t k = 0; k < SimdLevel_Count; k++) {
+        if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+            continue;
+        }
+
+        DrawSpanKernels kernels = getDrawSpanKernels((SimdLevel)k, osb->layout);
+        RenderWeirdGradientFunc* background = getRenderWeirdGradient((SimdLevel)k, osb->layout);
+
+        for(uint32_t frame = 0; frame < numFrames; frame++) {
+            background(osb, frame, frame);
+            uint64_t startNanoseconds = debugGetNanoseconds();
+
+            for(uint32_t i = 0; i < QUAD_SCENE_COUNT; i++) {
+                drawQuad(osb, &kernels, &texture, quads[3 * i], quads[3 * i + 1], quads[3 * i + 2]);
+            }
+
+            nanoseconds[frame] = debugGetNanoseconds() - startNanoseconds;
+        }
+
+        qsort(nanoseconds, numFrames, sizeof(uint64_t), compareU64);
+        real64_t median = (real64_t)percentile(nanoseconds, numFrames, 50);
+        if(k == SimdLevel_Scalar) {
+            scalarNanoseconds = median;
+        }
+
+        printf("%-20s %12.2f %12.1f %12.2f %12.1f %6.2fx scalar\n", simdLevelNames[k], median / 1e6, median / QUAD_SCENE_COUNT,
+                median / totalArea, totalArea * 1e3 / median, scalarNanoseconds / median);
+    }
+
+    free(nanoseconds);
+    free(quads);
+    free(bitmapPixels);
+    munmap(textureMemory, textureMemorySize);
+}
+
+//NOTE: What outputSound did before the oscillator bank: one sinf per sample
+//      and a phase that grows forever
+//NOTE: What one empty block costs the thread it runs on, begin and end event
+//      included.  Collection is outside the timed part.  Most of it is the two
+//      rdtsc, which are a lot slower under some hypervisors, so time a bare
+//      pair as well.
+static void timeProfileBlock(Profiler* profiler) {
+    uint64_t nanoseconds = 0;
+    uint64_t cycles = 0;
+
+    uint64_t rdtscStartNanoseconds = debugGetNanoseconds();
+    for(uint32_t i = 0; i < PROFILE_COST_BLOCKS; i++) {
+        __rdtsc();
+        __rdtsc();
+    }
+    real64_t rdtscNanoseconds = (real64_t)(debugGetNanoseconds() - rdtscStartNanoseconds) / PROFILE_COST_BLOCKS;
+
+    for(uint32_t done = 0; done < PROFILE_COST_BLOCKS; done += PROFILE_COST_BATCH) {
+        uint64_t startNanoseconds = debugGetNanoseconds();
+        uint64_t startCycles = __rdtsc();
+
+        for(uint32_t i = 0; i < PROFILE_COST_BATCH; i++) {
+            TIMED_BLOCK("emptyBlock");
+        }
+
+        cycles += __rdtsc() - startCycles;
+        nanoseconds += debugGetNanoseconds() - startNanoseconds;
+
+        collectProfileEvents(profiler);
+    }
+
+    uint32_t blocks = (PROFILE_COST_BLOCKS / PROFILE_COST_BATCH) * PROFILE_COST_BATCH;
+    printf("\nempty TIMED_BLOCK: %.1fns %.1f cycles, two bare rdtsc %.1fns (%u blocks, %llu events dropped)\n",
+            (real64_t)nanoseconds / blocks, (real64_t)cycles / blocks, rdtscNanoseconds, blocks,
+            (unsigned long long)profiler->droppedEvents);
+}
+
+static void outputSoundSinf(Sample* samples, uint32_t numSamples, real32_t* t, uint32_t tone, real32_t volume) {
+    real32_t period = SOUND_FREQ / tone;
+
+    for (uint32_t i = 0; i < numSamples; i++) {
+        *t += 2 * pi32 / period;
+        int16_t sample = sinf(*t) * volume;
+        samples[i].leftChannel = sample;
+        samples[i].rightChannel = sample;
+    }
+}
+
+static void printSamplesPerSecond(const char* name, uint32_t voices, uint64_t samples, uint64_t nanoseconds) {
+    real64_t seconds = nanoseconds / 1e9;
+    printf("%-20s %6u %14.2f %18.2f\n", name, voices, samples / seconds / 1e6, samples * (real64_t)voices / seconds / 1e6);
+}
+
+static void timeAudio(uint32_t numFrames) {
+    const uint32_t samplesPerFrame = (uint32_t)(SOUND_FREQ * BENCH_FRAME_SECONDS);
+    const uint32_t voiceCounts[] = {1, 16, 64, MAX_OSCILLATORS};
+    Sample* samples = (Sample*)allocateOrDie(samplesPerFrame * sizeof(Sample));
+    OscillatorBank* bank = (OscillatorBank*)allocateOrDie(sizeof(OscillatorBank));
+
+    printf("\n%-20s %6s %14s %18s\n", "audio", "voices", "Msamples/s", "Mvoice-samples/s");
+
+    real32_t t = 0;
+    uint64_t start = debugGetNanoseconds();
+    for(uint32_t frame = 0; frame < numFrames; frame++) {
+        outputSoundSinf(samples, samplesPerFrame, &t, 512, 2500.f);
+    }
+    printSamplesPerSecond("sinf per sample", 1, (uint64_t)numFrames * samplesPerFrame, debugGetNanoseconds() - start);
+
+    for(uint32_t c = 0; c < ARRAY_SIZE(voiceCounts); c++) {
+        *bank = {};
+        bank->count = voiceCounts[c];
+        for(uint32_t v = 0; v < bank->count; v++) {
+            setOscillator(bank, v, 110.f + 7.f * v, 32000.f / bank->count);
+        }
+
+        start = debugGetNanoseconds();
+        for(uint32_t frame = 0; frame < numFrames; frame++) {
+            mixSoundOutput(bank, nullptr, mixRunScalar, samples, samplesPerFrame);
+        }
+        printSamplesPerSecond("oscillator bank", bank->count, (uint64_t)numFrames * samplesPerFrame, debugGetNanoseconds() - start);
+    }
+
+    //accuracy of the polynomial against sinf over a couple of turns
+    real32_t maxError = 0;
+    for(uint32_t i = 0; i < 100000; i += 4) {
+        alignas(16) real32_t turns[4], approx[4];
+        for(uint32_t j = 0; j < 4; j++) {
+            turns[j] = (i + j) / 50000.f;
+        }
+        _mm_store_ps(approx, sineTurns4(_mm_load_ps(turns)));
+        for(uint32_t j = 0; j < 4; j++) {
+            real32_t error = fabsf(approx[j] - sinf(2.f * pi32 * turns[j]));
+            maxError = (error > maxError) ? error : maxError;
+        }
+    }
+    printf("sineTurns4 max error vs sinf: %g (%.3f int16 steps at full scale)\n", maxError, maxError * 32767.f);
+
+    //sample voices with no oscillators, one frame at a time
+    const uint32_t mixerVoiceCounts[] = {100, 256, MAX_MIXER_VOICES};
+    MixerVoices* voices = (MixerVoices*)allocateOrDie(sizeof(MixerVoices));
+    int16_t* source = (int16_t*)allocateOrDie(MIXER_SOURCE_LENGTH * sizeof(int16_t));
+    uint64_t* nanoseconds = (uint64_t*)calloc(numFrames, sizeof(uint64_t));
+
+    if(!nanoseconds) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+
+    *bank = {};
+    printf("\nmixer, %u samples per frame\n", samplesPerFrame);
+
+    for(uint32_t c = 0; c < ARRAY_SIZE(mixerVoiceCounts); c++) {
+        for(uint32_t k = 0; k < SimdLevel_Count; k++) {
+            if(k == SimdLevel_AVX2 && !cpuSupportsAVX2()) {
+                continue;
+            }
+
+            uint32_t rng = 0x1234567;
+            randomMixerVoices(voices, source, mixerVoiceCounts[c], &rng);
+            MixRunFunc* mixRun = getMixRun((SimdLevel)k);
+
+            for(uint32_t frame = 0; frame < numFrames; frame++) {
+                uint64_t startNanoseconds = debugGetNanoseconds();
+                mixSoundOutput(bank, voices, mixRun, samples, samplesPerFrame);
+                nanoseconds[frame] = debugGetNanoseconds() - startNanoseconds;
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "%s %u voices", simdLevelNames[k], voices->count);
+            printSummaryLine(name, "ns", nanoseconds, numFrames);
+        }
+    }
+
+    free(nanoseconds);
+    munmap(source, MIXER_SOURCE_LENGTH * sizeof(int16_t));
+    munmap(voices, sizeof(MixerVoices));
+    munmap(samples, samplesPerFrame * sizeof(Sample));
+    munmap(bank, sizeof(OscillatorBank));
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    parseOptions(&options, argc, argv);
+
+    if(options.verifyKernels) {
+        bool renderOk = verifyRenderKernels();
+        bool drawOk = verifyDrawKernels();
+        bool mixerOk = verifyMixerKernels();
+        bool inputOk = verifyInputRecording();
+        return (renderOk && drawOk && mixerOk && inputOk) ? 0 : 1;
+    }
+
+    GameUpdateAndRenderFunc* guarf = loadGameCode();
+
+    GameMemory gameMemory;
+    gameMemory.permanentStorageSize = PERMANENT_STORAGE_SIZE;
+    gameMemory.transientStorageSize = TRANSIENT_STORAGE_SIZE;
+    uint64_t gameMemorySize = gameMemory.permanentStorageSize + gameMemory.transientStorageSize;
+    void* memoryBlock = allocateGameMemoryOrDie(gameMemorySize);
+    gameMemory.permanentStorage = memoryBlock;
+    gameMemory.transientStorage = (uint8_t*)memoryBlock + gameMemory.permanentStorageSize;
+
+    loadGameState(memoryBlock, gameMemorySize);
+
+    //NOTE: Always attached, the per-block series come from its frame table.
+    //      Only -profile keeps the events for a trace.
+    if(!(gProfiler = createProfiler())) {
+        printGeneralErrorAndExit("Cannot create profiler");
+    }
+    gameMemory.profiler = gProfiler;
+
+    if(options.profile && !beginProfileCapture(gProfiler, options.numFrames)) {
+        printGeneralErrorAndExit("Cannot allocate memory for the profile capture");
+    }
+
+    if(options.workerCount > 0) {
+        if(!(gameMemory.renderQueue = createWorkQueue(options.workerCount))) {
+            printGeneralErrorAndExit("Cannot create work queue");
+        }
+        gameMemory.platformAddEntry = platformAddEntry;
+        gameMemory.platformCompleteAllWork = platformCompleteAllWork;
+    }
+
+    OffScreenBuffer osb;
+    osb.width = options.width;
+    osb.height = options.height;
+    osb.pitch = alignPow2(options.width * sizeof(Pixel), CACHE_LINE_SIZE);
+    osb.pixels = (Pixel*)allocateOrDie((uint64_t)osb.pitch * osb.height);
+    osb.layout = options.layout;
+
+    GameSoundOutput* sb = (GameSoundOutput*)allocateOrDie(sizeof(GameSoundOutput));
+    *sb = {};
+    sb->volume = 2500;
+    sb->numSamples = (uint32_t)(SOUND_FREQ * BENCH_FRAME_SECONDS);
+
+    InputPlayer player;
+    bool hasInput = openInputPlayback(&player, GAME_INPUT_PATH);
+    if(!hasInput) {
+        fprintf(stderr, "Warning: no usable %s, running with idle input\n", GAME_INPUT_PATH);
+    }
+
+    BenchSeries series[BenchSeries_Count];
+    for(uint32_t i = 0; i < BenchSeries_Count; i++) {
+        series[i].nanoseconds = (uint64_t*)calloc(options.numFrames, sizeof(uint64_t));
+        series[i].cycles = (uint64_t*)calloc(options.numFrames, sizeof(uint64_t));
+
+        if(!series[i].nanoseconds || !series[i].cycles) {
+            printGeneralErrorAndExit("Cannot allocate memory");
+        }
+    }
+
+    FILE* csvFile = nullptr;
+    if(options.csvPath) {
+        if(!(csvFile = fopen(options.csvPath, "w"))) {
+            printGeneralErrorAndExit("Could not open csv file");
+        }
+
+        fprintf(csvFile, "frame");
+        for(uint32_t i = 0; i < BenchSeries_Count; i++) {
+            fprintf(csvFile, ",%s_ns,%s_cycles", benchSeriesNames[i], benchSeriesNames[i]);
+        }
+        fprintf(csvFile, "\n");
+    }
+
+    PlatformFrameStats frameStats;
+    if(options.drawOverlay) {
+        frameStats.isOverlayVisible = true;
+        frameStats.targetMilliseconds = BENCH_FRAME_SECONDS * 1000;
+        gameMemory.frameStats = &frameStats;
+    }
+
+    InputContext input;
+
+    for(uint32_t frame = 0; frame < options.numFrames; frame++) {
+        if(hasInput) {
+            playInputFrame(&player, &input);
+        }
+
+        uint64_t startNanoseconds = debugGetNanoseconds();
+        uint64_t startCycles = __rdtsc();
+
+        guarf(&gameMemory, &osb, sb, &input, BENCH_FRAME_SECONDS);
+
+        uint64_t endCycles = __rdtsc();
+        uint64_t endNanoseconds = debugGetNanoseconds();
+
+        series[BenchSeries_GameUpdateAndRender].nanoseconds[frame] = endNanoseconds - startNanoseconds;
+        series[BenchSeries_GameUpdateAndRender].cycles[frame] = endCycles - startCycles;
+
+        recordFrameTime(&frameStats, (endNanoseconds - startNanoseconds) / 1e6f);
+        endProfileFrame(gProfiler);
+
+        real64_t nanosecondsPerCycle = 1e9 / getProfilerTscPerSecond(gProfiler);
+        for(uint32_t i = 0; i < BenchSeries_Count; i++) {
+            uint32_t site = benchSeriesSites[i] ? findProfileSite(gProfiler, benchSeriesSites[i]) : 0;
+            if(site) {
+                series[i].cycles[frame] = gProfiler->frame[site].cycles;
+                series[i].nanoseconds[frame] = (uint64_t)(gProfiler->frame[site].cycles * nanosecondsPerCycle);
+            }
+        }
+
+        if(csvFile) {
+            fprintf(csvFile, "%u", frame);
+            for(uint32_t i = 0; i < BenchSeries_Count; i++) {
+                fprintf(csvFile, ",%llu,%llu",
+                        (unsigned long long)series[i].nanoseconds[frame],
+                        (unsigned long long)series[i].cycles[frame]);
+            }
+            fprintf(csvFile, "\n");
+        }
+    }
+
+    printf("%u frames at %ux%u, %u samples per frame, %u render threads\n\n",
+            options.numFrames, osb.width, osb.height, sb->numSamples,
+            gameMemory.renderQueue ? gameMemory.renderQueue->threadCount : 1);
+    printf("%-20s %-6s %12s %12s %12s %12s %12s\n", "block", "unit", "mean", "min", "p50", "p99", "max");
+
+    for(uint32_t i = 0; i < BenchSeries_Count; i++) {
+        printSummaryLine(benchSeriesNames[i], "ns", series[i].nanoseconds, options.numFrames);
+        printSummaryLine(benchSeriesNames[i], "cycles", series[i].cycles, options.numFrames);
+    }
+
+#if HANDMADE_INTERNAL
+    static const char* arenaNames[DebugArena_Count] = {"permanent", "transient"};
+
+    printf("\n%-20s %12s %12s %12s\n", "arena", "used KB", "peak KB", "size KB");
+    for(uint32_t i = 0; i < DebugArena_Count; i++) {
+        printf("%-20s %12.1f %12.1f %12.1f\n", arenaNames[i], gameMemory.arenas[i].used / 1024.0,
+                gameMemory.arenas[i].highWater / 1024.0, gameMemory.arenas[i].size / 1024.0);
+    }
+#endif
+
+    if(options.profile) {
+        printf("\n");
+        printProfileTable(gProfiler, stdout);
+        if(!writeChromeTrace(gProfiler, BENCH_TRACE_PATH)) {
+            fprintf(stderr, "Warning: could not write %s\n", BENCH_TRACE_PATH);
+        }
+        timeProfileBlock(gProfiler);
+    }
+
+    if(options.timeKernels) {
+        timeRenderKernels(&osb, options.numFrames);
+        timeDrawKernels(&osb, options.numFrames);
+    }
+
+    if(options.timeQuads) {
+        timeQuadScene(&osb, options.numFrames);
+    }
+
+    if(options.timeAudio) {
+        timeAudio(options.numFrames);
+    }
+
+    if(csvFile) {
+        fclose(csvFile);
+    }
+
+    if(hasInput) {
+        closeInputPlayback(&player);
+    }
+
+    if(gameMemory.renderQueue) {
+        destroyWorkQueue(gameMemory.renderQueue);
+    }
+
+    destroyProfiler(gProfiler);
+
+    return 0;
+}
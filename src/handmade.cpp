@@ -1,59 +1,157 @@
 #include <math.h>
 #include "handmade.hpp"
+#include "handmade_render.hpp"
+#include "handmade_audio.hpp"
+#include "handmade_profiler.hpp"
+#include "handmade_overlay.hpp"
+
+//NOTE: Picked the first time this copy of the game library renders, so a
+//      reload re-runs the cpuid check.  The render kernels are picked again if
+//      the buffer comes in another layout.
+static RenderWeirdGradientFunc* renderWeirdGradient;
+static MixRunFunc* mixRun;
+static DrawSpanKernels drawKernels;
+
+//NOTE: Tile widths are a multiple of 16 pixels (one 64 byte cache line).  The
+//      platform hands us 64 byte aligned rows, so no two tiles ever write to
+//      the same cache line.
+#define RENDER_TILE_WIDTH 256
+#define RENDER_TILE_HEIGHT 32
+
+struct alignas(CACHE_LINE_SIZE) RenderTileWork {
+    OffScreenBuffer tile;
+    int blueOffset;
+    int greenOffset;
+};
+
+static void renderTile(PlatformWorkQueue* queue, void* data) {
+    TIMED_BLOCK("renderTile");
+    RenderTileWork* work = (RenderTileWork*)data;
+    renderWeirdGradient(&work->tile, work->blueOffset, work->greenOffset);
+}
 
-static void renderWeirdGradient(OffScreenBuffer *buf, int blueOffset, int greenOffset) {
-    Pixel *pixels = buf->pixels;
-
-    for (uint32_t y = 0; y < buf->height; y++) {
-
-        Pixel *currPixel = pixels; 
-
-        for (uint32_t x = 0; x < buf->width; x++) {
-            currPixel->b = x + blueOffset;
-            currPixel->g = y + greenOffset;
+//NOTE: Tile work comes from frameArena and has to outlive the jobs, which it
+//      does since we wait for all of them before returning
+static void renderTiled(GameMemory* memory, MemoryArena* frameArena, OffScreenBuffer* buf, int blueOffset, int greenOffset) {
+    TIMED_BLOCK("renderTiled");
+    uint32_t tileCountX = (buf->width + RENDER_TILE_WIDTH - 1) / RENDER_TILE_WIDTH;
+    uint32_t tileCountY = (buf->height + RENDER_TILE_HEIGHT - 1) / RENDER_TILE_HEIGHT;
+    uint32_t tileCount = tileCountX * tileCountY;
+
+    if(!memory->renderQueue || !arenaHasRoomFor(frameArena, tileCount * sizeof(RenderTileWork), alignof(RenderTileWork))) {
+        renderWeirdGradient(buf, blueOffset, greenOffset);
+        return;
+    }
 
-            currPixel++;
+    RenderTileWork* renderTileWork = pushArray(frameArena, tileCount, RenderTileWork);
+    uint32_t tileIndex = 0;
+    for(uint32_t tileY = 0; tileY < tileCountY; tileY++) {
+        for(uint32_t tileX = 0; tileX < tileCountX; tileX++) {
+            uint32_t minX = tileX * RENDER_TILE_WIDTH;
+            uint32_t minY = tileY * RENDER_TILE_HEIGHT;
+            uint32_t maxX = (minX + RENDER_TILE_WIDTH < buf->width) ? minX + RENDER_TILE_WIDTH : buf->width;
+            uint32_t maxY = (minY + RENDER_TILE_HEIGHT < buf->height) ? minY + RENDER_TILE_HEIGHT : buf->height;
+
+            RenderTileWork* work = &renderTileWork[tileIndex++];
+            work->tile.pixels = getRow(buf, minY) + minX;
+            work->tile.width = maxX - minX;
+            work->tile.height = maxY - minY;
+            work->tile.pitch = buf->pitch;
+            work->tile.layout = buf->layout;
+            //the gradient is a function of the pixel position, shift it into tile space
+            work->blueOffset = blueOffset + minX;
+            work->greenOffset = greenOffset + minY;
+
+            memory->platformAddEntry(memory->renderQueue, renderTile, work);
         }
-
-        pixels += buf->width;
     }
-}
-
-
-static void outputSound(GameSoundOutput* sb, uint32_t tone) {
-
-    real32_t period = SOUND_FREQ / tone;
-
 
+    memory->platformCompleteAllWork(memory->renderQueue);
+}
 
-    for (uint32_t i = 0; i < sb->numSamples; i++) {
+#define PLAYER_SIZE 48
+
+//NOTE: Stand-in sprite until we load art: a disc with a soft edge, in
+//      premultiplied alpha
+static LoadedBitmap makePlayerBitmap(MemoryArena* arena, PixelLayout layout) {
+    LoadedBitmap bitmap;
+    bitmap.width = PLAYER_SIZE;
+    bitmap.height = PLAYER_SIZE;
+    bitmap.pitch = PLAYER_SIZE * sizeof(Pixel);
+    bitmap.pixels = pushArray(arena, PLAYER_SIZE * PLAYER_SIZE, Pixel);
+
+    real32_t radius = PLAYER_SIZE * .5f;
+    for(uint32_t y = 0; y < bitmap.height; y++) {
+        for(uint32_t x = 0; x < bitmap.width; x++) {
+            real32_t dx = x + .5f - radius;
+            real32_t dy = y + .5f - radius;
+            real32_t coverage = radius - sqrtf(dx * dx + dy * dy);
+            coverage = (coverage < 0.f) ? 0.f : ((coverage > 1.f) ? 1.f : coverage);
+
+            bitmap.pixels[y * PLAYER_SIZE + x] = packPixel(layout,
+                    (uint8_t)(255.f * coverage + .5f), (uint8_t)(200.f * coverage + .5f),
+                    (uint8_t)(64.f * coverage + .5f), (uint8_t)(255.f * coverage + .5f));
+        }
+    }
 
-        sb->t += 2 * pi32 / period;
-        real32_t sineVal = sinf(sb->t);
+    return bitmap;
+}
 
+static void outputSound(GameState* state, GameSoundOutput* sb) {
+    TIMED_BLOCK("outputSound");
 #if 0 
-        int16_t sample = sineVal * sb->volume;
+    real32_t volume = (real32_t)sb->volume;
 #else
-        int16_t sample = 0;
+    real32_t volume = 0.f;
 #endif
-        sb->samples[i].leftChannel = sample;  //left channel 
-        sb->samples[i].rightChannel = sample; //right channel
+    state->oscillators.count = 1;
+    setOscillator(&state->oscillators, 0, (real32_t)state->tone, volume);
 
-    }
-    
+    mixSoundOutput(&state->oscillators, &state->voices, mixRun, sb->samples, sb->numSamples);
 }
 
 #ifndef NDEBUG 
 extern "C"
 #endif
 void gameUpdateAndRender(GameMemory* memory, OffScreenBuffer *buf, GameSoundOutput* sb, const InputContext* inputContext, real32_t secsSinceLastFrame) {
+#if HANDMADE_INTERNAL
+    gProfiler = memory->profiler;
+#endif
+    TIMED_BLOCK("gameUpdateAndRender");
+    assert(sizeof(GameState) <= memory->permanentStorageSize);
+    assert(sizeof(TransientState) <= memory->transientStorageSize);
     GameState* state = (GameState*)memory->permanentStorage;
+    TransientState* tranState = (TransientState*)memory->transientStorage;
+
+    if(!renderWeirdGradient || drawKernels.layout != buf->layout) {
+        renderWeirdGradient = getRenderWeirdGradient(getBestSimdLevel(), buf->layout);
+        mixRun = getMixRun(getBestSimdLevel());
+        drawKernels = getDrawSpanKernels(getBestSimdLevel(), buf->layout);
+    }
 
     if(!state->isInited) {
+        initializeArena(&state->permanentArena, (uint8_t*)memory->permanentStorage + sizeof(GameState),
+                memory->permanentStorageSize - sizeof(GameState));
         state->tone = 512;
         state->isInited = true;
     }
 
+    //NOTE: A saved state can come back at another address (the bench loads
+    //      one into its own block).  Allocations keep their offsets, so only
+    //      the base moves.
+    state->permanentArena.base = (uint8_t*)memory->permanentStorage + sizeof(GameState);
+
+    uint8_t* transientBase = (uint8_t*)memory->transientStorage + sizeof(TransientState);
+    if(!tranState->isInited || tranState->arena.base != transientBase || tranState->layout != buf->layout) {
+        initializeArena(&tranState->arena, transientBase, memory->transientStorageSize - sizeof(TransientState));
+        tranState->layout = buf->layout;
+        tranState->playerBitmap = makePlayerBitmap(&tranState->arena, buf->layout);
+        tranState->playerTexture = tileTexture(&tranState->arena, &tranState->playerBitmap);
+        tranState->isInited = true;
+    }
+
+    TemporaryMemory frameMemory = beginTemporaryMemory(&tranState->arena);
+
     for(uint32_t i = 0; i < ARRAY_SIZE(inputContext->controllers); i++) {
         const ControllerInput* ci = &inputContext->controllers[i]; 
 
@@ -83,6 +181,47 @@ void gameUpdateAndRender(GameMemory* memory, OffScreenBuffer *buf, GameSoundOutp
     }
 
 
-    outputSound(sb, state->tone);
-    renderWeirdGradient(buf, state->blueOffset, state->greenOffset);
+    outputSound(state, sb);
+    renderTiled(memory, &tranState->arena, buf, state->blueOffset, state->greenOffset);
+
+    {
+        TIMED_BLOCK("drawPlayer");
+        real32_t playerX = (buf->width - PLAYER_SIZE) * .5f;
+        real32_t playerY = (buf->height - PLAYER_SIZE) * .5f;
+        Pixel shadow = packPixel(buf->layout, 0, 0, 0, 96);
+        drawRectangle(buf, &drawKernels, playerX + 6.f, playerY + PLAYER_SIZE - 4.f,
+                playerX + PLAYER_SIZE - 6.f, playerY + PLAYER_SIZE + 4.f, shadow);
+        drawBitmap(buf, &drawKernels, &tranState->playerBitmap, playerX, playerY);
+
+        //a smaller copy circling the player, turning as it goes
+        state->orbitAngle += secsSinceLastFrame;
+        if(state->orbitAngle > 2.f * pi32) {
+            state->orbitAngle -= 2.f * pi32;
+        }
+        real32_t c = cosf(state->orbitAngle);
+        real32_t s = sinf(state->orbitAngle);
+        real32_t size = PLAYER_SIZE * .5f;
+        V2 xAxis = {c * size, s * size};
+        V2 yAxis = {-s * size, c * size};
+        V2 centre = {playerX + PLAYER_SIZE * .5f + c * PLAYER_SIZE, playerY + PLAYER_SIZE * .5f + s * PLAYER_SIZE};
+        V2 origin = {centre.x - .5f * (xAxis.x + yAxis.x), centre.y - .5f * (xAxis.y + yAxis.y)};
+        drawQuad(buf, &drawKernels, &tranState->playerTexture, origin, xAxis, yAxis);
+    }
+
+    if(memory->frameStats && memory->frameStats->isOverlayVisible) {
+        TIMED_BLOCK("drawDebugOverlay");
+        drawDebugOverlay(buf, memory->frameStats, &state->permanentArena, &tranState->arena);
+    }
+
+    endTemporaryMemory(frameMemory);
+    checkArena(&tranState->arena);
+
+#if HANDMADE_INTERNAL
+    MemoryArena* arenas[DebugArena_Count] = {&state->permanentArena, &tranState->arena};
+    for(uint32_t i = 0; i < DebugArena_Count; i++) {
+        memory->arenas[i].used = arenas[i]->used;
+        memory->arenas[i].highWater = arenas[i]->highWater;
+        memory->arenas[i].size = arenas[i]->size;
+    }
+#endif
 }
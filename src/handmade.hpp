@@ -1,14 +1,17 @@
 #pragma once
 
 #include <stdint.h>
+#include <assert.h>
 #include <stdio.h>
+#include <time.h>
+#include <x86intrin.h>
 
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
 
 #define SOUND_FREQ 48000
 #define NUM_CHANNELS 2
-#define SOUND_LATENCY (SOUND_FREQ / 15)
+#define SOUND_LATENCY (SOUND_FREQ / 15) //starting write-ahead, the platform adapts it from there
 
 #define LEFT_THUMB_DEADZONE  7849
 #define RIGHT_THUMB_DEADZONE 8689
@@ -19,6 +22,16 @@
 
 #define NUM_BUTTONS 12
 
+#define GAME_LIB_PATH "./game.so"
+#define GAME_INPUT_PATH "game_input.bin"
+#define GAME_STATE_PATH "game_state.bin"
+
+#define CACHE_LINE_SIZE 64
+
+#define PERMANENT_STORAGE_SIZE MB(64)
+#define TRANSIENT_STORAGE_SIZE MB(64)
+#define GAME_MEMORY_BASE_ADDRESS TB(2) //where the platform asks for the block in internal builds
+
 //utility macros/inline functions
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
 
@@ -38,10 +51,101 @@ inline uint64_t TB(uint64_t num) {
     return GB(num)*1024ll;
 }
 
+inline uint32_t alignPow2(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+//NOTE: Bump allocator over a fixed block, the only way the game gets memory.
+//      Nothing is freed on its own; a TemporaryMemory scope rolls the arena
+//      back to where it was when the scope began.  highWater is the most the
+//      arena ever had in use, scopes included.  Not thread safe, push from
+//      one thread and hand the results to the workers.
+struct MemoryArena {
+    uint8_t* base;
+    uint64_t size;
+    uint64_t used;
+    uint64_t highWater;
+    uint32_t tempCount;
+};
+
+struct TemporaryMemory {
+    MemoryArena* arena;
+    uint64_t used;
+};
+
+inline void initializeArena(MemoryArena* arena, void* base, uint64_t size) {
+    arena->base = (uint8_t*)base;
+    arena->size = size;
+    arena->used = 0;
+    arena->highWater = 0;
+    arena->tempCount = 0;
+}
+
+//NOTE: alignment must be a power of two
+inline uint64_t getAlignmentOffset(MemoryArena* arena, uint64_t alignment) {
+    uint64_t address = (uint64_t)(arena->base + arena->used);
+    return ((address + alignment - 1) & ~(alignment - 1)) - address;
+}
+
+inline bool arenaHasRoomFor(MemoryArena* arena, uint64_t size, uint64_t alignment) {
+    return arena->used + getAlignmentOffset(arena, alignment) + size <= arena->size;
+}
+
+inline void* pushSize_(MemoryArena* arena, uint64_t size, uint64_t alignment) {
+    uint64_t offset = getAlignmentOffset(arena, alignment);
+    assert(arena->used + offset + size <= arena->size);
+
+    void* result = arena->base + arena->used + offset;
+    arena->used += offset + size;
+
+    if(arena->used > arena->highWater) {
+        arena->highWater = arena->used;
+    }
+
+    return result;
+}
+
+#define pushStruct(arena, type) (type*)pushSize_(arena, sizeof(type), alignof(type))
+#define pushArray(arena, count, type) (type*)pushSize_(arena, (count) * sizeof(type), alignof(type))
+#define pushSize(arena, size) pushSize_(arena, size, 16)
+
+//NOTE: Carves size bytes out of arena for a child that is then managed on
+//      its own.  The parent never gets them back short of a temporary scope.
+inline void subArena(MemoryArena* result, MemoryArena* arena, uint64_t size, uint64_t alignment = 16) {
+    initializeArena(result, pushSize_(arena, size, alignment), size);
+}
+
+inline TemporaryMemory beginTemporaryMemory(MemoryArena* arena) {
+    TemporaryMemory result;
+    result.arena = arena;
+    result.used = arena->used;
+
+    arena->tempCount++;
+
+    return result;
+}
+
+inline void endTemporaryMemory(TemporaryMemory temp) {
+    MemoryArena* arena = temp.arena;
+    assert(arena->used >= temp.used);
+    assert(arena->tempCount > 0);
+
+    arena->used = temp.used;
+    arena->tempCount--;
+}
+
+//NOTE: Every scope has to be closed by the time this is called
+inline void checkArena(MemoryArena* arena) {
+    assert(arena->tempCount == 0);
+}
+
 typedef float real32_t;
 typedef double real64_t;
 
 
+//NOTE: The named channels are SDL_PIXELFORMAT_RGBA8888, PixelLayout_RGBA.
+//      Buffers can be in any PixelLayout, so anything that ends up in one is
+//      built with packPixel for that buffer's layout.
 union Pixel {
     struct {
         uint8_t a;
@@ -54,6 +158,51 @@ union Pixel {
 
 };
 
+//NOTE: Where the channels sit in Pixel::value, named high byte to low like
+//      the SDL packed formats.  The X formats share the layout of their A
+//      counterpart, the texture ignores that byte.
+enum PixelLayout {
+    PixelLayout_RGBA,
+    PixelLayout_ARGB,
+    PixelLayout_ABGR,
+    PixelLayout_BGRA,
+    PixelLayout_Count
+};
+
+static const char* const pixelLayoutNames[PixelLayout_Count] = {
+    "rgba",
+    "argb",
+    "abgr",
+    "bgra",
+};
+
+constexpr uint32_t getRedShift(PixelLayout layout) {
+    return (layout == PixelLayout_RGBA) ? 24 : (layout == PixelLayout_ARGB) ? 16 : (layout == PixelLayout_ABGR) ? 0 : 8;
+}
+
+constexpr uint32_t getGreenShift(PixelLayout layout) {
+    return (layout == PixelLayout_RGBA || layout == PixelLayout_BGRA) ? 16 : 8;
+}
+
+constexpr uint32_t getBlueShift(PixelLayout layout) {
+    return (layout == PixelLayout_RGBA) ? 8 : (layout == PixelLayout_ARGB) ? 0 : (layout == PixelLayout_ABGR) ? 16 : 24;
+}
+
+constexpr uint32_t getAlphaShift(PixelLayout layout) {
+    return (layout == PixelLayout_RGBA || layout == PixelLayout_BGRA) ? 0 : 24;
+}
+
+inline Pixel packPixel(PixelLayout layout, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    Pixel p;
+    p.value = ((uint32_t)r << getRedShift(layout)) | ((uint32_t)g << getGreenShift(layout)) |
+        ((uint32_t)b << getBlueShift(layout)) | ((uint32_t)a << getAlphaShift(layout));
+    return p;
+}
+
+inline uint8_t getPixelAlpha(Pixel p, PixelLayout layout) {
+    return (uint8_t)(p.value >> getAlphaShift(layout));
+}
+
 struct Sample{
     int16_t leftChannel = 0;
     int16_t rightChannel = 0;
@@ -61,7 +210,6 @@ struct Sample{
 
 struct GameSoundOutput {
     uint32_t volume = 0;
-    real32_t t = 0; //used for argument in sine
     uint32_t numSamples = 0;
     Sample samples[SOUND_FREQ];
 };
@@ -71,26 +219,199 @@ struct OffScreenBuffer{
     uint32_t width = 0;
     uint32_t height = 0;
     uint32_t pitch = 0;
+    PixelLayout layout = PixelLayout_RGBA; //picked by the platform to match the window
 };
 
+//NOTE: Laid out like OffScreenBuffer, pitch in bytes, premultiplied alpha,
+//      pixels in the layout of the buffer it gets drawn into
+struct LoadedBitmap {
+    Pixel* pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pitch = 0;
+};
+
+#define TEXTURE_TILE_SIZE 4 //4x4 texels, one cache line
+#define TEXTURE_MAX_SIZE 4096
+
+//NOTE: Premultiplied texels in TEXTURE_TILE_SIZE square tiles, row major
+//      inside a tile and tiles row major.  A bilinear footprint mostly falls
+//      in one cache line whatever the direction the quad walks the texture.
+struct TiledTexture {
+    Pixel* texels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t tilesPerRow = 0;
+};
+
+struct V2 {
+    real32_t x;
+    real32_t y;
+};
+
+//NOTE: No default member initializers here.  ButtonState lives in an anonymous
+//      struct inside ControllerInput, which requires a trivial type; the
+//      ControllerInput constructor zeroes it instead.
 struct ButtonState {
-    uint32_t halfTransitionCount = 0;
-    bool isEndedDown = false;
+    uint32_t halfTransitionCount;
+    bool isEndedDown;
+};
+
+#if HANDMADE_INTERNAL
+//NOTE: The game copies these out of its arenas at the end of every frame
+enum DebugArenaType {
+    DebugArena_Permanent,
+    DebugArena_Transient,
+    DebugArena_Count
+};
+
+struct DebugArenaUsage {
+    uint64_t used;
+    uint64_t highWater;
+    uint64_t size;
+};
+
+inline uint64_t debugGetNanoseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+//NOTE: Frame timing the platform measured, for the game's debug overlay.
+//      Lives outside game memory so rewinds and snapshots leave it alone.
+//      recordFrameTime keeps the ring, the histogram and the percentiles in step.
+#define FRAME_STATS_HISTORY 256
+#define FRAME_STATS_BUCKETS 256
+#define FRAME_STATS_BUCKET_MS .25f //the last bucket takes everything from 63.75ms up
+
+struct PlatformFrameStats {
+    real32_t frameMilliseconds[FRAME_STATS_HISTORY] = {}; //newest at (frameCount - 1) % FRAME_STATS_HISTORY
+    uint16_t histogram[FRAME_STATS_BUCKETS] = {};         //of the frames in frameMilliseconds
+    uint32_t frameCount = 0;
+    real32_t targetMilliseconds = 0;
+    real32_t p50Milliseconds = 0;
+    real32_t p99Milliseconds = 0;
+
+    real32_t audioLatencyMilliseconds = 0;
+    real32_t audioTargetMilliseconds = 0;
+    uint32_t audioUnderruns = 0;
+
+    real32_t renderScale = 1.f; //of the window size the game draws at, the buffer size is already scaled
+
+    bool isOverlayVisible = false;
 };
 
+inline uint32_t getFrameStatsBucket(real32_t milliseconds) {
+    uint32_t bucket = (uint32_t)(milliseconds / FRAME_STATS_BUCKET_MS);
+    return (bucket < FRAME_STATS_BUCKETS) ? bucket : FRAME_STATS_BUCKETS - 1;
+}
+
+//NOTE: Upper edge of the bucket the pct percentile frame falls in
+inline real32_t getFrameStatsPercentile(const PlatformFrameStats* stats, uint32_t count, uint32_t pct) {
+    uint32_t rank = (count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for(uint32_t bucket = 0; bucket < FRAME_STATS_BUCKETS; bucket++) {
+        seen += stats->histogram[bucket];
+        if(seen >= rank && seen > 0) {
+            return (bucket + 1) * FRAME_STATS_BUCKET_MS;
+        }
+    }
+    return 0;
+}
+
+//NOTE: Platform side, once a frame with the time the frame took
+inline void recordFrameTime(PlatformFrameStats* stats, real32_t milliseconds) {
+    uint32_t slot = stats->frameCount % FRAME_STATS_HISTORY;
+    if(stats->frameCount >= FRAME_STATS_HISTORY) {
+        stats->histogram[getFrameStatsBucket(stats->frameMilliseconds[slot])]--;
+    }
+
+    stats->frameMilliseconds[slot] = milliseconds;
+    stats->histogram[getFrameStatsBucket(milliseconds)]++;
+    stats->frameCount++;
+
+    uint32_t count = (stats->frameCount < FRAME_STATS_HISTORY) ? stats->frameCount : FRAME_STATS_HISTORY;
+    stats->p50Milliseconds = getFrameStatsPercentile(stats, count, 50);
+    stats->p99Milliseconds = getFrameStatsPercentile(stats, count, 99);
+}
+
+//NOTE: Job system the platform hands the game.  Entries added from one frame
+//      may run on any thread in any order; platformCompleteAllWork returns once
+//      every entry added so far has finished.
+struct PlatformWorkQueue;
+typedef void PlatformWorkQueueCallback(PlatformWorkQueue* queue, void* data);
+typedef void PlatformAddEntryFunc(PlatformWorkQueue* queue, PlatformWorkQueueCallback* callback, void* data);
+typedef void PlatformCompleteAllWorkFunc(PlatformWorkQueue* queue);
+
+//NOTE: See handmade_profiler.hpp, null runs the game's TIMED_BLOCKs as no-ops
+struct Profiler;
+
 struct GameMemory {
     void* permanentStorage = nullptr;
     uint64_t permanentStorageSize = 0;
     void* transientStorage = nullptr;
     uint64_t transientStorageSize = 0;
 
+    //null when the platform has no worker threads, render on the calling thread then
+    PlatformWorkQueue* renderQueue = nullptr;
+    PlatformAddEntryFunc* platformAddEntry = nullptr;
+    PlatformCompleteAllWorkFunc* platformCompleteAllWork = nullptr;
+
+    //null when the platform doesn't measure, the overlay is off then
+    const PlatformFrameStats* frameStats = nullptr;
+
+#if HANDMADE_INTERNAL
+    DebugArenaUsage arenas[DebugArena_Count] = {};
+    Profiler* profiler = nullptr;
+#endif
+};
+
+
+#define MAX_OSCILLATORS 256
+
+//NOTE: Voices for the oscillator bank in handmade_audio.hpp, stored as
+//      parallel arrays so the render loop can run across them with SIMD
+struct OscillatorBank {
+    uint32_t count;
+    alignas(16) real32_t phase[MAX_OSCILLATORS];          //turns, always in [0, 1)
+    alignas(16) real32_t phaseIncrement[MAX_OSCILLATORS]; //turns per sample, frequency / SOUND_FREQ
+    alignas(16) real32_t volume[MAX_OSCILLATORS];         //peak amplitude in int16 units
+};
+
+#define MAX_MIXER_VOICES 512
+
+//NOTE: Looping mono int16 sources mixed by handmade_audio.hpp, one array per
+//      field so the mix loop only touches what it needs
+struct MixerVoices {
+    uint32_t count;
+    const int16_t* source[MAX_MIXER_VOICES];
+    uint32_t sourceLength[MAX_MIXER_VOICES];   //in samples
+    uint32_t position[MAX_MIXER_VOICES];       //next sample to play, < sourceLength
+    real32_t volume[MAX_MIXER_VOICES];         //1 plays the source as is
+    real32_t pan[MAX_MIXER_VOICES];            //-1 hard left, 0 centre, 1 hard right
 };
 
+//NOTE: Lives at the start of permanentStorage, the arena hands out the rest
 struct GameState {
     bool isInited = false;
+    MemoryArena permanentArena;
     int blueOffset = 0;
     int greenOffset = 0;
     uint32_t tone = 0;
+    real32_t orbitAngle = 0.f;
+    OscillatorBank oscillators;
+    MixerVoices voices;
+};
+
+//NOTE: Lives at the start of transientStorage.  Anything in here can be
+//      thrown away at any time, the game rebuilds it when it is missing.
+struct TransientState {
+    bool isInited = false;
+    MemoryArena arena; //frame scratch comes from a scope that ends with the frame
+    PixelLayout layout = PixelLayout_RGBA; //of the bitmaps below, they are rebuilt when the buffer's changes
+    LoadedBitmap playerBitmap; //built at the bottom of arena, below the frame scope
+    TiledTexture playerTexture;
 };
 
 struct ControllerInput {
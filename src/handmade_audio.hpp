@@ -0,0 +1,214 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <immintrin.h>
+#include "handmade.hpp"
+#include "handmade_intrinsics.hpp"
+
+//NOTE: Sound mixer shared by the game and the bench driver.  Oscillators and
+//      sample voices are summed MIX_BLOCK_SIZE samples at a time into float
+//      accumulators that stay in L1, then packed to int16 with saturation.
+//      Oscillator phase is kept in turns and wrapped to [0, 1) so it never
+//      loses precision no matter how long the game runs.
+
+#define MIX_BLOCK_SIZE 256 //must be a multiple of 8
+
+typedef void MixRunFunc(const int16_t* source, real32_t* left, real32_t* right, uint32_t numSamples, real32_t leftGain, real32_t rightGain);
+
+inline void setOscillator(OscillatorBank* bank, uint32_t index, real32_t frequency, real32_t volume) {
+    bank->phaseIncrement[index] = frequency / SOUND_FREQ;
+    bank->volume[index] = volume;
+}
+
+//NOTE: sin(2*pi*turns) for turns >= 0.  Reduce to [-.5, .5], fold into
+//      [-.25, .25] using sin(pi - x) = sin(x) and finish with a 9th order odd
+//      polynomial, which is good to ~4e-6, well under one int16 step.
+inline __m128 sineTurns4(__m128 turns) {
+    const __m128 signMask = _mm_set1_ps(-0.f);
+    const __m128 half = _mm_set1_ps(.5f);
+    const __m128 quarter = _mm_set1_ps(.25f);
+
+    __m128 y = _mm_sub_ps(turns, _mm_cvtepi32_ps(_mm_cvtps_epi32(turns)));
+
+    __m128 sign = _mm_and_ps(y, signMask);
+    __m128 folded = _mm_sub_ps(_mm_or_ps(half, sign), y);
+    __m128 needsFold = _mm_cmpgt_ps(_mm_andnot_ps(signMask, y), quarter);
+    y = _mm_or_ps(_mm_and_ps(needsFold, folded), _mm_andnot_ps(needsFold, y));
+
+    __m128 x = _mm_mul_ps(y, _mm_set1_ps(2.f * pi32));
+    __m128 x2 = _mm_mul_ps(x, x);
+
+    __m128 p = _mm_set1_ps(1.f / 362880.f);
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.f / 5040.f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.f / 120.f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(-1.f / 6.f));
+    p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.f));
+
+    return _mm_mul_ps(p, x);
+}
+
+//NOTE: Adds every voice into accumulator[0, numSamples).  The accumulator must
+//      have room for numSamples rounded up to a multiple of 4.
+static void renderOscillatorBlock(OscillatorBank* bank, real32_t* accumulator, uint32_t numSamples) {
+    for(uint32_t v = 0; v < bank->count; v++) {
+        real32_t inc = bank->phaseIncrement[v];
+        real32_t startPhase = bank->phase[v];
+
+        __m128 phase = _mm_add_ps(_mm_set1_ps(startPhase), _mm_mul_ps(_mm_setr_ps(0.f, 1.f, 2.f, 3.f), _mm_set1_ps(inc)));
+        __m128 step = _mm_set1_ps(4.f * inc);
+        __m128 volume = _mm_set1_ps(bank->volume[v]);
+
+        for(uint32_t i = 0; i < numSamples; i += 4) {
+            __m128 acc = _mm_load_ps(accumulator + i);
+            acc = _mm_add_ps(acc, _mm_mul_ps(volume, sineTurns4(phase)));
+            _mm_store_ps(accumulator + i, acc);
+
+            phase = _mm_add_ps(phase, step);
+            phase = _mm_sub_ps(phase, _mm_cvtepi32_ps(_mm_cvttps_epi32(phase)));
+        }
+
+        //NOTE: Advance by exactly numSamples, not the rounded up count
+        real32_t endPhase = startPhase + inc * numSamples;
+        bank->phase[v] = endPhase - (int32_t)endPhase;
+    }
+}
+
+static void mixRunScalar(const int16_t* source, real32_t* left, real32_t* right, uint32_t numSamples, real32_t leftGain, real32_t rightGain) {
+    for(uint32_t i = 0; i < numSamples; i++) {
+        real32_t value = source[i];
+        left[i] += value * leftGain;
+        right[i] += value * rightGain;
+    }
+}
+
+static void mixRunSSE2(const int16_t* source, real32_t* left, real32_t* right, uint32_t numSamples, real32_t leftGain, real32_t rightGain) {
+    __m128 leftGain4 = _mm_set1_ps(leftGain);
+    __m128 rightGain4 = _mm_set1_ps(rightGain);
+    uint32_t i = 0;
+
+    for(; i + 4 <= numSamples; i += 4) {
+        //sign extend four int16 to int32 by shifting them into the high half and back
+        __m128i raw = _mm_loadl_epi64((const __m128i*)(source + i));
+        __m128 value = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16));
+
+        _mm_storeu_ps(left + i, _mm_add_ps(_mm_loadu_ps(left + i), _mm_mul_ps(value, leftGain4)));
+        _mm_storeu_ps(right + i, _mm_add_ps(_mm_loadu_ps(right + i), _mm_mul_ps(value, rightGain4)));
+    }
+
+    mixRunScalar(source + i, left + i, right + i, numSamples - i, leftGain, rightGain);
+}
+
+__attribute__((target("avx2")))
+static void mixRunAVX2(const int16_t* source, real32_t* left, real32_t* right, uint32_t numSamples, real32_t leftGain, real32_t rightGain) {
+    __m256 leftGain8 = _mm256_set1_ps(leftGain);
+    __m256 rightGain8 = _mm256_set1_ps(rightGain);
+    uint32_t i = 0;
+
+    for(; i + 8 <= numSamples; i += 8) {
+        __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(source + i))));
+
+        _mm256_storeu_ps(left + i, _mm256_add_ps(_mm256_loadu_ps(left + i), _mm256_mul_ps(value, leftGain8)));
+        _mm256_storeu_ps(right + i, _mm256_add_ps(_mm256_loadu_ps(right + i), _mm256_mul_ps(value, rightGain8)));
+    }
+
+    mixRunScalar(source + i, left + i, right + i, numSamples - i, leftGain, rightGain);
+}
+
+static MixRunFunc* getMixRun(SimdLevel level) {
+    switch(level) {
+        case SimdLevel_AVX2:
+            return mixRunAVX2;
+        case SimdLevel_SSE2:
+            return mixRunSSE2;
+        default:
+            return mixRunScalar;
+    }
+}
+
+//NOTE: Balance style pan, the near side stays at full volume
+inline void getPanGains(real32_t volume, real32_t pan, real32_t* leftGain, real32_t* rightGain) {
+    *leftGain = volume * ((pan > 0.f) ? 1.f - pan : 1.f);
+    *rightGain = volume * ((pan < 0.f) ? 1.f + pan : 1.f);
+}
+
+//NOTE: Mixes numSamples of every voice, looping each source as needed
+static void mixVoicesBlock(MixerVoices* voices, MixRunFunc* mixRun, real32_t* left, real32_t* right, uint32_t numSamples) {
+    for(uint32_t v = 0; v < voices->count; v++) {
+        const int16_t* source = voices->source[v];
+        uint32_t length = voices->sourceLength[v];
+        uint32_t position = voices->position[v];
+
+        if(!source || length == 0) {
+            continue;
+        }
+
+        real32_t leftGain, rightGain;
+        getPanGains(voices->volume[v], voices->pan[v], &leftGain, &rightGain);
+
+        uint32_t mixed = 0;
+        while(mixed < numSamples) {
+            uint32_t run = numSamples - mixed;
+            if(run > length - position) {
+                run = length - position;
+            }
+
+            mixRun(source + position, left + mixed, right + mixed, run, leftGain, rightGain);
+
+            mixed += run;
+            position += run;
+            if(position == length) {
+                position = 0;
+            }
+        }
+
+        voices->position[v] = position;
+    }
+}
+
+//NOTE: Converts both accumulators to int16 with saturating packs and interleaves them
+static void writeStereoBlock(Sample* samples, const real32_t* left, const real32_t* right, uint32_t numSamples) {
+    uint32_t i = 0;
+
+    for(; i + 8 <= numSamples; i += 8) {
+        __m128i l = _mm_packs_epi32(_mm_cvtps_epi32(_mm_load_ps(left + i)), _mm_cvtps_epi32(_mm_load_ps(left + i + 4)));
+        __m128i r = _mm_packs_epi32(_mm_cvtps_epi32(_mm_load_ps(right + i)), _mm_cvtps_epi32(_mm_load_ps(right + i + 4)));
+
+        _mm_storeu_si128((__m128i*)(samples + i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i*)(samples + i + 4), _mm_unpackhi_epi16(l, r));
+    }
+
+    for(; i < numSamples; i++) {
+        real32_t l = left[i];
+        real32_t r = right[i];
+        l = (l > 32767.f) ? 32767.f : (l < -32768.f) ? -32768.f : l;
+        r = (r > 32767.f) ? 32767.f : (r < -32768.f) ? -32768.f : r;
+        samples[i].leftChannel = (int16_t)lrintf(l);
+        samples[i].rightChannel = (int16_t)lrintf(r);
+    }
+}
+
+//NOTE: Oscillators play centred, voices may be null
+static void mixSoundOutput(OscillatorBank* oscillators, MixerVoices* voices, MixRunFunc* mixRun, Sample* samples, uint32_t numSamples) {
+    alignas(32) real32_t mono[MIX_BLOCK_SIZE];
+    alignas(32) real32_t left[MIX_BLOCK_SIZE];
+    alignas(32) real32_t right[MIX_BLOCK_SIZE];
+
+    for(uint32_t blockStart = 0; blockStart < numSamples; blockStart += MIX_BLOCK_SIZE) {
+        uint32_t blockSize = numSamples - blockStart;
+        if(blockSize > MIX_BLOCK_SIZE) {
+            blockSize = MIX_BLOCK_SIZE;
+        }
+
+        memset(mono, 0, sizeof(mono));
+        renderOscillatorBlock(oscillators, mono, blockSize);
+        memcpy(left, mono, sizeof(mono));
+        memcpy(right, mono, sizeof(mono));
+
+        if(voices) {
+            mixVoicesBlock(voices, mixRun, left, right, blockSize);
+        }
+
+        writeStereoBlock(samples + blockStart, left, right, blockSize);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cpuid.h>
+#include "handmade.hpp"
+
+//NOTE: Instruction set levels our kernels come in.  SSE2 is part of x86-64 so
+//      it is always there; AVX2 is checked at runtime.
+enum SimdLevel {
+    SimdLevel_Scalar,
+    SimdLevel_SSE2,
+    SimdLevel_AVX2,
+    SimdLevel_Count
+};
+
+//NOTE: AVX2 needs both the cpuid feature bit and the OS saving ymm state
+static bool cpuSupportsAVX2() {
+    uint32_t eax, ebx, ecx, edx;
+
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+
+    bool osSavesYmm = false;
+    if((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+        uint32_t xcrLow, xcrHigh;
+        __asm__ volatile("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+        osSavesYmm = (xcrLow & 0x6) == 0x6;
+    }
+
+    if(!osSavesYmm || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+
+    return (ebx & bit_AVX2) != 0;
+}
+
+static SimdLevel getBestSimdLevel() {
+    if(cpuSupportsAVX2()) {
+        return SimdLevel_AVX2;
+    }
+
+    return SimdLevel_SSE2;
+}
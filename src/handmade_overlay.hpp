@@ -0,0 +1,187 @@
+#pragma once
+
+#include <stdio.h>
+#include "handmade.hpp"
+#include "handmade_render.hpp"
+
+//NOTE: Debug overlay the game draws over the finished frame: a frame time
+//      graph of the last FRAME_STATS_HISTORY frames against the target, the
+//      p50/p99 from the platform's histogram, audio latency and underruns,
+//      and arena usage.  It only ever writes pixels, never reads them, since
+//      in lock present mode the frame is write-combined texture memory.
+//      Shared with the bench driver, which times it.
+
+#define OVERLAY_GLYPH_WIDTH 5
+#define OVERLAY_GLYPH_HEIGHT 7
+#define OVERLAY_GLYPH_ADVANCE 6
+#define OVERLAY_LINE_HEIGHT 10
+#define OVERLAY_MARGIN 4
+#define OVERLAY_GRAPH_HEIGHT 64 //pixels for twice the target frame time
+#define OVERLAY_TEXT_LINES 4
+#define OVERLAY_TEXT_LENGTH 128
+#define OVERLAY_TEXT_COLUMNS 48 //what the panel is sized for, longer lines run off it
+#define OVERLAY_FIRST_GLYPH ' '
+#define OVERLAY_GLYPH_COUNT 64  //' ' through '_', lower case draws as upper case
+
+//NOTE: 5x7 glyphs, one byte per row from the top, bit 4 is the leftmost pixel
+static const uint8_t overlayGlyphs[OVERLAY_GLYPH_COUNT][OVERLAY_GLYPH_HEIGHT] = {
+    {0x00,0x00,0x00,0x00,0x00,0x00,0x00}, // space
+    {0x04,0x04,0x04,0x04,0x00,0x00,0x04}, // !
+    {0x0A,0x0A,0x0A,0x00,0x00,0x00,0x00}, // "
+    {0x0A,0x0A,0x1F,0x0A,0x1F,0x0A,0x0A}, // #
+    {0x04,0x0F,0x14,0x0E,0x05,0x1E,0x04}, // $
+    {0x18,0x19,0x02,0x04,0x08,0x13,0x03}, // %
+    {0x0C,0x12,0x14,0x08,0x15,0x12,0x0D}, // &
+    {0x0C,0x04,0x08,0x00,0x00,0x00,0x00}, // '
+    {0x02,0x04,0x08,0x08,0x08,0x04,0x02}, // (
+    {0x08,0x04,0x02,0x02,0x02,0x04,0x08}, // )
+    {0x00,0x04,0x15,0x0E,0x15,0x04,0x00}, // *
+    {0x00,0x04,0x04,0x1F,0x04,0x04,0x00}, // +
+    {0x00,0x00,0x00,0x00,0x0C,0x04,0x08}, // ,
+    {0x00,0x00,0x00,0x1F,0x00,0x00,0x00}, // -
+    {0x00,0x00,0x00,0x00,0x00,0x0C,0x0C}, // .
+    {0x00,0x01,0x02,0x04,0x08,0x10,0x00}, // /
+    {0x0E,0x11,0x13,0x15,0x19,0x11,0x0E}, // 0
+    {0x04,0x0C,0x04,0x04,0x04,0x04,0x0E}, // 1
+    {0x0E,0x11,0x01,0x02,0x04,0x08,0x1F}, // 2
+    {0x1F,0x02,0x04,0x02,0x01,0x11,0x0E}, // 3
+    {0x02,0x06,0x0A,0x12,0x1F,0x02,0x02}, // 4
+    {0x1F,0x10,0x1E,0x01,0x01,0x11,0x0E}, // 5
+    {0x06,0x08,0x10,0x1E,0x11,0x11,0x0E}, // 6
+    {0x1F,0x01,0x02,0x04,0x08,0x08,0x08}, // 7
+    {0x0E,0x11,0x11,0x0E,0x11,0x11,0x0E}, // 8
+    {0x0E,0x11,0x11,0x0F,0x01,0x02,0x0C}, // 9
+    {0x00,0x0C,0x0C,0x00,0x0C,0x0C,0x00}, // :
+    {0x00,0x0C,0x0C,0x00,0x0C,0x04,0x08}, // ;
+    {0x02,0x04,0x08,0x10,0x08,0x04,0x02}, // <
+    {0x00,0x00,0x1F,0x00,0x1F,0x00,0x00}, // =
+    {0x08,0x04,0x02,0x01,0x02,0x04,0x08}, // >
+    {0x0E,0x11,0x01,0x02,0x04,0x00,0x04}, // ?
+    {0x0E,0x11,0x01,0x0D,0x15,0x15,0x0E}, // @
+    {0x0E,0x11,0x11,0x11,0x1F,0x11,0x11}, // A
+    {0x1E,0x11,0x11,0x1E,0x11,0x11,0x1E}, // B
+    {0x0E,0x11,0x10,0x10,0x10,0x11,0x0E}, // C
+    {0x1C,0x12,0x11,0x11,0x11,0x12,0x1C}, // D
+    {0x1F,0x10,0x10,0x1E,0x10,0x10,0x1F}, // E
+    {0x1F,0x10,0x10,0x1E,0x10,0x10,0x10}, // F
+    {0x0E,0x11,0x10,0x17,0x11,0x11,0x0F}, // G
+    {0x11,0x11,0x11,0x1F,0x11,0x11,0x11}, // H
+    {0x0E,0x04,0x04,0x04,0x04,0x04,0x0E}, // I
+    {0x07,0x02,0x02,0x02,0x02,0x12,0x0C}, // J
+    {0x11,0x12,0x14,0x18,0x14,0x12,0x11}, // K
+    {0x10,0x10,0x10,0x10,0x10,0x10,0x1F}, // L
+    {0x11,0x1B,0x15,0x15,0x11,0x11,0x11}, // M
+    {0x11,0x11,0x19,0x15,0x13,0x11,0x11}, // N
+    {0x0E,0x11,0x11,0x11,0x11,0x11,0x0E}, // O
+    {0x1E,0x11,0x11,0x1E,0x10,0x10,0x10}, // P
+    {0x0E,0x11,0x11,0x11,0x15,0x12,0x0D}, // Q
+    {0x1E,0x11,0x11,0x1E,0x14,0x12,0x11}, // R
+    {0x0F,0x10,0x10,0x0E,0x01,0x01,0x1E}, // S
+    {0x1F,0x04,0x04,0x04,0x04,0x04,0x04}, // T
+    {0x11,0x11,0x11,0x11,0x11,0x11,0x0E}, // U
+    {0x11,0x11,0x11,0x11,0x11,0x0A,0x04}, // V
+    {0x11,0x11,0x11,0x15,0x15,0x15,0x0A}, // W
+    {0x11,0x11,0x0A,0x04,0x0A,0x11,0x11}, // X
+    {0x11,0x11,0x11,0x0A,0x04,0x04,0x04}, // Y
+    {0x1F,0x01,0x02,0x04,0x08,0x10,0x1F}, // Z
+    {0x0E,0x08,0x08,0x08,0x08,0x08,0x0E}, // [
+    {0x00,0x10,0x08,0x04,0x02,0x01,0x00}, // backslash
+    {0x0E,0x02,0x02,0x02,0x02,0x02,0x0E}, // ]
+    {0x04,0x0A,0x11,0x00,0x00,0x00,0x00}, // ^
+    {0x00,0x00,0x00,0x00,0x00,0x00,0x1F}, // _
+};
+
+//NOTE: Half open, clipped to the buffer
+static void fillOverlayRect(OffScreenBuffer* buf, int32_t minX, int32_t minY, int32_t maxX, int32_t maxY, Pixel color) {
+    minX = (minX < 0) ? 0 : minX;
+    minY = (minY < 0) ? 0 : minY;
+    maxX = (maxX > (int32_t)buf->width) ? (int32_t)buf->width : maxX;
+    maxY = (maxY > (int32_t)buf->height) ? (int32_t)buf->height : maxY;
+
+    for(int32_t y = minY; y < maxY; y++) {
+        Pixel* row = getRow(buf, y);
+        for(int32_t x = minX; x < maxX; x++) {
+            row[x] = color;
+        }
+    }
+}
+
+static void drawOverlayText(OffScreenBuffer* buf, int32_t x, int32_t y, const char* text, Pixel color) {
+    if(y < 0 || y + OVERLAY_GLYPH_HEIGHT > (int32_t)buf->height) {
+        return;
+    }
+
+    for(; *text && x + OVERLAY_GLYPH_WIDTH <= (int32_t)buf->width; text++, x += OVERLAY_GLYPH_ADVANCE) {
+        uint32_t c = (uint8_t)*text;
+        if(c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        if(c < OVERLAY_FIRST_GLYPH || c >= OVERLAY_FIRST_GLYPH + OVERLAY_GLYPH_COUNT) {
+            c = '?';
+        }
+
+        const uint8_t* glyph = overlayGlyphs[c - OVERLAY_FIRST_GLYPH];
+        for(uint32_t row = 0; row < OVERLAY_GLYPH_HEIGHT; row++) {
+            if(!glyph[row]) {
+                continue;
+            }
+
+            Pixel* out = getRow(buf, y + row) + x;
+            for(uint32_t bit = 0; bit < OVERLAY_GLYPH_WIDTH; bit++) {
+                if(glyph[row] & (0x10 >> bit)) {
+                    out[bit] = color;
+                }
+            }
+        }
+    }
+}
+
+static void drawDebugOverlay(OffScreenBuffer* buf, const PlatformFrameStats* stats, const MemoryArena* permanent, const MemoryArena* transient) {
+    const Pixel background = packPixel(buf->layout, 16, 16, 24, 0xFF);
+    const Pixel textColor = packPixel(buf->layout, 230, 230, 230, 0xFF);
+    const Pixel targetColor = packPixel(buf->layout, 90, 90, 140, 0xFF);
+    const Pixel goodColor = packPixel(buf->layout, 60, 200, 90, 0xFF);
+    const Pixel lateColor = packPixel(buf->layout, 230, 190, 40, 0xFF);
+    const Pixel missColor = packPixel(buf->layout, 230, 60, 50, 0xFF);
+
+    int32_t panelWidth = 2 * OVERLAY_MARGIN + FRAME_STATS_HISTORY;
+    int32_t textWidth = 2 * OVERLAY_MARGIN + OVERLAY_TEXT_COLUMNS * OVERLAY_GLYPH_ADVANCE;
+    panelWidth = (textWidth > panelWidth) ? textWidth : panelWidth;
+    int32_t panelHeight = 3 * OVERLAY_MARGIN + OVERLAY_GRAPH_HEIGHT + OVERLAY_TEXT_LINES * OVERLAY_LINE_HEIGHT;
+    fillOverlayRect(buf, 0, 0, panelWidth, panelHeight, background);
+
+    //graph, newest frame on the right, the target is half way up
+    int32_t graphBottom = OVERLAY_MARGIN + OVERLAY_GRAPH_HEIGHT;
+    real32_t target = (stats->targetMilliseconds > 0) ? stats->targetMilliseconds : 1000.f / 60;
+    real32_t pixelsPerMillisecond = OVERLAY_GRAPH_HEIGHT / (2 * target);
+
+    uint32_t count = (stats->frameCount < FRAME_STATS_HISTORY) ? stats->frameCount : FRAME_STATS_HISTORY;
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t frame = stats->frameCount - count + i;
+        real32_t milliseconds = stats->frameMilliseconds[frame % FRAME_STATS_HISTORY];
+        int32_t height = (int32_t)(milliseconds * pixelsPerMillisecond + .5f);
+        height = (height > OVERLAY_GRAPH_HEIGHT) ? OVERLAY_GRAPH_HEIGHT : (height < 1) ? 1 : height;
+
+        Pixel color = (milliseconds <= target * 1.05f) ? goodColor : (milliseconds <= target * 1.5f) ? lateColor : missColor;
+        int32_t x = OVERLAY_MARGIN + (FRAME_STATS_HISTORY - count) + i;
+        fillOverlayRect(buf, x, graphBottom - height, x + 1, graphBottom, color);
+    }
+
+    fillOverlayRect(buf, OVERLAY_MARGIN, graphBottom - OVERLAY_GRAPH_HEIGHT / 2,
+            OVERLAY_MARGIN + FRAME_STATS_HISTORY, graphBottom - OVERLAY_GRAPH_HEIGHT / 2 + 1, targetColor);
+
+    char lines[OVERLAY_TEXT_LINES][OVERLAY_TEXT_LENGTH];
+    real32_t lastMilliseconds = stats->frameCount ? stats->frameMilliseconds[(stats->frameCount - 1) % FRAME_STATS_HISTORY] : 0;
+    snprintf(lines[0], OVERLAY_TEXT_LENGTH, "frame %5.2fms  target %5.2fms  scale %.2f", lastMilliseconds, target, stats->renderScale);
+    snprintf(lines[1], OVERLAY_TEXT_LENGTH, "p50 %5.2fms  p99 %5.2fms  (%u frames)",
+            stats->p50Milliseconds, stats->p99Milliseconds, count);
+    snprintf(lines[2], OVERLAY_TEXT_LENGTH, "audio %5.1fms  target %5.1fms  underruns %u",
+            stats->audioLatencyMilliseconds, stats->audioTargetMilliseconds, stats->audioUnderruns);
+    snprintf(lines[3], OVERLAY_TEXT_LENGTH, "arenas perm %lluk/%llum  trans %lluk peak %lluk",
+            (unsigned long long)permanent->used / 1024, (unsigned long long)permanent->size / MB(1),
+            (unsigned long long)transient->used / 1024, (unsigned long long)transient->highWater / 1024);
+
+    for(uint32_t i = 0; i < OVERLAY_TEXT_LINES; i++) {
+        drawOverlayText(buf, OVERLAY_MARGIN, graphBottom + OVERLAY_MARGIN + i * OVERLAY_LINE_HEIGHT, lines[i], textColor);
+    }
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+#include "handmade.hpp"
+
+//NOTE: Scoped rdtsc timing blocks for the hot path.  TIMED_BLOCK("name")
+//      writes a begin event into the calling thread's ring when it is entered
+//      and an end event when the scope closes; nothing else happens on the
+//      hot path.  The platform (or the bench driver) owns the Profiler, hands
+//      it to the game through GameMemory, and drains every ring once a frame
+//      into a per-site table.  A capture also keeps the raw events so they
+//      can be written out as a Chrome trace_event file (chrome://tracing or
+//      ui.perfetto.dev).
+//
+//      Every module that includes this (the platform, the bench, the game
+//      library) has its own gProfiler and its own thread_local ring pointer.
+//      Threads find their ring by kernel thread id, so a reloaded game
+//      library picks up the rings it used before.
+
+#define PROFILER_MAX_THREADS 80 //the work queue alone can have 64
+#define PROFILER_MAX_SITES 256
+#define PROFILER_SITE_NAME_LENGTH 48
+#define PROFILER_RING_SIZE 16384 //events, must be a power of two
+#define PROFILER_MAX_DEPTH 32
+#define PROFILER_CAPTURE_EVENTS (1 << 20)
+
+enum ProfileEventType {
+    ProfileEvent_Begin,
+    ProfileEvent_End,
+};
+
+struct ProfileEvent {
+    uint64_t tsc;
+    uint32_t site;
+    uint32_t type;
+};
+
+//NOTE: What a capture keeps, the thread is an index into Profiler::threads
+struct ProfileCaptureEvent {
+    uint64_t tsc;
+    uint16_t site;
+    uint8_t thread;
+    uint8_t type;
+};
+
+struct ProfileOpenBlock {
+    uint32_t site;
+    uint64_t tsc;
+};
+
+struct alignas(CACHE_LINE_SIZE) ProfileThread {
+    //written by the owning thread only
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> writeCursor;
+    ProfileEvent events[PROFILER_RING_SIZE];
+
+    //only touched by whoever collects
+    alignas(CACHE_LINE_SIZE) uint64_t readCursor;
+    uint32_t depth;
+    ProfileOpenBlock open[PROFILER_MAX_DEPTH];
+
+    pid_t tid;
+};
+
+struct ProfileSiteStats {
+    uint64_t cycles; //inclusive
+    uint32_t count;
+};
+
+struct ProfileSiteTotals {
+    uint64_t cycles;
+    uint64_t maxFrameCycles;
+    uint64_t count;
+};
+
+struct Profiler {
+    std::atomic<uint32_t> threadCount;
+    std::atomic<uint32_t> siteCount; //site 0 is never handed out
+    std::atomic<bool> registerLock;
+
+    char siteNames[PROFILER_MAX_SITES][PROFILER_SITE_NAME_LENGTH];
+    ProfileThread threads[PROFILER_MAX_THREADS];
+
+    //NOTE: rdtsc has no fixed unit, exports convert with the rate measured
+    //      since the profiler was created
+    uint64_t startTsc;
+    uint64_t startNanoseconds;
+
+    //this frame, filled by collectProfileEvents
+    ProfileSiteStats frame[PROFILER_MAX_SITES];
+    uint64_t droppedEvents;
+
+    ProfileEvent scratch[PROFILER_RING_SIZE];
+
+    //capture, mapped the first time one is asked for
+    ProfileCaptureEvent* captureEvents;
+    uint32_t captureEventCount;
+    uint32_t captureFramesLeft;
+    uint32_t captureFrameCount;
+    uint64_t captureDroppedEvents;
+    ProfileSiteTotals captureTotals[PROFILER_MAX_SITES];
+};
+
+static Profiler* gProfiler;
+static thread_local ProfileThread* profileThread;
+
+inline uint64_t getProfilerNanoseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+inline Profiler* createProfiler() {
+    void* memory = mmap(nullptr, sizeof(Profiler), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if(memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    Profiler* profiler = new(memory) Profiler;
+    profiler->threadCount.store(0, std::memory_order_relaxed);
+    profiler->siteCount.store(1, std::memory_order_relaxed);
+    profiler->registerLock.store(false, std::memory_order_relaxed);
+    profiler->startNanoseconds = getProfilerNanoseconds();
+    profiler->startTsc = __rdtsc();
+
+    return profiler;
+}
+
+inline void destroyProfiler(Profiler* profiler) {
+    if(profiler->captureEvents) {
+        munmap(profiler->captureEvents, PROFILER_CAPTURE_EVENTS * sizeof(ProfileCaptureEvent));
+    }
+    profiler->~Profiler();
+    munmap(profiler, sizeof(Profiler));
+}
+
+static void lockProfiler(Profiler* profiler) {
+    while(profiler->registerLock.exchange(true, std::memory_order_acquire)) {
+        _mm_pause();
+    }
+}
+
+static void unlockProfiler(Profiler* profiler) {
+    profiler->registerLock.store(false, std::memory_order_release);
+}
+
+//NOTE: Slow path, once per thread per module.  Returns null when every slot
+//      is taken and the thread goes unprofiled.
+static ProfileThread* attachProfileThread(Profiler* profiler) {
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    ProfileThread* ret = nullptr;
+
+    lockProfiler(profiler);
+    uint32_t threadCount = profiler->threadCount.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < threadCount; i++) {
+        if(profiler->threads[i].tid == tid) {
+            ret = &profiler->threads[i];
+            break;
+        }
+    }
+
+    if(!ret && threadCount < PROFILER_MAX_THREADS) {
+        ret = &profiler->threads[threadCount];
+        ret->tid = tid;
+        profiler->threadCount.store(threadCount + 1, std::memory_order_release);
+    }
+    unlockProfiler(profiler);
+
+    profileThread = ret;
+    return ret;
+}
+
+//NOTE: Names are matched, not pointers, since a reloaded game library brings
+//      its own copies of the string literals
+static uint32_t registerProfileSite(std::atomic<uint32_t>* siteId, const char* name) {
+    Profiler* profiler = gProfiler;
+    if(!profiler) {
+        return 0;
+    }
+
+    lockProfiler(profiler);
+    uint32_t siteCount = profiler->siteCount.load(std::memory_order_relaxed);
+    uint32_t site = 0;
+    for(uint32_t i = 1; i < siteCount; i++) {
+        if(!strncmp(profiler->siteNames[i], name, PROFILER_SITE_NAME_LENGTH - 1)) {
+            site = i;
+            break;
+        }
+    }
+
+    if(!site && siteCount < PROFILER_MAX_SITES) {
+        site = siteCount;
+        strncpy(profiler->siteNames[site], name, PROFILER_SITE_NAME_LENGTH - 1);
+        profiler->siteCount.store(siteCount + 1, std::memory_order_release);
+    }
+    unlockProfiler(profiler);
+
+    siteId->store(site, std::memory_order_relaxed);
+    return site;
+}
+
+static void recordProfileEvent(uint32_t site, uint32_t type) {
+    ProfileThread* thread = profileThread;
+    if(!thread && (!gProfiler || !(thread = attachProfileThread(gProfiler)))) {
+        return;
+    }
+
+    uint64_t index = thread->writeCursor.load(std::memory_order_relaxed);
+    ProfileEvent* event = &thread->events[index & (PROFILER_RING_SIZE - 1)];
+    event->tsc = __rdtsc();
+    event->site = site;
+    event->type = type;
+    thread->writeCursor.store(index + 1, std::memory_order_release);
+}
+
+struct ProfileBlock {
+    uint32_t site;
+
+    ProfileBlock(std::atomic<uint32_t>* siteId, const char* name) {
+        site = siteId->load(std::memory_order_relaxed);
+        if(!site) {
+            site = registerProfileSite(siteId, name);
+        }
+        if(site) {
+            recordProfileEvent(site, ProfileEvent_Begin);
+        }
+    }
+
+    ~ProfileBlock() {
+        if(site) {
+            recordProfileEvent(site, ProfileEvent_End);
+        }
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if HANDMADE_INTERNAL
+#define TIMED_BLOCK(name) \
+    static std::atomic<uint32_t> PROFILE_CONCAT(profileSite, __LINE__)(0); \
+    ProfileBlock PROFILE_CONCAT(profileBlock, __LINE__)(&PROFILE_CONCAT(profileSite, __LINE__), name)
+#else
+#define TIMED_BLOCK(name)
+#endif
+
+inline real64_t getProfilerTscPerSecond(Profiler* profiler) {
+    uint64_t nanoseconds = getProfilerNanoseconds() - profiler->startNanoseconds;
+    uint64_t cycles = __rdtsc() - profiler->startTsc;
+
+    return nanoseconds ? (real64_t)cycles * 1e9 / nanoseconds : 1e9;
+}
+
+//NOTE: False if the capture buffer can't be mapped, nothing is captured then
+inline bool beginProfileCapture(Profiler* profiler, uint32_t frameCount) {
+    if(!profiler->captureEvents) {
+        void* memory = mmap(nullptr, PROFILER_CAPTURE_EVENTS * sizeof(ProfileCaptureEvent),
+                PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+        if(memory == MAP_FAILED) {
+            return false;
+        }
+        profiler->captureEvents = (ProfileCaptureEvent*)memory;
+    }
+
+    profiler->captureEventCount = 0;
+    profiler->captureFramesLeft = frameCount;
+    profiler->captureFrameCount = 0;
+    profiler->captureDroppedEvents = 0;
+    memset(profiler->captureTotals, 0, sizeof(profiler->captureTotals));
+    return true;
+}
+
+inline void processProfileEvent(Profiler* profiler, uint32_t threadIndex, const ProfileEvent* event) {
+    ProfileThread* thread = &profiler->threads[threadIndex];
+
+    if(event->site >= PROFILER_MAX_SITES) {
+        return;
+    }
+
+    if(event->type == ProfileEvent_Begin) {
+        if(thread->depth < PROFILER_MAX_DEPTH) {
+            thread->open[thread->depth].site = event->site;
+            thread->open[thread->depth].tsc = event->tsc;
+        }
+        thread->depth++;
+    }
+    else if(thread->depth > 0) {
+        thread->depth--;
+        if(thread->depth < PROFILER_MAX_DEPTH) {
+            ProfileOpenBlock* open = &thread->open[thread->depth];
+
+            //NOTE: A mismatch means the begin was overwritten before we got to it
+            if(open->site == event->site) {
+                profiler->frame[event->site].cycles += event->tsc - open->tsc;
+                profiler->frame[event->site].count++;
+            }
+            else {
+                thread->depth = 0;
+            }
+        }
+    }
+
+    if(profiler->captureFramesLeft) {
+        if(profiler->captureEventCount < PROFILER_CAPTURE_EVENTS) {
+            ProfileCaptureEvent* captured = &profiler->captureEvents[profiler->captureEventCount++];
+            captured->tsc = event->tsc;
+            captured->site = (uint16_t)event->site;
+            captured->thread = (uint8_t)threadIndex;
+            captured->type = (uint8_t)event->type;
+        }
+        else {
+            profiler->captureDroppedEvents++;
+        }
+    }
+}
+
+//NOTE: Call once a frame from one thread.  Each ring is copied out, then
+//      anything the writer could have lapped while we copied is thrown away.
+//      That includes the slot at lappedCursor, which the writer fills before
+//      it publishes the cursor past it.  Blocks still open stay on their
+//      thread's stack for the next frame.
+inline void collectProfileEvents(Profiler* profiler) {
+    memset(profiler->frame, 0, sizeof(profiler->frame));
+
+    uint32_t threadCount = profiler->threadCount.load(std::memory_order_acquire);
+    for(uint32_t threadIndex = 0; threadIndex < threadCount; threadIndex++) {
+        ProfileThread* thread = &profiler->threads[threadIndex];
+        uint64_t writeCursor = thread->writeCursor.load(std::memory_order_acquire);
+        uint64_t readCursor = thread->readCursor;
+
+        if(writeCursor - readCursor > PROFILER_RING_SIZE) {
+            profiler->droppedEvents += writeCursor - readCursor - PROFILER_RING_SIZE;
+            readCursor = writeCursor - PROFILER_RING_SIZE;
+            thread->depth = 0;
+        }
+
+        uint32_t count = (uint32_t)(writeCursor - readCursor);
+        for(uint32_t i = 0; i < count; i++) {
+            profiler->scratch[i] = thread->events[(readCursor + i) & (PROFILER_RING_SIZE - 1)];
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t lappedCursor = thread->writeCursor.load(std::memory_order_relaxed);
+        uint32_t first = 0;
+        if(lappedCursor - readCursor >= PROFILER_RING_SIZE) {
+            first = (uint32_t)(lappedCursor - readCursor - PROFILER_RING_SIZE + 1);
+            if(first > count) {
+                first = count;
+            }
+            profiler->droppedEvents += first;
+            thread->depth = 0;
+        }
+
+        for(uint32_t i = first; i < count; i++) {
+            processProfileEvent(profiler, threadIndex, &profiler->scratch[i]);
+        }
+
+        thread->readCursor = writeCursor;
+    }
+}
+
+//NOTE: Returns true on the frame a capture finishes
+inline bool endProfileFrame(Profiler* profiler) {
+    collectProfileEvents(profiler);
+
+    if(!profiler->captureFramesLeft) {
+        return false;
+    }
+
+    for(uint32_t site = 1; site < PROFILER_MAX_SITES; site++) {
+        ProfileSiteStats* frame = &profiler->frame[site];
+        ProfileSiteTotals* totals = &profiler->captureTotals[site];
+
+        totals->cycles += frame->cycles;
+        totals->count += frame->count;
+        if(frame->cycles > totals->maxFrameCycles) {
+            totals->maxFrameCycles = frame->cycles;
+        }
+    }
+
+    profiler->captureFrameCount++;
+    return --profiler->captureFramesLeft == 0;
+}
+
+//NOTE: 0 if no block by that name has run yet
+inline uint32_t findProfileSite(Profiler* profiler, const char* name) {
+    uint32_t siteCount = profiler->siteCount.load(std::memory_order_acquire);
+    for(uint32_t site = 1; site < siteCount; site++) {
+        if(!strncmp(profiler->siteNames[site], name, PROFILER_SITE_NAME_LENGTH - 1)) {
+            return site;
+        }
+    }
+
+    return 0;
+}
+
+inline void printProfileTable(Profiler* profiler, FILE* out) {
+    real64_t msPerCycle = 1000. / getProfilerTscPerSecond(profiler);
+    uint32_t frameCount = profiler->captureFrameCount ? profiler->captureFrameCount : 1;
+    uint32_t siteCount = profiler->siteCount.load(std::memory_order_acquire);
+
+    fprintf(out, "%-32s %10s %10s %10s\n", "block (per frame)", "calls", "mean ms", "max ms");
+    for(uint32_t site = 1; site < siteCount; site++) {
+        ProfileSiteTotals* totals = &profiler->captureTotals[site];
+        if(!totals->count) {
+            continue;
+        }
+
+        fprintf(out, "%-32s %10.1f %10.3f %10.3f\n", profiler->siteNames[site],
+                (real64_t)totals->count / frameCount, totals->cycles * msPerCycle / frameCount,
+                totals->maxFrameCycles * msPerCycle);
+    }
+
+    if(profiler->captureDroppedEvents || profiler->droppedEvents) {
+        fprintf(out, "%llu events dropped\n",
+                (unsigned long long)(profiler->captureDroppedEvents + profiler->droppedEvents));
+    }
+}
+
+//NOTE: Chrome's trace_event format, timestamps in microseconds from the first
+//      captured event
+inline bool writeChromeTrace(Profiler* profiler, const char* path) {
+    FILE* f = fopen(path, "w");
+    if(!f) {
+        return false;
+    }
+
+    real64_t microsecondsPerCycle = 1e6 / getProfilerTscPerSecond(profiler);
+    uint64_t baseTsc = profiler->captureEventCount ? profiler->captureEvents[0].tsc : 0;
+    for(uint32_t i = 1; i < profiler->captureEventCount; i++) {
+        if(profiler->captureEvents[i].tsc < baseTsc) {
+            baseTsc = profiler->captureEvents[i].tsc;
+        }
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for(uint32_t i = 0; i < profiler->captureEventCount; i++) {
+        ProfileCaptureEvent* event = &profiler->captureEvents[i];
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", i ? ",\n" : "",
+                profiler->siteNames[event->site], (event->type == ProfileEvent_Begin) ? 'B' : 'E',
+                profiler->threads[event->thread].tid, (event->tsc - baseTsc) * microsecondsPerCycle);
+    }
+
+    fprintf(f, "\n]}\n");
+
+    bool succeeded = !ferror(f);
+    return (fclose(f) == 0) && succeeded;
+}
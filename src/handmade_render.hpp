@@ -0,0 +1,785 @@
+#pragma once
+
+#include <math.h>
+#include <immintrin.h>
+#include "handmade.hpp"
+#include "handmade_intrinsics.hpp"
+
+//NOTE: Render kernels shared by the game and the bench driver.  Every kernel
+//      has a scalar reference version; the SIMD versions must produce
+//      byte-identical output and are picked once at startup by getBestSimdLevel.
+//      Kernels that care where the channels are take the PixelLayout as a
+//      template parameter, so the shifts are constants and each layout gets its
+//      own copy of the loop; the getters pick the copy for the buffer.
+
+typedef void RenderWeirdGradientFunc(OffScreenBuffer *buf, int blueOffset, int greenOffset);
+
+inline Pixel* getRow(OffScreenBuffer *buf, uint32_t y) {
+    return (Pixel*)((uint8_t*)buf->pixels + (uint64_t)y * buf->pitch);
+}
+
+template<PixelLayout layout>
+static void renderWeirdGradientScalar(OffScreenBuffer *buf, int blueOffset, int greenOffset) {
+    const uint32_t blueShift = getBlueShift(layout);
+    const uint32_t greenShift = getGreenShift(layout);
+
+    for (uint32_t y = 0; y < buf->height; y++) {
+
+        Pixel *currPixel = getRow(buf, y);
+
+        for (uint32_t x = 0; x < buf->width; x++) {
+            Pixel p;
+            p.value = (((x + blueOffset) & 0xFF) << blueShift) | (((y + greenOffset) & 0xFF) << greenShift);
+
+            *currPixel++ = p;
+        }
+    }
+}
+
+//NOTE: Only blue and green are set, alpha and red stay zero, same as the
+//      scalar path
+template<PixelLayout layout>
+static void renderWeirdGradientSSE2(OffScreenBuffer *buf, int blueOffset, int greenOffset) {
+    const uint32_t blueShift = getBlueShift(layout);
+    const uint32_t greenShift = getGreenShift(layout);
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i four = _mm_set1_epi32(4);
+
+    for (uint32_t y = 0; y < buf->height; y++) {
+        Pixel *row = getRow(buf, y);
+        __m128i green = _mm_set1_epi32(((y + greenOffset) & 0xFF) << greenShift);
+        __m128i blue = _mm_add_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(blueOffset));
+
+        uint32_t x = 0;
+        for (; x + 4 <= buf->width; x += 4) {
+            __m128i b = _mm_slli_epi32(_mm_and_si128(blue, byteMask), blueShift);
+            _mm_storeu_si128((__m128i*)(row + x), _mm_or_si128(b, green));
+            blue = _mm_add_epi32(blue, four);
+        }
+
+        for (; x < buf->width; x++) {
+            row[x].value = (((x + blueOffset) & 0xFF) << blueShift) | (((y + greenOffset) & 0xFF) << greenShift);
+        }
+    }
+}
+
+template<PixelLayout layout>
+__attribute__((target("avx2")))
+static void renderWeirdGradientAVX2(OffScreenBuffer *buf, int blueOffset, int greenOffset) {
+    const uint32_t blueShift = getBlueShift(layout);
+    const uint32_t greenShift = getGreenShift(layout);
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m256i eight = _mm256_set1_epi32(8);
+    const __m256i sixteen = _mm256_set1_epi32(16);
+
+    for (uint32_t y = 0; y < buf->height; y++) {
+        Pixel *row = getRow(buf, y);
+        __m256i green = _mm256_set1_epi32(((y + greenOffset) & 0xFF) << greenShift);
+        __m256i blue0 = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(blueOffset));
+        __m256i blue1 = _mm256_add_epi32(blue0, eight);
+
+        uint32_t x = 0;
+        for (; x + 16 <= buf->width; x += 16) {
+            __m256i b0 = _mm256_slli_epi32(_mm256_and_si256(blue0, byteMask), blueShift);
+            __m256i b1 = _mm256_slli_epi32(_mm256_and_si256(blue1, byteMask), blueShift);
+            _mm256_storeu_si256((__m256i*)(row + x), _mm256_or_si256(b0, green));
+            _mm256_storeu_si256((__m256i*)(row + x + 8), _mm256_or_si256(b1, green));
+            blue0 = _mm256_add_epi32(blue0, sixteen);
+            blue1 = _mm256_add_epi32(blue1, sixteen);
+        }
+
+        for (; x < buf->width; x++) {
+            row[x].value = (((x + blueOffset) & 0xFF) << blueShift) | (((y + greenOffset) & 0xFF) << greenShift);
+        }
+    }
+}
+
+template<PixelLayout layout>
+static RenderWeirdGradientFunc* getRenderWeirdGradientFor(SimdLevel level) {
+    switch(level) {
+        case SimdLevel_AVX2:
+            return renderWeirdGradientAVX2<layout>;
+        case SimdLevel_SSE2:
+            return renderWeirdGradientSSE2<layout>;
+        default:
+            return renderWeirdGradientScalar<layout>;
+    }
+}
+
+static RenderWeirdGradientFunc* getRenderWeirdGradient(SimdLevel level, PixelLayout layout) {
+    switch(layout) {
+        case PixelLayout_ARGB:
+            return getRenderWeirdGradientFor<PixelLayout_ARGB>(level);
+        case PixelLayout_ABGR:
+            return getRenderWeirdGradientFor<PixelLayout_ABGR>(level);
+        case PixelLayout_BGRA:
+            return getRenderWeirdGradientFor<PixelLayout_BGRA>(level);
+        default:
+            return getRenderWeirdGradientFor<PixelLayout_RGBA>(level);
+    }
+}
+
+//NOTE: Sprites and rectangles.  Colours are premultiplied and in the layout
+//      of the buffer, so drawing is dest = source + dest * (255 - source alpha)
+//      / 255 on every channel, alpha included.  Only finding the source alpha
+//      depends on the layout.  The division rounds with the usual (t + (t >> 8)) >> 8
+//      trick, which stays inside 16 bits, so the SIMD versions can do it in
+//      16 bit lanes and still match the scalar one exactly.
+
+//NOTE: The span kernels do one clipped row; drawRectangle and drawBitmap do
+//      the clipping and walk the rows.  fill stores the colour, blendColor
+//      blends one colour over the span and blend blends a row of source pixels.
+typedef void ColorSpanFunc(Pixel* dest, uint32_t count, Pixel color);
+typedef void BlendSpanFunc(Pixel* dest, const Pixel* source, uint32_t count);
+
+//NOTE: Everything about a quad the pixel loop needs, worked out once per
+//      quad by drawQuad.  u and v are the quad's edge functions scaled so each
+//      pair of opposite edges sits at 0 and 1; a pixel centre is covered when
+//      both are in [0, 1).  texelScale takes them to texels in 24.8 fixed point.
+struct QuadSetup {
+    const TiledTexture* texture;
+    real32_t originX;
+    real32_t originY;
+    real32_t uPerX;
+    real32_t uPerY;
+    real32_t vPerX;
+    real32_t vPerY;
+    real32_t texelScaleX;
+    real32_t texelScaleY;
+    int32_t maxTexelX;
+    int32_t maxTexelY;
+    int32_t tileRowStride; //texels from one row of tiles to the next
+};
+
+typedef void QuadSpanFunc(Pixel* row, const QuadSetup* setup, uint32_t y, uint32_t minX, uint32_t maxX);
+
+struct DrawSpanKernels {
+    PixelLayout layout;
+    ColorSpanFunc* fill;
+    ColorSpanFunc* blendColor;
+    BlendSpanFunc* blend;
+    QuadSpanFunc* texturedQuad;
+};
+
+inline uint32_t mulDiv255(uint32_t value, uint32_t factor) {
+    uint32_t t = value * factor + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+template<PixelLayout layout>
+inline Pixel blendPremultiplied(Pixel dest, Pixel source) {
+    uint32_t inverseAlpha = 255 - ((source.value >> getAlphaShift(layout)) & 0xFF);
+    Pixel result;
+    result.value = 0;
+
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t channel = ((source.value >> shift) & 0xFF) + mulDiv255((dest.value >> shift) & 0xFF, inverseAlpha);
+        result.value |= ((channel > 0xFF) ? 0xFF : channel) << shift;
+    }
+
+    return result;
+}
+
+static void fillSpanScalar(Pixel* dest, uint32_t count, Pixel color) {
+    for(uint32_t x = 0; x < count; x++) {
+        dest[x] = color;
+    }
+}
+
+template<PixelLayout layout>
+static void blendColorSpanScalar(Pixel* dest, uint32_t count, Pixel color) {
+    for(uint32_t x = 0; x < count; x++) {
+        dest[x] = blendPremultiplied<layout>(dest[x], color);
+    }
+}
+
+template<PixelLayout layout>
+static void blendSpanScalar(Pixel* dest, const Pixel* source, uint32_t count) {
+    for(uint32_t x = 0; x < count; x++) {
+        dest[x] = blendPremultiplied<layout>(dest[x], source[x]);
+    }
+}
+
+//NOTE: Blends four pixels.  The unpack puts two pixels in each register as
+//      eight 16 bit channels, so the inverse alpha has to be repeated over the
+//      four channels of its pixel the same way.
+inline __m128i blendPremultipliedSSE2(__m128i dest, __m128i source, __m128i inverseAlphaLow, __m128i inverseAlphaHigh) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+
+    __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dest, zero), inverseAlphaLow), half);
+    __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dest, zero), inverseAlphaHigh), half);
+    low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+
+    return _mm_adds_epu8(_mm_packus_epi16(low, high), source);
+}
+
+static void fillSpanSSE2(Pixel* dest, uint32_t count, Pixel color) {
+    __m128i value = _mm_set1_epi32(color.value);
+
+    uint32_t x = 0;
+    for(; x + 4 <= count; x += 4) {
+        _mm_storeu_si128((__m128i*)(dest + x), value);
+    }
+
+    for(; x < count; x++) {
+        dest[x] = color;
+    }
+}
+
+template<PixelLayout layout>
+static void blendColorSpanSSE2(Pixel* dest, uint32_t count, Pixel color) {
+    __m128i source = _mm_set1_epi32(color.value);
+    __m128i inverseAlpha = _mm_set1_epi16(255 - ((color.value >> getAlphaShift(layout)) & 0xFF));
+
+    uint32_t x = 0;
+    for(; x + 4 <= count; x += 4) {
+        __m128i d = _mm_loadu_si128((__m128i*)(dest + x));
+        _mm_storeu_si128((__m128i*)(dest + x), blendPremultipliedSSE2(d, source, inverseAlpha, inverseAlpha));
+    }
+
+    for(; x < count; x++) {
+        dest[x] = blendPremultiplied<layout>(dest[x], color);
+    }
+}
+
+template<PixelLayout layout>
+static void blendSpanSSE2(Pixel* dest, const Pixel* source, uint32_t count) {
+    const __m128i alphaMask = _mm_set1_epi32(0xFF);
+
+    uint32_t x = 0;
+    for(; x + 4 <= count; x += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(source + x));
+        __m128i d = _mm_loadu_si128((__m128i*)(dest + x));
+
+        //255 - alpha into both halves of each pixel
+        __m128i inverseAlpha = _mm_sub_epi32(alphaMask, _mm_and_si128(_mm_srli_epi32(s, getAlphaShift(layout)), alphaMask));
+        inverseAlpha = _mm_or_si128(inverseAlpha, _mm_slli_epi32(inverseAlpha, 16));
+        __m128i inverseAlphaLow = _mm_unpacklo_epi32(inverseAlpha, inverseAlpha);
+        __m128i inverseAlphaHigh = _mm_unpackhi_epi32(inverseAlpha, inverseAlpha);
+
+        _mm_storeu_si128((__m128i*)(dest + x), blendPremultipliedSSE2(d, s, inverseAlphaLow, inverseAlphaHigh));
+    }
+
+    for(; x < count; x++) {
+        dest[x] = blendPremultiplied<layout>(dest[x], source[x]);
+    }
+}
+
+//NOTE: Same as the SSE2 version eight pixels at a time.  The 256 bit unpacks
+//      and packs work inside each 128 bit half, so pixels come back in order.
+__attribute__((target("avx2")))
+inline __m256i blendPremultipliedAVX2(__m256i dest, __m256i source, __m256i inverseAlphaLow, __m256i inverseAlphaHigh) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(128);
+
+    __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(dest, zero), inverseAlphaLow), half);
+    __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(dest, zero), inverseAlphaHigh), half);
+    low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+    high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+
+    return _mm256_adds_epu8(_mm256_packus_epi16(low, high), source);
+}
+
+__attribute__((target("avx2")))
+static void fillSpanAVX2(Pixel* dest, uint32_t count, Pixel color) {
+    __m256i value = _mm256_set1_epi32(color.value);
+
+    uint32_t x = 0;
+    for(; x + 8 <= count; x += 8) {
+        _mm256_storeu_si256((__m256i*)(dest + x), value);
+    }
+
+    for(; x < count; x++) {
+        dest[x] = color;
+    }
+}
+
+template<PixelLayout layout>
+__attribute__((target("avx2")))
+static void blendColorSpanAVX2(Pixel* dest, uint32_t count, Pixel color) {
+    __m256i source = _mm256_set1_epi32(color.value);
+    __m256i inverseAlpha = _mm256_set1_epi16(255 - ((color.value >> getAlphaShift(layout)) & 0xFF));
+
+    uint32_t x = 0;
+    for(; x + 8 <= count; x += 8) {
+        __m256i d = _mm256_loadu_si256((__m256i*)(dest + x));
+        _mm256_storeu_si256((__m256i*)(dest + x), blendPremultipliedAVX2(d, source, inverseAlpha, inverseAlpha));
+    }
+
+    for(; x < count; x++) {
+        dest[x] = blendPremultiplied<layout>(dest[x], color);
+    }
+}
+
+template<PixelLayout layout>
+__attribute__((target("avx2")))
+static void blendSpanAVX2(Pixel* dest, const Pixel* source, uint32_t count) {
+    const __m256i alphaMask = _mm256_set1_epi32(0xFF);
+
+    uint32_t x = 0;
+    for(; x + 8 <= count; x += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(source + x));
+        __m256i d = _mm256_loadu_si256((__m256i*)(dest + x));
+
+        __m256i inverseAlpha = _mm256_sub_epi32(alphaMask, _mm256_and_si256(_mm256_srli_epi32(s, getAlphaShift(layout)), alphaMask));
+        inverseAlpha = _mm256_or_si256(inverseAlpha, _mm256_slli_epi32(inverseAlpha, 16));
+        __m256i inverseAlphaLow = _mm256_unpacklo_epi32(inverseAlpha, inverseAlpha);
+        __m256i inverseAlphaHigh = _mm256_unpackhi_epi32(inverseAlpha, inverseAlpha);
+
+        _mm256_storeu_si256((__m256i*)(dest + x), blendPremultipliedAVX2(d, s, inverseAlphaLow, inverseAlphaHigh));
+    }
+
+    for(; x < count; x++) {
+        dest[x] = blendPremultiplied<layout>(dest[x], source[x]);
+    }
+}
+
+inline uint32_t getTexelIndex(const QuadSetup* setup, int32_t x, int32_t y) {
+    return (y >> 2) * setup->tileRowStride + ((y & 3) << 2) + ((x >> 2) << 4) + (x & 3);
+}
+
+//NOTE: Bilinear weights are 8 bit, so each lerp stays inside 16 bits:
+//      a * (256 - t) + b * t is at most 255 * 256
+inline uint32_t lerpTexels(uint32_t a, uint32_t b, uint32_t t) {
+    uint32_t result = 0;
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t channel = (((a >> shift) & 0xFF) * (256 - t) + ((b >> shift) & 0xFF) * t) >> 8;
+        result |= channel << shift;
+    }
+    return result;
+}
+
+//NOTE: One pixel of a textured quad, the reference the SIMD spans have to
+//      match.  Sampling clamps to the texture edge.
+template<PixelLayout layout>
+inline void shadeQuadPixel(Pixel* dest, const QuadSetup* setup, real32_t uRow, real32_t vRow, uint32_t x) {
+    real32_t dx = ((real32_t)x + .5f) - setup->originX;
+    real32_t u = dx * setup->uPerX + uRow;
+    real32_t v = dx * setup->vPerX + vRow;
+
+    if(!(u >= 0.f && u < 1.f && v >= 0.f && v < 1.f)) {
+        return;
+    }
+
+    int32_t s = (int32_t)(u * setup->texelScaleX) - 128;
+    int32_t t = (int32_t)(v * setup->texelScaleY) - 128;
+    int32_t x0 = s >> 8;
+    int32_t y0 = t >> 8;
+    int32_t x1 = (x0 + 1 > setup->maxTexelX) ? setup->maxTexelX : x0 + 1;
+    int32_t y1 = (y0 + 1 > setup->maxTexelY) ? setup->maxTexelY : y0 + 1;
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+
+    const Pixel* texels = setup->texture->texels;
+    uint32_t top = lerpTexels(texels[getTexelIndex(setup, x0, y0)].value, texels[getTexelIndex(setup, x1, y0)].value, s & 0xFF);
+    uint32_t bottom = lerpTexels(texels[getTexelIndex(setup, x0, y1)].value, texels[getTexelIndex(setup, x1, y1)].value, s & 0xFF);
+
+    Pixel sample;
+    sample.value = lerpTexels(top, bottom, t & 0xFF);
+    *dest = blendPremultiplied<layout>(*dest, sample);
+}
+
+template<PixelLayout layout>
+static void texturedQuadSpanScalar(Pixel* row, const QuadSetup* setup, uint32_t y, uint32_t minX, uint32_t maxX) {
+    real32_t dy = ((real32_t)y + .5f) - setup->originY;
+    real32_t uRow = dy * setup->uPerY;
+    real32_t vRow = dy * setup->vPerY;
+
+    for(uint32_t x = minX; x < maxX; x++) {
+        shadeQuadPixel<layout>(row + x, setup, uRow, vRow, x);
+    }
+}
+
+//NOTE: Puts a per pixel 8 bit weight in all four 16 bit channels of its
+//      pixel, matching the layout of the 8 to 16 bit unpacks
+inline void spreadWeightSSE2(__m128i weight, __m128i* low, __m128i* high) {
+    weight = _mm_or_si128(weight, _mm_slli_epi32(weight, 16));
+    *low = _mm_unpacklo_epi32(weight, weight);
+    *high = _mm_unpackhi_epi32(weight, weight);
+}
+
+inline __m128i lerpTexelsSSE2(__m128i a, __m128i b, __m128i t) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi32(256);
+
+    __m128i tLow, tHigh, sLow, sHigh;
+    spreadWeightSSE2(t, &tLow, &tHigh);
+    spreadWeightSSE2(_mm_sub_epi32(full, t), &sLow, &sHigh);
+
+    __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), sLow), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), tLow));
+    __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), sHigh), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), tHigh));
+
+    return _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8));
+}
+
+//NOTE: (y >> 2) * stride with madd, which SSE2 has for 16 bit halves.  Both
+//      fit in 15 bits since textures are at most TEXTURE_MAX_SIZE.
+inline __m128i getTexelIndexSSE2(__m128i x, __m128i y, __m128i stride) {
+    const __m128i three = _mm_set1_epi32(3);
+    __m128i index = _mm_madd_epi16(_mm_srli_epi32(y, 2), stride);
+    index = _mm_add_epi32(index, _mm_slli_epi32(_mm_and_si128(y, three), 2));
+    index = _mm_add_epi32(index, _mm_slli_epi32(_mm_srli_epi32(x, 2), 4));
+    return _mm_add_epi32(index, _mm_and_si128(x, three));
+}
+
+//NOTE: No gather before AVX2, so the four taps are loaded one lane at a time
+inline __m128i gatherTexelsSSE2(const Pixel* texels, __m128i index) {
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128((__m128i*)lanes, index);
+    return _mm_setr_epi32(texels[lanes[0]].value, texels[lanes[1]].value, texels[lanes[2]].value, texels[lanes[3]].value);
+}
+
+template<PixelLayout layout>
+static void texturedQuadSpanSSE2(Pixel* row, const QuadSetup* setup, uint32_t y, uint32_t minX, uint32_t maxX) {
+    real32_t dy = ((real32_t)y + .5f) - setup->originY;
+    real32_t uRow = dy * setup->uPerY;
+    real32_t vRow = dy * setup->vPerY;
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 half = _mm_set1_ps(.5f);
+    const __m128 originX = _mm_set1_ps(setup->originX);
+    const __m128 uPerX = _mm_set1_ps(setup->uPerX);
+    const __m128 vPerX = _mm_set1_ps(setup->vPerX);
+    const __m128 uStart = _mm_set1_ps(uRow);
+    const __m128 vStart = _mm_set1_ps(vRow);
+    const __m128 texelScaleX = _mm_set1_ps(setup->texelScaleX);
+    const __m128 texelScaleY = _mm_set1_ps(setup->texelScaleY);
+    const __m128i bias = _mm_set1_epi32(128);
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i oneTexel = _mm_set1_epi32(1);
+    const __m128i maxTexelX = _mm_set1_epi32(setup->maxTexelX);
+    const __m128i maxTexelY = _mm_set1_epi32(setup->maxTexelY);
+    const __m128i stride = _mm_set1_epi32(setup->tileRowStride);
+    const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+    const Pixel* texels = setup->texture->texels;
+
+    uint32_t x = minX;
+    for(; x + 4 <= maxX; x += 4) {
+        __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), laneOffsets)), half), originX);
+        __m128 u = _mm_add_ps(_mm_mul_ps(dx, uPerX), uStart);
+        __m128 v = _mm_add_ps(_mm_mul_ps(dx, vPerX), vStart);
+
+        __m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmplt_ps(u, one)),
+                _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmplt_ps(v, one)));
+        if(_mm_movemask_ps(covered) == 0) {
+            continue;
+        }
+
+        //uncovered lanes still sample, so keep them on the texture
+        u = _mm_min_ps(_mm_max_ps(u, zero), one);
+        v = _mm_min_ps(_mm_max_ps(v, zero), one);
+
+        __m128i s = _mm_sub_epi32(_mm_cvttps_epi32(_mm_mul_ps(u, texelScaleX)), bias);
+        __m128i t = _mm_sub_epi32(_mm_cvttps_epi32(_mm_mul_ps(v, texelScaleY)), bias);
+        __m128i x0 = _mm_srai_epi32(s, 8);
+        __m128i y0 = _mm_srai_epi32(t, 8);
+        __m128i x1 = _mm_add_epi32(x0, oneTexel);
+        __m128i y1 = _mm_add_epi32(y0, oneTexel);
+        __m128i pastX = _mm_cmpgt_epi32(x1, maxTexelX);
+        __m128i pastY = _mm_cmpgt_epi32(y1, maxTexelY);
+        x1 = _mm_or_si128(_mm_and_si128(pastX, maxTexelX), _mm_andnot_si128(pastX, x1));
+        y1 = _mm_or_si128(_mm_and_si128(pastY, maxTexelY), _mm_andnot_si128(pastY, y1));
+        x0 = _mm_andnot_si128(_mm_srai_epi32(x0, 31), x0);
+        y0 = _mm_andnot_si128(_mm_srai_epi32(y0, 31), y0);
+
+        __m128i texel00 = gatherTexelsSSE2(texels, getTexelIndexSSE2(x0, y0, stride));
+        __m128i texel10 = gatherTexelsSSE2(texels, getTexelIndexSSE2(x1, y0, stride));
+        __m128i texel01 = gatherTexelsSSE2(texels, getTexelIndexSSE2(x0, y1, stride));
+        __m128i texel11 = gatherTexelsSSE2(texels, getTexelIndexSSE2(x1, y1, stride));
+
+        __m128i fractionX = _mm_and_si128(s, byteMask);
+        __m128i top = lerpTexelsSSE2(texel00, texel10, fractionX);
+        __m128i bottom = lerpTexelsSSE2(texel01, texel11, fractionX);
+        __m128i sample = lerpTexelsSSE2(top, bottom, _mm_and_si128(t, byteMask));
+
+        __m128i inverseAlphaLow, inverseAlphaHigh;
+        spreadWeightSSE2(_mm_sub_epi32(byteMask, _mm_and_si128(_mm_srli_epi32(sample, getAlphaShift(layout)), byteMask)), &inverseAlphaLow, &inverseAlphaHigh);
+
+        __m128i dest = _mm_loadu_si128((__m128i*)(row + x));
+        __m128i blended = blendPremultipliedSSE2(dest, sample, inverseAlphaLow, inverseAlphaHigh);
+        __m128i mask = _mm_castps_si128(covered);
+        _mm_storeu_si128((__m128i*)(row + x), _mm_or_si128(_mm_and_si128(mask, blended), _mm_andnot_si128(mask, dest)));
+    }
+
+    for(; x < maxX; x++) {
+        shadeQuadPixel<layout>(row + x, setup, uRow, vRow, x);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void spreadWeightAVX2(__m256i weight, __m256i* low, __m256i* high) {
+    weight = _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+    *low = _mm256_unpacklo_epi32(weight, weight);
+    *high = _mm256_unpackhi_epi32(weight, weight);
+}
+
+__attribute__((target("avx2")))
+inline __m256i lerpTexelsAVX2(__m256i a, __m256i b, __m256i t) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi32(256);
+
+    __m256i tLow, tHigh, sLow, sHigh;
+    spreadWeightAVX2(t, &tLow, &tHigh);
+    spreadWeightAVX2(_mm256_sub_epi32(full, t), &sLow, &sHigh);
+
+    __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), sLow), _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), tLow));
+    __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), sHigh), _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), tHigh));
+
+    return _mm256_packus_epi16(_mm256_srli_epi16(low, 8), _mm256_srli_epi16(high, 8));
+}
+
+__attribute__((target("avx2")))
+inline __m256i getTexelIndexAVX2(__m256i x, __m256i y, __m256i stride) {
+    const __m256i three = _mm256_set1_epi32(3);
+    __m256i index = _mm256_mullo_epi32(_mm256_srli_epi32(y, 2), stride);
+    index = _mm256_add_epi32(index, _mm256_slli_epi32(_mm256_and_si256(y, three), 2));
+    index = _mm256_add_epi32(index, _mm256_slli_epi32(_mm256_srli_epi32(x, 2), 4));
+    return _mm256_add_epi32(index, _mm256_and_si256(x, three));
+}
+
+template<PixelLayout layout>
+__attribute__((target("avx2")))
+static void texturedQuadSpanAVX2(Pixel* row, const QuadSetup* setup, uint32_t y, uint32_t minX, uint32_t maxX) {
+    real32_t dy = ((real32_t)y + .5f) - setup->originY;
+    real32_t uRow = dy * setup->uPerY;
+    real32_t vRow = dy * setup->vPerY;
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 half = _mm256_set1_ps(.5f);
+    const __m256 originX = _mm256_set1_ps(setup->originX);
+    const __m256 uPerX = _mm256_set1_ps(setup->uPerX);
+    const __m256 vPerX = _mm256_set1_ps(setup->vPerX);
+    const __m256 uStart = _mm256_set1_ps(uRow);
+    const __m256 vStart = _mm256_set1_ps(vRow);
+    const __m256 texelScaleX = _mm256_set1_ps(setup->texelScaleX);
+    const __m256 texelScaleY = _mm256_set1_ps(setup->texelScaleY);
+    const __m256i bias = _mm256_set1_epi32(128);
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m256i oneTexel = _mm256_set1_epi32(1);
+    const __m256i zeroTexel = _mm256_setzero_si256();
+    const __m256i maxTexelX = _mm256_set1_epi32(setup->maxTexelX);
+    const __m256i maxTexelY = _mm256_set1_epi32(setup->maxTexelY);
+    const __m256i stride = _mm256_set1_epi32(setup->tileRowStride);
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const int* texels = (const int*)setup->texture->texels;
+
+    uint32_t x = minX;
+    for(; x + 8 <= maxX; x += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_add_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), laneOffsets)), half), originX);
+        __m256 u = _mm256_add_ps(_mm256_mul_ps(dx, uPerX), uStart);
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(dx, vPerX), vStart);
+
+        __m256 covered = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LT_OQ)),
+                _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LT_OQ)));
+        if(_mm256_movemask_ps(covered) == 0) {
+            continue;
+        }
+
+        u = _mm256_min_ps(_mm256_max_ps(u, zero), one);
+        v = _mm256_min_ps(_mm256_max_ps(v, zero), one);
+
+        __m256i s = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, texelScaleX)), bias);
+        __m256i t = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(v, texelScaleY)), bias);
+        __m256i x0 = _mm256_max_epi32(_mm256_srai_epi32(s, 8), zeroTexel);
+        __m256i y0 = _mm256_max_epi32(_mm256_srai_epi32(t, 8), zeroTexel);
+        __m256i x1 = _mm256_min_epi32(_mm256_add_epi32(_mm256_srai_epi32(s, 8), oneTexel), maxTexelX);
+        __m256i y1 = _mm256_min_epi32(_mm256_add_epi32(_mm256_srai_epi32(t, 8), oneTexel), maxTexelY);
+
+        __m256i texel00 = _mm256_i32gather_epi32(texels, getTexelIndexAVX2(x0, y0, stride), 4);
+        __m256i texel10 = _mm256_i32gather_epi32(texels, getTexelIndexAVX2(x1, y0, stride), 4);
+        __m256i texel01 = _mm256_i32gather_epi32(texels, getTexelIndexAVX2(x0, y1, stride), 4);
+        __m256i texel11 = _mm256_i32gather_epi32(texels, getTexelIndexAVX2(x1, y1, stride), 4);
+
+        __m256i fractionX = _mm256_and_si256(s, byteMask);
+        __m256i top = lerpTexelsAVX2(texel00, texel10, fractionX);
+        __m256i bottom = lerpTexelsAVX2(texel01, texel11, fractionX);
+        __m256i sample = lerpTexelsAVX2(top, bottom, _mm256_and_si256(t, byteMask));
+
+        __m256i inverseAlphaLow, inverseAlphaHigh;
+        spreadWeightAVX2(_mm256_sub_epi32(byteMask, _mm256_and_si256(_mm256_srli_epi32(sample, getAlphaShift(layout)), byteMask)), &inverseAlphaLow, &inverseAlphaHigh);
+
+        __m256i dest = _mm256_loadu_si256((__m256i*)(row + x));
+        __m256i blended = blendPremultipliedAVX2(dest, sample, inverseAlphaLow, inverseAlphaHigh);
+        _mm256_storeu_si256((__m256i*)(row + x), _mm256_blendv_epi8(dest, blended, _mm256_castps_si256(covered)));
+    }
+
+    for(; x < maxX; x++) {
+        shadeQuadPixel<layout>(row + x, setup, uRow, vRow, x);
+    }
+}
+
+template<PixelLayout layout>
+static DrawSpanKernels getDrawSpanKernelsFor(SimdLevel level) {
+    DrawSpanKernels kernels;
+    kernels.layout = layout;
+
+    switch(level) {
+        case SimdLevel_AVX2:
+            kernels.fill = fillSpanAVX2;
+            kernels.blendColor = blendColorSpanAVX2<layout>;
+            kernels.blend = blendSpanAVX2<layout>;
+            kernels.texturedQuad = texturedQuadSpanAVX2<layout>;
+            break;
+        case SimdLevel_SSE2:
+            kernels.fill = fillSpanSSE2;
+            kernels.blendColor = blendColorSpanSSE2<layout>;
+            kernels.blend = blendSpanSSE2<layout>;
+            kernels.texturedQuad = texturedQuadSpanSSE2<layout>;
+            break;
+        default:
+            kernels.fill = fillSpanScalar;
+            kernels.blendColor = blendColorSpanScalar<layout>;
+            kernels.blend = blendSpanScalar<layout>;
+            kernels.texturedQuad = texturedQuadSpanScalar<layout>;
+            break;
+    }
+
+    return kernels;
+}
+
+static DrawSpanKernels getDrawSpanKernels(SimdLevel level, PixelLayout layout) {
+    switch(layout) {
+        case PixelLayout_ARGB:
+            return getDrawSpanKernelsFor<PixelLayout_ARGB>(level);
+        case PixelLayout_ABGR:
+            return getDrawSpanKernelsFor<PixelLayout_ABGR>(level);
+        case PixelLayout_BGRA:
+            return getDrawSpanKernelsFor<PixelLayout_BGRA>(level);
+        default:
+            return getDrawSpanKernelsFor<PixelLayout_RGBA>(level);
+    }
+}
+
+//NOTE: A pixel is covered when its centre is inside [min, max), so edges
+//      that meet share no pixels and nothing is drawn twice.  Clamped in
+//      float first so huge or NaN coordinates cannot overflow the int.
+inline int32_t getCoveredPixel(real32_t edge, uint32_t limit) {
+    real32_t pixel = ceilf(edge - .5f);
+    pixel = (pixel > 0.f) ? pixel : 0.f;
+    pixel = (pixel < (real32_t)limit) ? pixel : (real32_t)limit;
+    return (int32_t)pixel;
+}
+
+static void drawRectangle(OffScreenBuffer* buf, const DrawSpanKernels* kernels, real32_t minX, real32_t minY, real32_t maxX, real32_t maxY, Pixel color) {
+    int32_t x0 = getCoveredPixel(minX, buf->width);
+    int32_t y0 = getCoveredPixel(minY, buf->height);
+    int32_t x1 = getCoveredPixel(maxX, buf->width);
+    int32_t y1 = getCoveredPixel(maxY, buf->height);
+
+    if(x0 >= x1 || y0 >= y1 || color.value == 0) {
+        return;
+    }
+
+    ColorSpanFunc* span = (getPixelAlpha(color, kernels->layout) == 0xFF) ? kernels->fill : kernels->blendColor;
+    for(int32_t y = y0; y < y1; y++) {
+        span(getRow(buf, y) + x0, x1 - x0, color);
+    }
+}
+
+//NOTE: Snaps the top left corner to a whole pixel with the same rule as
+//      drawRectangle, there is no filtering
+static void drawBitmap(OffScreenBuffer* buf, const DrawSpanKernels* kernels, const LoadedBitmap* bitmap, real32_t x, real32_t y) {
+    //limits are far enough out that the unclipped corner still fits an int
+    const real32_t limit = (real32_t)(1 << 30);
+    x = (x > -limit) ? ((x < limit) ? x : limit) : -limit;
+    y = (y > -limit) ? ((y < limit) ? y : limit) : -limit;
+
+    int64_t originX = (int64_t)ceilf(x - .5f);
+    int64_t originY = (int64_t)ceilf(y - .5f);
+    int64_t x0 = (originX > 0) ? originX : 0;
+    int64_t y0 = (originY > 0) ? originY : 0;
+    int64_t x1 = originX + bitmap->width;
+    int64_t y1 = originY + bitmap->height;
+    x1 = (x1 < buf->width) ? x1 : buf->width;
+    y1 = (y1 < buf->height) ? y1 : buf->height;
+
+    if(x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    for(int64_t row = y0; row < y1; row++) {
+        const Pixel* source = (const Pixel*)((const uint8_t*)bitmap->pixels + (uint64_t)(row - originY) * bitmap->pitch) + (x0 - originX);
+        kernels->blend(getRow(buf, row) + x0, source, x1 - x0);
+    }
+}
+
+//NOTE: Copies a bitmap into tiles.  Tiles past the right and bottom edges
+//      are padded with the edge texels; sampling clamps before it gets there.
+static TiledTexture tileTexture(MemoryArena* arena, const LoadedBitmap* bitmap) {
+    TiledTexture texture;
+
+    if(bitmap->width == 0 || bitmap->height == 0 || bitmap->width > TEXTURE_MAX_SIZE || bitmap->height > TEXTURE_MAX_SIZE) {
+        return texture;
+    }
+
+    texture.width = bitmap->width;
+    texture.height = bitmap->height;
+    texture.tilesPerRow = alignPow2(bitmap->width, TEXTURE_TILE_SIZE) / TEXTURE_TILE_SIZE;
+    uint32_t paddedHeight = alignPow2(bitmap->height, TEXTURE_TILE_SIZE);
+    texture.texels = (Pixel*)pushSize_(arena, (uint64_t)texture.tilesPerRow * TEXTURE_TILE_SIZE * paddedHeight * sizeof(Pixel), CACHE_LINE_SIZE);
+
+    QuadSetup setup;
+    setup.tileRowStride = texture.tilesPerRow * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+    for(uint32_t y = 0; y < paddedHeight; y++) {
+        uint32_t sourceY = (y < bitmap->height) ? y : bitmap->height - 1;
+        const Pixel* source = (const Pixel*)((const uint8_t*)bitmap->pixels + (uint64_t)sourceY * bitmap->pitch);
+
+        for(uint32_t x = 0; x < texture.tilesPerRow * TEXTURE_TILE_SIZE; x++) {
+            uint32_t sourceX = (x < bitmap->width) ? x : bitmap->width - 1;
+            texture.texels[getTexelIndex(&setup, x, y)] = source[sourceX];
+        }
+    }
+
+    return texture;
+}
+
+//NOTE: Draws the parallelogram origin + u * xAxis + v * yAxis for u and v in
+//      [0, 1) with the texture stretched over it, bilinear filtered and
+//      blended.  Everything per quad is done here so the span kernels only
+//      step the edge functions along x.
+static void drawQuad(OffScreenBuffer* buf, const DrawSpanKernels* kernels, const TiledTexture* texture, V2 origin, V2 xAxis, V2 yAxis) {
+    real32_t determinant = xAxis.x * yAxis.y - yAxis.x * xAxis.y;
+    if(!texture->texels || fabsf(determinant) < 1e-6f) {
+        return;
+    }
+
+    real32_t cornersX[4] = {origin.x, origin.x + xAxis.x, origin.x + yAxis.x, origin.x + xAxis.x + yAxis.x};
+    real32_t cornersY[4] = {origin.y, origin.y + xAxis.y, origin.y + yAxis.y, origin.y + xAxis.y + yAxis.y};
+    real32_t minX = cornersX[0], maxX = cornersX[0], minY = cornersY[0], maxY = cornersY[0];
+    for(uint32_t i = 1; i < 4; i++) {
+        minX = (cornersX[i] < minX) ? cornersX[i] : minX;
+        maxX = (cornersX[i] > maxX) ? cornersX[i] : maxX;
+        minY = (cornersY[i] < minY) ? cornersY[i] : minY;
+        maxY = (cornersY[i] > maxY) ? cornersY[i] : maxY;
+    }
+
+    int32_t x0 = getCoveredPixel(minX, buf->width);
+    int32_t y0 = getCoveredPixel(minY, buf->height);
+    int32_t x1 = getCoveredPixel(maxX, buf->width);
+    int32_t y1 = getCoveredPixel(maxY, buf->height);
+    if(x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    QuadSetup setup;
+    setup.texture = texture;
+    setup.originX = origin.x;
+    setup.originY = origin.y;
+    setup.uPerX = yAxis.y / determinant;
+    setup.uPerY = -yAxis.x / determinant;
+    setup.vPerX = -xAxis.y / determinant;
+    setup.vPerY = xAxis.x / determinant;
+    setup.texelScaleX = (real32_t)(texture->width * 256);
+    setup.texelScaleY = (real32_t)(texture->height * 256);
+    setup.maxTexelX = texture->width - 1;
+    setup.maxTexelY = texture->height - 1;
+    setup.tileRowStride = texture->tilesPerRow * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+
+    for(int32_t y = y0; y < y1; y++) {
+        kernels->texturedQuad(getRow(buf, y), &setup, y, x0, x1);
+    }
+}
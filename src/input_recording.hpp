@@ -0,0 +1,547 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "handmade.hpp"
+#include "platform_log.hpp"
+
+//NOTE: Input recording file shared by the sdl platform and the bench driver.
+//      Layout is an InputRecordingHeader, the frames back to back, then the
+//      index: the file offset of every keyframe.  Each frame is encoded
+//      against the previous one and keyframes against an idle controller, so
+//      playback can start at any keyframe and seeking to a frame decodes at
+//      most INPUT_KEYFRAME_INTERVAL - 1 frames past it.
+//
+//      A frame is a varint mask of the controllers that differ from the
+//      frame before, then for each of those:
+//          varint  isEndedDown bits XOR the previous frame, isAnalog in bit 12
+//          varint  mask of buttons with a nonzero halfTransitionCount
+//          varint  mask of buttons with more than one transition
+//          varint  halfTransitionCount - 2 for each button in that mask
+//          varint  zigzag delta of each stick axis, quantized to int16
+//      An idle frame is one byte.  Axes round trip exactly for values that
+//      came from an int16 stick reading the way the platform normalizes them.
+//
+//      Recording encodes on the calling thread into fixed chunks and a
+//      writer thread does the file io.  The header and index are only
+//      written when recording stops; a file without them still plays from
+//      the start.  The index is allocated up front for the longest
+//      recording, so the calling thread never allocates.
+
+#define INPUT_RECORDING_MAGIC 0x52494D48 //"HMIR"
+#define INPUT_RECORDING_VERSION 1
+#define INPUT_KEYFRAME_INTERVAL 64
+#define INPUT_CHUNK_SIZE KB(16)
+#define INPUT_CHUNK_COUNT 4
+#define INPUT_MAX_RECORDING_FRAMES (240 * 60 * 60 * 4) //4 hours at 240Hz
+#define INPUT_MAX_KEYFRAMES (INPUT_MAX_RECORDING_FRAMES / INPUT_KEYFRAME_INTERVAL)
+#define INPUT_MAX_FRAME_SIZE (1 + MAX_CONTROLLERS * (3 * 3 + NUM_BUTTONS * 5 + 2 * 5))
+#define INPUT_ANALOG_BIT (1u << NUM_BUTTONS)
+
+struct InputRecordingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frameCount;        //0 if recording never stopped cleanly
+    uint32_t keyframeInterval;
+    uint64_t indexOffset;       //0 if recording never stopped cleanly
+};
+
+//NOTE: What a frame is delta encoded against
+struct QuantizedController {
+    uint32_t downBits;
+    int32_t x;
+    int32_t y;
+};
+
+struct InputChunk {
+    uint8_t* bytes = nullptr;
+    uint32_t size = 0;          //0 tells the writer thread to stop
+};
+
+struct InputRecorder {
+    int fd = -1;
+    InputChunk chunks[INPUT_CHUNK_COUNT];
+    uint32_t writeIndex = 0;    //calling thread only
+    uint32_t readIndex = 0;     //writer thread only
+    uint64_t fileOffset = 0;    //where the next frame lands
+    uint32_t frameCount = 0;
+    QuantizedController previous[MAX_CONTROLLERS];
+
+    uint64_t* keyframeOffsets = nullptr;   //INPUT_MAX_KEYFRAMES, after the chunks
+
+    std::thread thread;
+    sem_t freeChunks;
+    sem_t readyChunks;
+    std::atomic<bool> writeFailed;
+
+    InputRecorder()
+    :writeFailed(false)
+    {
+    }
+};
+
+struct InputPlayer {
+    const uint8_t* file = nullptr;
+    uint64_t fileSize = 0;
+    const uint8_t* keyframeIndex = nullptr;     //uint64 offsets, not necessarily aligned
+    uint32_t keyframeCount = 0;
+    uint32_t keyframeInterval = 0;
+    uint32_t frameCount = 0;    //0 when the file has no index
+    uint64_t dataEnd = 0;
+    uint64_t cursor = 0;
+    uint32_t frame = 0;         //index of the next frame to play
+    QuantizedController previous[MAX_CONTROLLERS];
+};
+
+inline uint32_t writeVarint(uint8_t* out, uint32_t value) {
+    uint32_t size = 0;
+
+    while(value >= 0x80) {
+        out[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t)value;
+
+    return size;
+}
+
+inline bool readVarint(const uint8_t** at, const uint8_t* end, uint32_t* value) {
+    uint32_t result = 0;
+
+    for(uint32_t shift = 0; shift < 35; shift += 7) {
+        if(*at >= end) {
+            return false;
+        }
+
+        uint8_t byte = *(*at)++;
+        result |= (uint32_t)(byte & 0x7F) << shift;
+
+        if(!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+inline uint32_t zigzagEncode(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t zigzagDecode(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+//NOTE: Inverse of normalizeStickInput in sdl_main.cpp
+inline int32_t quantizeAxis(real32_t value) {
+    return (int32_t)lrint((value > 0.f) ? value * 32767.0 : value * 32768.0);
+}
+
+inline real32_t dequantizeAxis(int32_t value) {
+    return (value > 0) ? value / 32767.0 : value / 32768.0;
+}
+
+static QuantizedController quantizeController(const ControllerInput* controller) {
+    QuantizedController result;
+    result.downBits = controller->isAnalog ? INPUT_ANALOG_BIT : 0;
+
+    for(uint32_t b = 0; b < NUM_BUTTONS; b++) {
+        if(controller->buttons[b].isEndedDown) {
+            result.downBits |= 1u << b;
+        }
+    }
+
+    result.x = quantizeAxis(controller->avgX);
+    result.y = quantizeAxis(controller->avgY);
+
+    return result;
+}
+
+static uint32_t encodeInputFrame(const InputContext* input, QuantizedController* previous, uint8_t* out) {
+    uint8_t body[INPUT_MAX_FRAME_SIZE];
+    uint32_t bodySize = 0;
+    uint32_t changedMask = 0;
+
+    for(uint32_t c = 0; c < MAX_CONTROLLERS; c++) {
+        const ControllerInput* controller = &input->controllers[c];
+        QuantizedController current = quantizeController(controller);
+
+        uint32_t transitionMask = 0;
+        uint32_t multiMask = 0;
+        for(uint32_t b = 0; b < NUM_BUTTONS; b++) {
+            uint32_t count = controller->buttons[b].halfTransitionCount;
+            transitionMask |= (count > 0) << b;
+            multiMask |= (count > 1) << b;
+        }
+
+        if(!transitionMask && current.downBits == previous[c].downBits &&
+                current.x == previous[c].x && current.y == previous[c].y) {
+            continue;
+        }
+
+        changedMask |= 1u << c;
+        bodySize += writeVarint(body + bodySize, current.downBits ^ previous[c].downBits);
+        bodySize += writeVarint(body + bodySize, transitionMask);
+        bodySize += writeVarint(body + bodySize, multiMask);
+
+        for(uint32_t b = 0; b < NUM_BUTTONS; b++) {
+            if(multiMask & (1u << b)) {
+                bodySize += writeVarint(body + bodySize, controller->buttons[b].halfTransitionCount - 2);
+            }
+        }
+
+        bodySize += writeVarint(body + bodySize, zigzagEncode(current.x - previous[c].x));
+        bodySize += writeVarint(body + bodySize, zigzagEncode(current.y - previous[c].y));
+
+        previous[c] = current;
+    }
+
+    uint32_t size = writeVarint(out, changedMask);
+    memcpy(out + size, body, bodySize);
+
+    return size + bodySize;
+}
+
+//NOTE: False on a truncated or corrupt frame, input is then half written
+static bool decodeInputFrame(const uint8_t** at, const uint8_t* end, QuantizedController* previous, InputContext* input) {
+    uint32_t changedMask;
+    if(!readVarint(at, end, &changedMask)) {
+        return false;
+    }
+
+    for(uint32_t c = 0; c < MAX_CONTROLLERS; c++) {
+        ControllerInput* controller = &input->controllers[c];
+        uint32_t transitionMask = 0;
+        uint32_t multiMask = 0;
+        uint32_t counts[NUM_BUTTONS] = {};
+
+        if(changedMask & (1u << c)) {
+            uint32_t downDelta, xDelta, yDelta;
+
+            if(!readVarint(at, end, &downDelta) || !readVarint(at, end, &transitionMask) ||
+                    !readVarint(at, end, &multiMask)) {
+                return false;
+            }
+
+            for(uint32_t b = 0; b < NUM_BUTTONS; b++) {
+                if(multiMask & (1u << b)) {
+                    if(!readVarint(at, end, &counts[b])) {
+                        return false;
+                    }
+                    counts[b] += 2;
+                }
+                else if(transitionMask & (1u << b)) {
+                    counts[b] = 1;
+                }
+            }
+
+            if(!readVarint(at, end, &xDelta) || !readVarint(at, end, &yDelta)) {
+                return false;
+            }
+
+            previous[c].downBits ^= downDelta;
+            previous[c].x += zigzagDecode(xDelta);
+            previous[c].y += zigzagDecode(yDelta);
+        }
+
+        controller->isAnalog = (previous[c].downBits & INPUT_ANALOG_BIT) != 0;
+        controller->avgX = dequantizeAxis(previous[c].x);
+        controller->avgY = dequantizeAxis(previous[c].y);
+
+        for(uint32_t b = 0; b < NUM_BUTTONS; b++) {
+            controller->buttons[b].halfTransitionCount = counts[b];
+            controller->buttons[b].isEndedDown = (previous[c].downBits >> b) & 1;
+        }
+    }
+
+    return true;
+}
+
+static void inputWriterThreadProc(InputRecorder* recorder) {
+    for(;;) {
+        sem_wait(&recorder->readyChunks);
+
+        InputChunk* chunk = &recorder->chunks[recorder->readIndex];
+        if(chunk->size == 0) {
+            break;
+        }
+
+        uint32_t written = 0;
+        while(written < chunk->size) {
+            ssize_t result = write(recorder->fd, chunk->bytes + written, chunk->size - written);
+            if(result <= 0) {
+                LOG_ERROR("Input recording write failed: %s", (result < 0) ? strerror(errno) : "nothing written");
+                recorder->writeFailed.store(true, std::memory_order_relaxed);
+                break;
+            }
+            written += result;
+        }
+
+        recorder->readIndex = (recorder->readIndex + 1) % INPUT_CHUNK_COUNT;
+        sem_post(&recorder->freeChunks);
+    }
+}
+
+//NOTE: Hands the chunk being filled to the writer thread and waits for the
+//      next one to come free
+static void submitInputChunk(InputRecorder* recorder) {
+    sem_post(&recorder->readyChunks);
+    recorder->writeIndex = (recorder->writeIndex + 1) % INPUT_CHUNK_COUNT;
+
+    sem_wait(&recorder->freeChunks);
+    recorder->chunks[recorder->writeIndex].size = 0;
+}
+
+static bool beginInputRecording(InputRecorder* recorder, const char* path) {
+    if(!recorder->chunks[0].bytes) {
+        //NOTE: Populated so the first frames don't page fault either
+        uint8_t* memory = (uint8_t*)mmap(nullptr, INPUT_CHUNK_SIZE * INPUT_CHUNK_COUNT + INPUT_MAX_KEYFRAMES * sizeof(uint64_t),
+                PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+
+        if(memory == MAP_FAILED) {
+            return false;
+        }
+
+        for(uint32_t i = 0; i < INPUT_CHUNK_COUNT; i++) {
+            recorder->chunks[i].bytes = memory + i * INPUT_CHUNK_SIZE;
+        }
+        recorder->keyframeOffsets = (uint64_t*)(memory + INPUT_CHUNK_SIZE * INPUT_CHUNK_COUNT);
+    }
+
+    if((recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        return false;
+    }
+
+    //NOTE: Frames start after the header, which is filled in on stop
+    InputRecordingHeader header = {};
+    if(write(recorder->fd, &header, sizeof(header)) != sizeof(header)) {
+        close(recorder->fd);
+        recorder->fd = -1;
+        return false;
+    }
+
+    recorder->fileOffset = sizeof(header);
+    recorder->frameCount = 0;
+    recorder->writeIndex = 0;
+    recorder->readIndex = 0;
+    recorder->chunks[0].size = 0;
+    recorder->writeFailed.store(false, std::memory_order_relaxed);
+
+    sem_init(&recorder->freeChunks, 0, INPUT_CHUNK_COUNT - 1); //the first one is already ours
+    sem_init(&recorder->readyChunks, 0, 0);
+    recorder->thread = std::thread(inputWriterThreadProc, recorder);
+
+    return true;
+}
+
+//NOTE: False once the recording is as long as it can get, or the writer
+//      thread failed.  The caller has to stop the recording then, nothing
+//      more is recorded.
+static bool recordInputFrame(InputRecorder* recorder, const InputContext* input) {
+    if(recorder->frameCount == INPUT_MAX_RECORDING_FRAMES || recorder->writeFailed.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    InputChunk* chunk = &recorder->chunks[recorder->writeIndex];
+    if(chunk->size + INPUT_MAX_FRAME_SIZE > INPUT_CHUNK_SIZE) {
+        submitInputChunk(recorder);
+        chunk = &recorder->chunks[recorder->writeIndex];
+    }
+
+    if(recorder->frameCount % INPUT_KEYFRAME_INTERVAL == 0) {
+        recorder->keyframeOffsets[recorder->frameCount / INPUT_KEYFRAME_INTERVAL] = recorder->fileOffset;
+        memset(recorder->previous, 0, sizeof(recorder->previous));
+    }
+
+    uint32_t size = encodeInputFrame(input, recorder->previous, chunk->bytes + chunk->size);
+    chunk->size += size;
+    recorder->fileOffset += size;
+    recorder->frameCount++;
+    return true;
+}
+
+//NOTE: Flushes everything, then appends the index and fills in the header
+static bool stopInputRecording(InputRecorder* recorder) {
+    if(recorder->chunks[recorder->writeIndex].size) {
+        submitInputChunk(recorder);
+    }
+
+    //empty chunk as the stop sentinel
+    sem_post(&recorder->readyChunks);
+    recorder->thread.join();
+
+    sem_destroy(&recorder->freeChunks);
+    sem_destroy(&recorder->readyChunks);
+
+    bool success = !recorder->writeFailed.load(std::memory_order_relaxed);
+
+    uint32_t keyframeCount = (recorder->frameCount + INPUT_KEYFRAME_INTERVAL - 1) / INPUT_KEYFRAME_INTERVAL;
+    uint64_t indexSize = keyframeCount * sizeof(uint64_t);
+
+    if(success && indexSize &&
+            pwrite(recorder->fd, recorder->keyframeOffsets, indexSize, recorder->fileOffset) != (ssize_t)indexSize) {
+        success = false;
+    }
+
+    if(success) {
+        InputRecordingHeader header;
+        header.magic = INPUT_RECORDING_MAGIC;
+        header.version = INPUT_RECORDING_VERSION;
+        header.frameCount = recorder->frameCount;
+        header.keyframeInterval = INPUT_KEYFRAME_INTERVAL;
+        header.indexOffset = recorder->fileOffset;
+
+        success = pwrite(recorder->fd, &header, sizeof(header), 0) == sizeof(header);
+    }
+
+    if(close(recorder->fd) != 0) {
+        success = false;
+    }
+    recorder->fd = -1;
+
+    return success;
+}
+
+static void releaseInputRecorder(InputRecorder* recorder) {
+    if(recorder->chunks[0].bytes) {
+        munmap(recorder->chunks[0].bytes, INPUT_CHUNK_SIZE * INPUT_CHUNK_COUNT + INPUT_MAX_KEYFRAMES * sizeof(uint64_t));
+    }
+
+    for(uint32_t i = 0; i < INPUT_CHUNK_COUNT; i++) {
+        recorder->chunks[i].bytes = nullptr;
+    }
+    recorder->keyframeOffsets = nullptr;
+}
+
+//NOTE: Positions playback so the next frame played is frame.  Costs one index
+//      lookup plus decoding up to the frame from its keyframe.
+static bool seekInputPlayback(InputPlayer* player, uint32_t frame) {
+    if(player->frameCount && frame >= player->frameCount) {
+        return false;
+    }
+
+    uint32_t keyframe = frame / player->keyframeInterval;
+    if(keyframe >= player->keyframeCount && keyframe != 0) {
+        //no index, only the start is known
+        return false;
+    }
+
+    player->cursor = sizeof(InputRecordingHeader);
+    if(player->keyframeCount) {
+        memcpy(&player->cursor, player->keyframeIndex + keyframe * sizeof(uint64_t), sizeof(uint64_t));
+    }
+
+    if(player->cursor < sizeof(InputRecordingHeader) || player->cursor > player->dataEnd) {
+        return false;
+    }
+    player->frame = keyframe * player->keyframeInterval;
+
+    const uint8_t* at = player->file + player->cursor;
+    const uint8_t* end = player->file + player->dataEnd;
+    InputContext skipped;
+
+    memset(player->previous, 0, sizeof(player->previous));
+    while(player->frame < frame) {
+        if(!decodeInputFrame(&at, end, player->previous, &skipped)) {
+            return false;
+        }
+        player->frame++;
+    }
+
+    player->cursor = at - player->file;
+    return true;
+}
+
+static bool openInputPlayback(InputPlayer* player, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        return false;
+    }
+
+    struct stat stats;
+    if(fstat(fd, &stats) != 0 || (uint64_t)stats.st_size < sizeof(InputRecordingHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void* file = mmap(nullptr, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(file == MAP_FAILED) {
+        return false;
+    }
+
+    InputRecordingHeader header;
+    memcpy(&header, file, sizeof(header));
+
+    player->file = (const uint8_t*)file;
+    player->fileSize = stats.st_size;
+
+    if(header.magic == INPUT_RECORDING_MAGIC && header.version == INPUT_RECORDING_VERSION &&
+            header.keyframeInterval && header.indexOffset >= sizeof(header)) {
+        player->keyframeInterval = header.keyframeInterval;
+        player->frameCount = header.frameCount;
+        player->keyframeCount = (header.frameCount + header.keyframeInterval - 1) / header.keyframeInterval;
+        player->dataEnd = header.indexOffset;
+        player->keyframeIndex = player->file + header.indexOffset;
+
+        if(header.indexOffset + player->keyframeCount * sizeof(uint64_t) > player->fileSize) {
+            munmap(file, stats.st_size);
+            player->file = nullptr;
+            return false;
+        }
+    }
+    else if(header.magic == 0) {
+        //NOTE: Never stopped cleanly, play what made it to disk
+        player->keyframeInterval = INPUT_KEYFRAME_INTERVAL;
+        player->frameCount = 0;
+        player->keyframeCount = 0;
+        player->dataEnd = player->fileSize;
+        player->keyframeIndex = nullptr;
+    }
+    else {
+        munmap(file, stats.st_size);
+        player->file = nullptr;
+        return false;
+    }
+
+    madvise(file, stats.st_size, MADV_SEQUENTIAL);
+
+    return seekInputPlayback(player, 0);
+}
+
+//NOTE: Loops back to the first frame at the end, an empty file plays idle input
+static void playInputFrame(InputPlayer* player, InputContext* input) {
+    for(uint32_t attempt = 0; attempt < 2; attempt++) {
+        if(player->frame % player->keyframeInterval == 0) {
+            memset(player->previous, 0, sizeof(player->previous));
+        }
+
+        const uint8_t* at = player->file + player->cursor;
+        bool atEnd = (player->frameCount && player->frame == player->frameCount) || player->cursor >= player->dataEnd;
+
+        if(!atEnd && decodeInputFrame(&at, player->file + player->dataEnd, player->previous, input)) {
+            player->cursor = at - player->file;
+            player->frame++;
+            return;
+        }
+
+        seekInputPlayback(player, 0);
+    }
+
+    *input = {};
+}
+
+static void closeInputPlayback(InputPlayer* player) {
+    munmap((void*)player->file, player->fileSize);
+    player->file = nullptr;
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <semaphore.h>
+#include "handmade.hpp"
+
+//NOTE: Platform logging.  LOG_INFO("...", ...) formats on the calling thread
+//      straight into a slot of a bounded lock-free queue.  The log thread
+//      wakes up every LOG_FLUSH_INTERVAL_MS, or early for an error or a
+//      filling queue, and does all of the writing.  A full queue drops the
+//      message and counts it rather than wait, so a frame never stalls on a
+//      slow terminal or disk.  Each call site gets LOG_RATE_BURST messages a
+//      second and the rest are counted and reported with the next one that
+//      gets through.
+//
+//      Levels below LOG_COMPILE_LEVEL compile out, levels below the runtime
+//      minimum cost one compare.  Before startLogger and after stopLogger
+//      messages are written synchronously, so fatal errors still show up.
+
+#define LOG_QUEUE_SIZE 256 //must be a power of two
+#define LOG_MESSAGE_SIZE 1024
+#define LOG_RATE_BURST 10
+#define LOG_FLUSH_INTERVAL_MS 20
+#define LOG_WRITE_BUFFER_SIZE (16 * 1024)
+
+enum LogLevel {
+    LogLevel_Debug,
+    LogLevel_Info,
+    LogLevel_Warning,
+    LogLevel_Error,
+    LogLevel_Count
+};
+
+static const char* logLevelNames[LogLevel_Count] = {
+    "debug",
+    "info",
+    "warning",
+    "error",
+};
+
+#ifndef LOG_COMPILE_LEVEL
+#if HANDMADE_INTERNAL
+#define LOG_COMPILE_LEVEL LogLevel_Debug
+#else
+#define LOG_COMPILE_LEVEL LogLevel_Info
+#endif
+#endif
+
+struct alignas(CACHE_LINE_SIZE) LogSlot {
+    std::atomic<uint64_t> sequence;
+    LogLevel level;
+    uint64_t nanoseconds;
+    uint32_t length;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+//NOTE: One per call site, zero initialized as a function local static
+struct LogSite {
+    std::atomic<uint64_t> windowStart;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+};
+
+//NOTE: Bounded multi-producer queue (Vyukov's), slot i is free for the
+//      producer that claims position p when its sequence is p and holds a
+//      message for the log thread when it is p + 1
+struct Logger {
+    LogLevel minLevel = LogLevel_Info;
+    uint64_t startNanoseconds = 0;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> enqueuePos;
+    alignas(CACHE_LINE_SIZE) uint64_t dequeuePos = 0;
+    std::atomic<uint32_t> droppedCount;
+    std::atomic<uint32_t> producerCount;    //inside logMessage past the rate limit, see stopLogger
+    std::atomic<bool> isRunning;
+    std::atomic<bool> isStopping;
+    sem_t semaphore;
+    std::thread thread;
+
+    LogSlot slots[LOG_QUEUE_SIZE];
+};
+
+static Logger gLogger;
+
+#define LOG(level, ...) \
+    do { \
+        if((level) >= LOG_COMPILE_LEVEL && (level) >= gLogger.minLevel) { \
+            static LogSite logSite; \
+            logMessage(&gLogger, &logSite, (level), __VA_ARGS__); \
+        } \
+    } while(0)
+
+//NOTE: For lines that are already paced, like the per-frame stats
+#define LOG_UNLIMITED(level, ...) \
+    do { \
+        if((level) >= LOG_COMPILE_LEVEL && (level) >= gLogger.minLevel) { \
+            logMessage(&gLogger, nullptr, (level), __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define LOG_DEBUG(...) LOG(LogLevel_Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LogLevel_Info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG(LogLevel_Warning, __VA_ARGS__)
+#define LOG_ERROR(...) LOG(LogLevel_Error, __VA_ARGS__)
+
+inline uint64_t getLogNanoseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//NOTE: "[  12.345] warning: text\n", returns the length.  Debug and info go
+//      to stdout, warnings and errors to stderr.
+inline uint32_t formatLogLine(char* out, uint32_t size, Logger* logger, LogLevel level, uint64_t nanoseconds, const char* text, uint32_t length) {
+    real64_t seconds = (nanoseconds - logger->startNanoseconds) / 1e9;
+    int prefix = snprintf(out, size, "[%8.3f] %s: ", seconds, logLevelNames[level]);
+    if(prefix < 0 || (uint32_t)prefix + length + 1 > size) {
+        return 0;
+    }
+
+    memcpy(out + prefix, text, length);
+    out[prefix + length] = '\n';
+    return prefix + length + 1;
+}
+
+inline int getLogFd(LogLevel level) {
+    return (level >= LogLevel_Warning) ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+inline void writeLogBytes(int fd, const char* bytes, uint32_t size) {
+    while(size > 0) {
+        ssize_t result = write(fd, bytes, size);
+        if(result <= 0) {
+            if(result < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        bytes += result;
+        size -= result;
+    }
+}
+
+//NOTE: Runs on the log thread, or on whoever stops the logger
+inline void drainLogQueue(Logger* logger) {
+    static char buffers[2][LOG_WRITE_BUFFER_SIZE];
+    uint32_t used[2] = {};
+
+    for(;;) {
+        LogSlot* slot = &logger->slots[logger->dequeuePos & (LOG_QUEUE_SIZE - 1)];
+        if(slot->sequence.load(std::memory_order_acquire) != logger->dequeuePos + 1) {
+            break;
+        }
+
+        uint32_t stream = (getLogFd(slot->level) == STDERR_FILENO) ? 1 : 0;
+        if(used[stream] + LOG_MESSAGE_SIZE + 64 > LOG_WRITE_BUFFER_SIZE) {
+            writeLogBytes(getLogFd(stream ? LogLevel_Error : LogLevel_Info), buffers[stream], used[stream]);
+            used[stream] = 0;
+        }
+        used[stream] += formatLogLine(buffers[stream] + used[stream], LOG_WRITE_BUFFER_SIZE - used[stream],
+                logger, slot->level, slot->nanoseconds, slot->text, slot->length);
+
+        slot->sequence.store(logger->dequeuePos + LOG_QUEUE_SIZE, std::memory_order_release);
+        logger->dequeuePos++;
+    }
+
+    uint32_t dropped = logger->droppedCount.exchange(0, std::memory_order_relaxed);
+    if(dropped) {
+        char text[64];
+        uint32_t length = snprintf(text, sizeof(text), "%u log messages dropped, queue full", dropped);
+        used[1] += formatLogLine(buffers[1] + used[1], LOG_WRITE_BUFFER_SIZE - used[1],
+                logger, LogLevel_Warning, getLogNanoseconds(), text, length);
+    }
+
+    writeLogBytes(STDOUT_FILENO, buffers[0], used[0]);
+    writeLogBytes(STDERR_FILENO, buffers[1], used[1]);
+}
+
+inline void logThreadProc(Logger* logger) {
+    while(!logger->isStopping.load(std::memory_order_acquire)) {
+        timespec wakeTime;
+        clock_gettime(CLOCK_REALTIME, &wakeTime);
+        wakeTime.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000;
+        if(wakeTime.tv_nsec >= 1000000000) {
+            wakeTime.tv_sec++;
+            wakeTime.tv_nsec -= 1000000000;
+        }
+
+        sem_timedwait(&logger->semaphore, &wakeTime);
+        drainLogQueue(logger);
+    }
+}
+
+//NOTE: Call once, before any other thread logs
+inline bool startLogger(Logger* logger, LogLevel minLevel) {
+    logger->minLevel = minLevel;
+    logger->startNanoseconds = getLogNanoseconds();
+    logger->enqueuePos.store(0, std::memory_order_relaxed);
+    logger->dequeuePos = 0;
+    logger->droppedCount.store(0, std::memory_order_relaxed);
+    logger->producerCount.store(0, std::memory_order_relaxed);
+    logger->isStopping.store(false, std::memory_order_relaxed);
+
+    for(uint32_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        logger->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    if(sem_init(&logger->semaphore, 0, 0) != 0) {
+        return false;
+    }
+
+    logger->thread = std::thread(logThreadProc, logger);
+    logger->isRunning.store(true, std::memory_order_release);
+    return true;
+}
+
+//NOTE: Writes out everything still queued.  Anything logged from here on is
+//      written synchronously.
+inline void stopLogger(Logger* logger) {
+    if(!logger->isRunning.exchange(false, std::memory_order_seq_cst)) {
+        return;
+    }
+
+    logger->isStopping.store(true, std::memory_order_release);
+    sem_post(&logger->semaphore);
+    logger->thread.join();
+
+    //NOTE: Producers that saw isRunning before we cleared it may still be
+    //      filling a slot or about to post the semaphore.  Both sides
+    //      announce themselves before they look at the other (seq_cst), so
+    //      any producer we don't see here saw isRunning false and writes
+    //      synchronously.
+    while(logger->producerCount.load(std::memory_order_seq_cst) != 0) {
+        sched_yield();
+    }
+
+    drainLogQueue(logger);
+    sem_destroy(&logger->semaphore);
+}
+
+//NOTE: Truncates to LOG_MESSAGE_SIZE - 1, returns the length
+inline uint32_t formatLogText(char* text, const char* format, va_list args, uint32_t suppressed) {
+    int length = vsnprintf(text, LOG_MESSAGE_SIZE, format, args);
+    if(length < 0) {
+        length = 0;
+    }
+    else if(length >= LOG_MESSAGE_SIZE) {
+        length = LOG_MESSAGE_SIZE - 1;
+    }
+
+    if(suppressed) {
+        int extra = snprintf(text + length, LOG_MESSAGE_SIZE - length, " (%u similar suppressed)", suppressed);
+        length = (extra > 0 && length + extra < LOG_MESSAGE_SIZE) ? length + extra : LOG_MESSAGE_SIZE - 1;
+    }
+
+    return length;
+}
+
+static void logMessage(Logger* logger, LogSite* site, LogLevel level, const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void logMessage(Logger* logger, LogSite* site, LogLevel level, const char* format, ...) {
+    uint64_t nanoseconds = getLogNanoseconds();
+    uint32_t suppressed = 0;
+
+    if(site) {
+        //NOTE: One second windows, races between threads only make it approximate
+        uint64_t windowStart = site->windowStart.load(std::memory_order_relaxed);
+        if(nanoseconds - windowStart >= 1000000000ull &&
+                site->windowStart.compare_exchange_strong(windowStart, nanoseconds, std::memory_order_relaxed)) {
+            site->count.store(0, std::memory_order_relaxed);
+            suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+        }
+
+        if(site->count.fetch_add(1, std::memory_order_relaxed) >= LOG_RATE_BURST) {
+            site->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    logger->producerCount.fetch_add(1, std::memory_order_seq_cst);
+
+    if(!logger->isRunning.load(std::memory_order_seq_cst)) {
+        logger->producerCount.fetch_sub(1, std::memory_order_release);
+
+        char text[LOG_MESSAGE_SIZE];
+        char line[LOG_MESSAGE_SIZE + 64];
+        va_list args;
+        va_start(args, format);
+        uint32_t length = formatLogText(text, format, args, suppressed);
+        va_end(args);
+
+        writeLogBytes(getLogFd(level), line, formatLogLine(line, sizeof(line), logger, level, nanoseconds, text, length));
+        return;
+    }
+
+    uint64_t pos = logger->enqueuePos.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    for(;;) {
+        slot = &logger->slots[pos & (LOG_QUEUE_SIZE - 1)];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)pos;
+
+        if(diff == 0) {
+            if(logger->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if(diff < 0) {
+            logger->droppedCount.fetch_add(1, std::memory_order_relaxed);
+            logger->producerCount.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        else {
+            pos = logger->enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    slot->length = formatLogText(slot->text, format, args, suppressed);
+    va_end(args);
+    slot->level = level;
+    slot->nanoseconds = nanoseconds;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    //NOTE: Otherwise the log thread picks it up on its next flush, so most
+    //      messages never enter the kernel on this thread
+    if(level >= LogLevel_Error || (pos & (LOG_QUEUE_SIZE / 2 - 1)) == 0) {
+        sem_post(&logger->semaphore);
+    }
+
+    logger->producerCount.fetch_sub(1, std::memory_order_release);
+}
@@ -3,63 +3,119 @@
 #include <stdio.h>
 #include <sys/mman.h>
 #include <stdint.h>
+#include <math.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include "handmade.hpp"
 #include "sdl_main.hpp"
+#include "work_queue.hpp"
+#include "handmade_profiler.hpp"
+#include "platform_log.hpp"
 
 
 
 static Texture gTexture;
 static OffScreenBuffer gOsb;
-
+static PresentPipeline gPipeline;
+static GameCodeWatcher gGameCodeWatcher;
+static PlatformFrameStats gFrameStats;
+static ResizeState gResize;
+static ProfileCaptureWriter gProfileWriter;
+
+//NOTE: Stopping the logger first gets everything already logged out ahead of
+//      this.  Main thread only.  _exit because exit() runs the destructors of
+//      gPipeline, gGameCodeWatcher and gProfileWriter, and destroying a
+//      std::thread that is still joinable is std::terminate.
 static void printGeneralErrorAndExit(const char* message) {
+    stopLogger(&gLogger);
     fprintf(stderr, "Fatal Error: %s\n", message);
-    exit(1);
+    fflush(stdout);
+    _exit(1);
 
 }
 
-static time_t getCreateTimeOfFile(const char* fileName) {
+static real32_t secondsForCountRange(uint64_t start, uint64_t end) {
+    uint64_t countFreq = SDL_GetPerformanceFrequency();
+    return (real32_t)(end - start) / countFreq;
+}
 
-   //get date created
-   struct stat fileStats;
-   if(stat(fileName, &fileStats) == 0) {
-       return fileStats.st_mtim.tv_sec;
-   }
-   else {
-       printGeneralErrorAndExit("Could not get modify date of game lib");
-       //TODO: Logging
-   }
+//NOTE: dlopen caches by path, and the build may replace the file while we
+//      read it, so every load works from a private copy.  The copy is unlinked
+//      as soon as it is open, the mapping keeps it alive.
+static bool copyToTempFile(const char* sourcePath, char* tempPath) {
+    int source = open(sourcePath, O_RDONLY | O_CLOEXEC);
+    if(source < 0) {
+        return false;
+    }
+
+    int dest = mkstemp(tempPath);
+    if(dest < 0) {
+        close(source);
+        return false;
+    }
+
+    struct stat fileStats;
+    bool copied = fstat(source, &fileStats) == 0;
+    off_t offset = 0;
+
+    while(copied && offset < fileStats.st_size) {
+        ssize_t bytes = sendfile(dest, source, &offset, fileStats.st_size - offset);
+        copied = bytes > 0;
+    }
+
+    close(source);
+    close(dest);
+
+    if(!copied) {
+        unlink(tempPath);
+    }
 
-   return 0;
+    return copied;
 }
 
+//NOTE: Returns an empty GameCode on failure.  Symbols are bound now rather
+//      than lazily so a reload never stalls the first frame that calls in.
 static GameCode loadGameCode() {
    GameCode ret;
-    
-   void* gameLib = dlopen(GAME_LIB_PATH, RTLD_LAZY);
+   uint64_t startCount = SDL_GetPerformanceCounter();
+   char tempPath[] = "/tmp/handmade_game_XXXXXX";
+
+   if(!copyToTempFile(GAME_LIB_PATH, tempPath)) {
+       LOG_ERROR("Could not copy %s", GAME_LIB_PATH);
+       return ret;
+   }
+
+   void* gameLib = dlopen(tempPath, RTLD_NOW | RTLD_LOCAL);
+   unlink(tempPath);
 
    if(!gameLib) {
-       //TODO: Logging
-       printGeneralErrorAndExit(dlerror());
+       LOG_ERROR("%s", dlerror());
+       return ret;
    }
-   
-   assert(gameLib);
 
    void* gameUpdateAndRenderPtr = dlsym(gameLib, "gameUpdateAndRender");
 
    if(!gameUpdateAndRenderPtr) {
-       //TODO: Logging
-       printGeneralErrorAndExit(dlerror());
+       LOG_ERROR("%s", dlerror());
+       dlclose(gameLib);
+       return ret;
    }
 
    ret.libraryHandle = gameLib;
    ret.guarf = (GameUpdateAndRenderFunc*) gameUpdateAndRenderPtr;
-
-   ret.dateLastModified = getCreateTimeOfFile(GAME_LIB_PATH);
+   ret.loadSeconds = secondsForCountRange(startCount, SDL_GetPerformanceCounter());
 
    return ret;
 }
@@ -69,313 +125,1897 @@ static void closeGameCode(GameCode* gameCode) {
         *gameCode = {};
     }
     else {
-        //TODO: Logging
+        LOG_WARNING("Could not close game code: %s", dlerror());
     }
 }
 
-static void reloadGameCode(GameCode* gameCode) {
-    closeGameCode(gameCode);
-    *gameCode = loadGameCode();
+static void closeRetiredLibrary(GameCodeWatcher* watcher) {
+    void* library = watcher->retiredLibrary.exchange(nullptr, std::memory_order_acquire);
+    if(library) {
+        dlclose(library);
+    }
 }
 
-//TODO: This function can both init and resize a texture.  Rename
-//to something better.  Or, refactor
-static void resizeTexture(Texture* texture, OffScreenBuffer* osb, int newWidth, int newHeight,
-        SDL_Renderer* renderer) {
-    int sizeOfBuffer = newWidth * newHeight * sizeof(Pixel);
+static void gameCodeWatcherProc(GameCodeWatcher* watcher, const char* libraryName) {
+    alignas(struct inotify_event) char events[4096];
+    pollfd fds[2] = {{watcher->inotifyFd, POLLIN, 0}, {watcher->wakeFd, POLLIN, 0}};
 
-    if (texture->pixels) {
-        munmap(texture->pixels, texture->sizeInBytes);
+    while(watcher->running.load(std::memory_order_relaxed)) {
+        if(poll(fds, ARRAY_SIZE(fds), -1) < 0) {
+            continue;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            uint64_t wakeCount;
+            if(read(watcher->wakeFd, &wakeCount, sizeof(wakeCount)) < 0) {
+                LOG_WARNING("Game code watcher wake read failed: %s", strerror(errno));
+            }
+            closeRetiredLibrary(watcher);
+        }
+
+        if(!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        bool libraryChanged = false;
+        ssize_t length = read(watcher->inotifyFd, events, sizeof(events));
+
+        for(ssize_t offset = 0; offset < length; ) {
+            inotify_event* event = (inotify_event*)(events + offset);
+            if(event->len && strcmp(event->name, libraryName) == 0) {
+                libraryChanged = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+
+        if(libraryChanged) {
+            GameCode loaded = loadGameCode();
+
+            if(loaded.guarf) {
+                GameCode* pending = new GameCode(loaded);
+                GameCode* stale = watcher->pendingCode.exchange(pending, std::memory_order_acq_rel);
+
+                //NOTE: A second build landed before the main loop took the first one
+                if(stale) {
+                    dlclose(stale->libraryHandle);
+                    delete stale;
+                }
+            }
+        }
+    }
+}
+
+//NOTE: Watches the directory rather than the file, the build replaces the
+//      file with a mv, which a watch on the old inode would never see.
+static void startGameCodeWatcher(GameCodeWatcher* watcher) {
+    static char directory[PATH_MAX];
+    const char* libraryName = strrchr(GAME_LIB_PATH, '/');
+
+    if(libraryName) {
+        snprintf(directory, sizeof(directory), "%.*s", (int)(libraryName - GAME_LIB_PATH), GAME_LIB_PATH);
+        libraryName++;
+    }
+    else {
+        snprintf(directory, sizeof(directory), ".");
+        libraryName = GAME_LIB_PATH;
+    }
+
+    watcher->inotifyFd = inotify_init1(IN_CLOEXEC);
+    watcher->wakeFd = eventfd(0, EFD_CLOEXEC);
+
+    if(watcher->inotifyFd < 0 || watcher->wakeFd < 0 ||
+            inotify_add_watch(watcher->inotifyFd, directory, IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        LOG_WARNING("Could not watch %s, game code hot reload is off", directory);
+        return;
+    }
+
+    watcher->running.store(true, std::memory_order_relaxed);
+    watcher->thread = std::thread(gameCodeWatcherProc, watcher, libraryName);
+}
+
+static void stopGameCodeWatcher(GameCodeWatcher* watcher) {
+    if(watcher->running.load(std::memory_order_relaxed)) {
+        uint64_t wake = 1;
+        watcher->running.store(false, std::memory_order_relaxed);
+        if(write(watcher->wakeFd, &wake, sizeof(wake)) < 0) {
+            LOG_WARNING("Could not wake the game code watcher: %s", strerror(errno));
+        }
+        watcher->thread.join();
+    }
+
+    closeRetiredLibrary(watcher);
+
+    GameCode* pending = watcher->pendingCode.exchange(nullptr, std::memory_order_acquire);
+    if(pending) {
+        closeGameCode(pending);
+        delete pending;
+    }
+
+    if(watcher->inotifyFd >= 0) {
+        close(watcher->inotifyFd);
+    }
+    if(watcher->wakeFd >= 0) {
+        close(watcher->wakeFd);
+    }
+}
+
+//NOTE: Called between frames, after guarf has returned and the render queue
+//      has drained, so nothing can still be running in the old library.
+//      Returns true when new code was swapped in.
+static bool swapInGameCode(GameCodeWatcher* watcher, GameCode* gameCode) {
+    GameCode* pending = watcher->pendingCode.exchange(nullptr, std::memory_order_acquire);
+    if(!pending) {
+        return false;
+    }
+
+    void* oldLibrary = gameCode->libraryHandle;
+    *gameCode = *pending;
+    delete pending;
+
+    //NOTE: If the thread hasn't closed the last one yet do it here, it's rare
+    void* unclosed = watcher->retiredLibrary.exchange(oldLibrary, std::memory_order_release);
+    if(unclosed) {
+        dlclose(unclosed);
+    }
+
+    uint64_t wake = 1;
+    if(write(watcher->wakeFd, &wake, sizeof(wake)) < 0) {
+        LOG_WARNING("Could not wake the game code watcher: %s", strerror(errno));
+    }
+
+    return true;
+}
+
+static const char* textureFormatModeNames[TextureFormat_Count] = {
+    "native",
+    "rgba",
+};
+
+//NOTE: The 32 bit formats the game has kernels for, X formats included
+static bool getPixelLayout(Uint32 format, PixelLayout* layout) {
+    switch(format) {
+        case SDL_PIXELFORMAT_RGBA8888:
+        case SDL_PIXELFORMAT_RGBX8888:
+            *layout = PixelLayout_RGBA;
+            return true;
+        case SDL_PIXELFORMAT_ARGB8888:
+        case SDL_PIXELFORMAT_RGB888:
+            *layout = PixelLayout_ARGB;
+            return true;
+        case SDL_PIXELFORMAT_ABGR8888:
+        case SDL_PIXELFORMAT_BGR888:
+            *layout = PixelLayout_ABGR;
+            return true;
+        case SDL_PIXELFORMAT_BGRA8888:
+        case SDL_PIXELFORMAT_BGRX8888:
+            *layout = PixelLayout_BGRA;
+            return true;
+        default:
+            return false;
+    }
+}
+
+//NOTE: A texture in a format the renderer does not take natively gets
+//      converted on every SDL_UpdateTexture.  So: the window's format if the
+//      renderer takes it, else the first renderer format we can draw, else
+//      RGBA8888 and let SDL convert.
+static void chooseTextureFormat(Texture* texture, SDL_Window* window, SDL_Renderer* renderer, TextureFormatMode mode) {
+    texture->format = SDL_PIXELFORMAT_RGBA8888;
+    texture->layout = PixelLayout_RGBA;
+
+    Uint32 windowFormat = SDL_GetWindowPixelFormat(window);
+    SDL_RendererInfo info;
+    if(SDL_GetRendererInfo(renderer, &info) != 0) {
+        LOG_WARNING("Could not get renderer info: %s", SDL_GetError());
+        info.num_texture_formats = 0;
+    }
+
+    if(mode == TextureFormat_Native) {
+        bool isChosen = false;
+        PixelLayout layout;
+
+        for(uint32_t i = 0; i < info.num_texture_formats && !isChosen; i++) {
+            if(info.texture_formats[i] == windowFormat && getPixelLayout(windowFormat, &layout)) {
+                texture->format = windowFormat;
+                texture->layout = layout;
+                isChosen = true;
+            }
+        }
+
+        for(uint32_t i = 0; i < info.num_texture_formats && !isChosen; i++) {
+            if(getPixelLayout(info.texture_formats[i], &layout)) {
+                texture->format = info.texture_formats[i];
+                texture->layout = layout;
+                isChosen = true;
+            }
+        }
 
+        if(!isChosen) {
+            LOG_WARNING("Renderer takes none of our pixel formats, SDL will convert every frame");
+        }
     }
 
-    if(!(texture->pixels = (Pixel*)mmap(NULL,
-                    sizeOfBuffer,
-                    PROT_READ | PROT_WRITE,
-                    MAP_ANONYMOUS | MAP_PRIVATE ,
-                    -1,
-                    0))) {
-        printGeneralErrorAndExit("Cannot allocate memeory\n");
+    LOG_INFO("Texture format %s (%s layout), window format %s", SDL_GetPixelFormatName(texture->format),
+            pixelLayoutNames[texture->layout], SDL_GetPixelFormatName(windowFormat));
+}
+
+static void printSDLErrorAndExit(void) {
+    stopLogger(&gLogger);
+    fprintf(stderr, "Fatal SDL error. Error: %s\n", SDL_GetError());
+    fflush(stdout);
+    _exit(1);
+}
+
+//NOTE: Address space only.  Pages get committed when a frame first draws
+//      into them, so reserving for the largest display costs a small window
+//      nothing.
+static Pixel* reserveFrameMemory(uint32_t sizeInBytes) {
+    void* pixels = mmap(NULL, sizeInBytes, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
 
+    if(pixels == MAP_FAILED) {
+        printGeneralErrorAndExit("Cannot allocate memory");
     }
 
-    texture->sizeInBytes = sizeOfBuffer;
+    return (Pixel*)pixels;
+}
+
+//NOTE: Width and height are the biggest over all displays separately, a
+//      window spanning or rotated between them still fits
+static void getLargestDisplaySize(uint32_t* width, uint32_t* height) {
+    int displayCount = SDL_GetNumVideoDisplays();
 
-    if (texture->sdlTexture) {
-        SDL_DestroyTexture(texture->sdlTexture);
+    for(int i = 0; i < displayCount; i++) {
+        SDL_DisplayMode displayMode;
+        if(SDL_GetDesktopDisplayMode(i, &displayMode) != 0) {
+            LOG_WARNING("Could not get the mode of display %d: %s", i, SDL_GetError());
+            continue;
+        }
 
+        if((uint32_t)displayMode.w > *width) {
+            *width = displayMode.w;
+        }
+        if((uint32_t)displayMode.h > *height) {
+            *height = displayMode.h;
+        }
+    }
+}
 
+//NOTE: Once at startup, again only if a window outgrows every display
+static void reserveBackbuffer(Texture* texture, uint32_t maxWidth, uint32_t maxHeight) {
+    if(texture->pixels) {
+        munmap(texture->pixels, texture->sizeInBytes);
     }
-    texture->sdlTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
-            SDL_TEXTUREACCESS_STREAMING, newWidth, newHeight);
 
+    texture->sizeInBytes = alignPow2(maxWidth * sizeof(Pixel), CACHE_LINE_SIZE) * maxHeight;
+    texture->pixels = reserveFrameMemory(texture->sizeInBytes);
+    texture->reservedWidth = maxWidth;
+    texture->reservedHeight = maxHeight;
+
+    LOG_INFO("Reserved %uKB of frame memory for %ux%u", texture->sizeInBytes / 1024, maxWidth, maxHeight);
+}
+
+//NOTE: The size has to fit the reservation.  The SDL texture is only
+//      recreated when the window outgrows it, and then rounded up so an edge
+//      being dragged outwards doesn't recreate it every event.  Returns
+//      whether it did.  Main thread only, between frames while the game
+//      thread is parked, like every other renderer call.
+static bool resizeTexture(Texture* texture, OffScreenBuffer* osb, uint32_t newWidth, uint32_t newHeight,
+        SDL_Renderer* renderer) {
+    assert(newWidth <= texture->reservedWidth && newHeight <= texture->reservedHeight);
+    bool isGrown = false;
+
+    if(!texture->sdlTexture || newWidth > texture->capacityWidth || newHeight > texture->capacityHeight) {
+        uint32_t capacityWidth = alignPow2(newWidth, TEXTURE_GROW_GRANULARITY);
+        uint32_t capacityHeight = alignPow2(newHeight, TEXTURE_GROW_GRANULARITY);
+        capacityWidth = (capacityWidth > texture->reservedWidth) ? texture->reservedWidth : capacityWidth;
+        capacityHeight = (capacityHeight > texture->reservedHeight) ? texture->reservedHeight : capacityHeight;
+        capacityWidth = (capacityWidth < texture->capacityWidth) ? texture->capacityWidth : capacityWidth;
+        capacityHeight = (capacityHeight < texture->capacityHeight) ? texture->capacityHeight : capacityHeight;
+
+        if(texture->sdlTexture) {
+            SDL_DestroyTexture(texture->sdlTexture);
+        }
+
+        if(!(texture->sdlTexture = SDL_CreateTexture(renderer, texture->format,
+                        SDL_TEXTUREACCESS_STREAMING, capacityWidth, capacityHeight))) {
+            printSDLErrorAndExit();
+        }
+
+        texture->capacityWidth = capacityWidth;
+        texture->capacityHeight = capacityHeight;
+        texture->isLockUnaligned = false;
+        isGrown = true;
+    }
 
     texture->width = newWidth;
     texture->height = newHeight;
+    texture->pitch = alignPow2(newWidth * sizeof(Pixel), CACHE_LINE_SIZE);
 
     //quick hack before i get rid of texture struct
     osb->pixels = texture->pixels;
     osb->height = texture->height;
     osb->width = texture->width;
+    osb->pitch = texture->pitch;
+    osb->layout = texture->layout;
+
+    texture->renderWidth = texture->width;
+    texture->renderHeight = texture->height;
+    texture->renderPitch = texture->pitch;
+
+    return isGrown;
 }
 
-static void printSDLErrorAndExit(void) {
-    fprintf(stderr, "Fatal SDL error. Error: %s\n", SDL_GetError());
-    exit(1);
+//NOTE: Never more than the texture, never less than a pixel.  The pitch
+//      shrinks with the width so a small frame is also a small upload.
+static void setRenderScale(Texture* texture, real32_t scale) {
+    uint32_t width = (uint32_t)(texture->width * scale + .5f);
+    uint32_t height = (uint32_t)(texture->height * scale + .5f);
+    texture->renderWidth = (width < 1) ? 1 : (width > texture->width) ? texture->width : width;
+    texture->renderHeight = (height < 1) ? 1 : (height > texture->height) ? texture->height : height;
+    texture->renderPitch = alignPow2(texture->renderWidth * sizeof(Pixel), CACHE_LINE_SIZE);
+}
+
+inline SDL_Rect getRenderRect(uint32_t width, uint32_t height) {
+    SDL_Rect rect = {0, 0, (int)width, (int)height};
+    return rect;
 }
 
 /*
  *---------------------------------------------------------------
  *              |                                |               |                
  *              |                                |               |
- *              |                                |               |                
- *              |                                |               |                
  * Region 2     |                                | Region 1      |
  *              |                                |               |
- *              |                                |               |
- *              |                                |               |
  *---------------------------------------------------------------
- *           end                               start       numSamples
+ *           wraps                         cursor & MASK     RING_BUFFER_SIZE
  */
 
-static void updateSDLSoundBuffer(SDLSoundRingBuffer* dest, const GameSoundOutput* src, uint32_t start, uint32_t end) {
+//NOTE: Copies numSamples starting at cursor out of/into the ring, splitting
+//      the copy where it wraps
+static void copyFromRing(Sample* dest, const Sample* ring, uint32_t cursor, uint32_t numSamples) {
+    uint32_t start = cursor & SOUND_RING_BUFFER_MASK;
+    uint32_t region1Len = (numSamples < SOUND_RING_BUFFER_SIZE - start) ? numSamples : SOUND_RING_BUFFER_SIZE - start;
+
+    memcpy(dest, ring + start, region1Len * sizeof(Sample));
+    memcpy(dest + region1Len, ring, (numSamples - region1Len) * sizeof(Sample));
+}
+
+static void copyToRing(Sample* ring, const Sample* src, uint32_t cursor, uint32_t numSamples) {
+    uint32_t start = cursor & SOUND_RING_BUFFER_MASK;
+    uint32_t region1Len = (numSamples < SOUND_RING_BUFFER_SIZE - start) ? numSamples : SOUND_RING_BUFFER_SIZE - start;
+
+    memcpy(ring + start, src, region1Len * sizeof(Sample));
+    memcpy(ring, src + region1Len, (numSamples - region1Len) * sizeof(Sample));
+}
+
+//NOTE: Samples between the estimated play cursor and the write cursor.  The
+//      callback hands the device a whole buffer at once, so readCursor jumps
+//      ahead of what is audible; walk it back by the part of that buffer the
+//      device hasn't played yet.
+static real32_t getQueuedLatency(SDLSoundRingBuffer* srb, uint32_t deviceSamples) {
+    uint32_t readCursor = srb->readCursor.load(std::memory_order_acquire);
+    uint32_t writeCursor = srb->writeCursor.load(std::memory_order_relaxed);
+    uint64_t lastCallbackCount = srb->lastCallbackCount.load(std::memory_order_relaxed);
+
+    real32_t inFlight = 0;
+    if(lastCallbackCount != 0) {
+        real32_t played = secondsForCountRange(lastCallbackCount, SDL_GetPerformanceCounter()) * SOUND_FREQ;
+        inFlight = (played < deviceSamples) ? deviceSamples - played : 0;
+    }
+
+    return (writeCursor - readCursor) + inFlight;
+}
+
+//NOTE: How many samples the game should produce this frame.  A frame's worth
+//      of the frame clock plus a fraction of the latency error, so a slightly
+//      fast or slow audio clock is steered out smoothly instead of showing up
+//      as a burst every time a callback lands.  The average correction is the
+//      drift between the two clocks.
+static uint32_t getSamplesToWrite(SDLSoundRingBuffer* srb, SDLAudioLatency* latency, real32_t frameSeconds) {
+    real32_t frameSamples = frameSeconds * SOUND_FREQ;
+    real32_t queued = getQueuedLatency(srb, latency->deviceSamples);
+    real32_t error = latency->targetSamples - (queued + frameSamples);
+
+    //NOTE: Way under, e.g. at startup or after a hitch, fill straight up
+    real32_t gain = (queued < latency->targetSamples / 2) ? 1.f : AUDIO_STEER_GAIN;
+    real32_t correction = error * gain;
+    real32_t numSamples = frameSamples + correction;
+
+    if(gain != 1.f) {
+        latency->driftPpm += AUDIO_DRIFT_SMOOTHING * (correction / frameSamples * 1e6f - latency->driftPpm);
+    }
+
+    uint32_t space = SOUND_RING_BUFFER_SIZE - (srb->writeCursor.load(std::memory_order_relaxed) - srb->readCursor.load(std::memory_order_acquire));
+    uint32_t maxSamples = (space < SOUND_FREQ) ? space : SOUND_FREQ; //GameSoundOutput holds a second
+
+    numSamples = (numSamples > 0) ? numSamples : 0;
+    numSamples = (numSamples < maxSamples) ? numSamples : maxSamples;
+
+    uint32_t samplesToWrite = (uint32_t)lrintf(numSamples);
+    latency->latencySamples = queued + samplesToWrite;
+
+    return samplesToWrite;
+}
+
+//NOTE: Once per frame.  At the end of every window grow the target if any
+//      callback underran, otherwise once things have settled shrink it by half
+//      the spare headroom the callbacks saw.
+static void updateAudioLatency(SDLSoundRingBuffer* srb, SDLAudioLatency* latency) {
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if(latency->windowStartCount == 0) {
+        //NOTE: Callbacks that ran before the first frame was written don't count
+        latency->windowStartCount = now;
+        latency->windowStartCallbacks = srb->callbackCount.load(std::memory_order_relaxed);
+        latency->windowStartUnderruns = srb->underrunCount.load(std::memory_order_relaxed);
+        srb->minHeadroom.store(UINT32_MAX, std::memory_order_relaxed);
+        return;
+    }
+
+    real32_t windowSeconds = secondsForCountRange(latency->windowStartCount, now);
+    if(windowSeconds < AUDIO_LATENCY_WINDOW_SECONDS) {
+        return;
+    }
+
+    uint32_t callbacks = srb->callbackCount.load(std::memory_order_relaxed);
+    uint32_t underruns = srb->underrunCount.load(std::memory_order_relaxed);
+    uint32_t minHeadroom = srb->minHeadroom.exchange(UINT32_MAX, std::memory_order_relaxed);
+    uint32_t deviceSamples = srb->callbackSamples.load(std::memory_order_relaxed);
+
+    if(deviceSamples) {
+        latency->deviceSamples = deviceSamples;
+    }
+
+    if(callbacks != latency->windowStartCallbacks) {
+        latency->callbackSeconds = windowSeconds / (callbacks - latency->windowStartCallbacks);
+    }
+
+    uint32_t minLatency = (latency->deviceSamples > AUDIO_MIN_LATENCY) ? latency->deviceSamples : AUDIO_MIN_LATENCY;
+
+    if(underruns != latency->windowStartUnderruns) {
+        uint32_t step = latency->targetSamples / 4;
+        latency->targetSamples += (step > latency->deviceSamples) ? step : latency->deviceSamples;
+        latency->cleanWindows = 0;
+    }
+    else if(++latency->cleanWindows >= AUDIO_LATENCY_SETTLE_WINDOWS &&
+            minHeadroom != UINT32_MAX && minHeadroom > AUDIO_LATENCY_MARGIN) {
+        //NOTE: Headroom can be a lot more than the target, clamp before
+        //      subtracting so the unsigned target can't wrap
+        uint32_t decrement = (minHeadroom - AUDIO_LATENCY_MARGIN) / 2;
+        uint32_t maxDecrement = (latency->targetSamples > minLatency) ? latency->targetSamples - minLatency : 0;
+        latency->targetSamples -= (decrement > maxDecrement) ? maxDecrement : decrement;
+    }
+
+    latency->targetSamples = (latency->targetSamples < minLatency) ? minLatency : latency->targetSamples;
+    latency->targetSamples = (latency->targetSamples > AUDIO_MAX_LATENCY) ? AUDIO_MAX_LATENCY : latency->targetSamples;
+
+    latency->windowStartCount = now;
+    latency->windowStartCallbacks = callbacks;
+    latency->windowStartUnderruns = underruns;
+}
+
+static void updateSDLSoundBuffer(SDLSoundRingBuffer* dest, const GameSoundOutput* src) {
+    TIMED_BLOCK("updateSDLSoundBuffer");
+    uint32_t readCursor = dest->readCursor.load(std::memory_order_acquire);
+    uint32_t writeCursor = dest->writeCursor.load(std::memory_order_relaxed);
+    uint32_t space = SOUND_RING_BUFFER_SIZE - (writeCursor - readCursor);
+    uint32_t numSamples = src->numSamples;
+
+    if(numSamples > space) {
+        dest->overrunCount.fetch_add(1, std::memory_order_relaxed);
+        numSamples = space;
+    }
+
+    copyToRing(dest->samples, src->samples, writeCursor, numSamples);
+    dest->writeCursor.store(writeCursor + numSamples, std::memory_order_release);
+}
+
+static void SDLAudioCallBack(void* userData, uint8_t* stream, int len) {
+    TIMED_BLOCK("SDLAudioCallBack");
+
+    SDLSoundRingBuffer* buf = (SDLSoundRingBuffer*)userData;
+
+    assert(len % sizeof(Sample) == 0);
+
+    uint32_t samplesRequested = len / sizeof(Sample);
+    uint32_t readCursor = buf->readCursor.load(std::memory_order_relaxed);
+    uint32_t writeCursor = buf->writeCursor.load(std::memory_order_acquire);
+    uint32_t available = writeCursor - readCursor;
+    uint32_t samplesToCopy = samplesRequested;
+
+    buf->lastCallbackCount.store(SDL_GetPerformanceCounter(), std::memory_order_relaxed);
+    buf->callbackSamples.store(samplesRequested, std::memory_order_relaxed);
+    buf->callbackCount.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t headroom = (available > samplesRequested) ? available - samplesRequested : 0;
+    uint32_t minHeadroom = buf->minHeadroom.load(std::memory_order_relaxed);
+    while(headroom < minHeadroom &&
+            !buf->minHeadroom.compare_exchange_weak(minHeadroom, headroom, std::memory_order_relaxed)) {
+    }
+
+    if(available < samplesRequested) {
+        //NOTE: The main loop fell behind.  Play what we have followed by silence
+        //      and only consume what was actually there.
+        buf->underrunCount.fetch_add(1, std::memory_order_relaxed);
+        samplesToCopy = available;
+        memset(stream + samplesToCopy * sizeof(Sample), 0, (samplesRequested - samplesToCopy) * sizeof(Sample));
+    }
+
+    copyFromRing((Sample*)stream, buf->samples, readCursor, samplesToCopy);
+
+    buf->readCursor.store(readCursor + samplesToCopy, std::memory_order_release);
+
+}
+
+static void initAudio(SDLSoundRingBuffer* srb) {
+    SDL_AudioSpec desiredAudio;
+    desiredAudio.channels = NUM_CHANNELS;
+    desiredAudio.samples = AUDIO_DEVICE_SAMPLES;
+    desiredAudio.freq = SOUND_FREQ;
+    desiredAudio.format = AUDIO_S16LSB;
+    desiredAudio.callback = SDLAudioCallBack;
+    desiredAudio.userdata = srb; 
+
+
+
+    if (SDL_OpenAudio(&desiredAudio, NULL) < 0) {
+        printSDLErrorAndExit();
+    }
+}
+
+static void initInput(SDLInputContext* sdlIC) {
+    for (int i = 0; i < MAX_SDL_CONTROLLERS; i++) {
+        if (SDL_IsGameController(i)) {
+            if(!(sdlIC->controllers[i] = SDL_GameControllerOpen(i))){
+                printSDLErrorAndExit();
+            }
+        }
+    }
+}
+
+static void initSDL(SDL_Window** window, SDL_Renderer** renderer, uint32_t rendererFlags, TextureFormatMode textureFormat, OffScreenBuffer* osb, SDLInputContext* sdlIC, SDLSoundRingBuffer* srb) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
+        printSDLErrorAndExit();
+    }
+
+    if(!(*window = SDL_CreateWindow("Handmade Hero",
+                    SDL_WINDOWPOS_UNDEFINED,
+                    SDL_WINDOWPOS_UNDEFINED,
+                    SCREEN_WIDTH,
+                    SCREEN_HEIGHT,
+                    SDL_WINDOW_RESIZABLE))) {
+        printSDLErrorAndExit();
+    }
+
+    //NOTE: Textures pick this up when they are created.  Below scale 1 the
+    //      render rect is stretched over the window, linear keeps that from
+    //      looking blocky.  Filtering blends in the texel just past the rect
+    //      at the right and bottom edge, a faint seam at worst.
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
+    if(!(*renderer = SDL_CreateRenderer(*window, -1, rendererFlags))) {
+        printSDLErrorAndExit();
+    }
+
+    chooseTextureFormat(&gTexture, *window, *renderer, textureFormat);
+
+    uint32_t maxWidth = SCREEN_WIDTH;
+    uint32_t maxHeight = SCREEN_HEIGHT;
+    getLargestDisplaySize(&maxWidth, &maxHeight);
+    reserveBackbuffer(&gTexture, maxWidth, maxHeight);
+    resizeTexture(&gTexture, osb, SCREEN_WIDTH, SCREEN_HEIGHT, *renderer);
+
+    initAudio(srb);
+    initInput(sdlIC);
+
+}
+
+//NOTE: Next to the rewind code it drives, further down
+static void runGameFrame(GameFrameJob* job);
+
+//NOTE: Never touches SDL's renderer or window, anything that can fail there
+//      stays on the main thread
+static void gameThreadProc(PresentPipeline* pipeline) {
+    while(true) {
+        sem_wait(&pipeline->jobReady);
+
+        if(pipeline->isStopping) {
+            break;
+        }
+
+        runGameFrame(&pipeline->job);
+        pipeline->frames[pipeline->writeIndex].submitCount = SDL_GetPerformanceCounter();
+        sem_post(&pipeline->jobDone);
+    }
+}
+
+//NOTE: Buffers are as big as the texture's reservation, so only a window
+//      that outgrows that has to restart the pipeline
+static void startPresentPipeline(PresentPipeline* pipeline, uint32_t bufferCount, Texture* texture) {
+    assert(pipeline->bufferCount == 0);
+    assert(bufferCount == PRESENT_BUFFER_COUNT);
+
+    for(uint32_t i = 0; i < bufferCount; i++) {
+        PresentFrame* frame = &pipeline->frames[i];
+        frame->sizeInBytes = texture->sizeInBytes;
+        frame->buffer.pixels = reserveFrameMemory(frame->sizeInBytes);
+        frame->buffer.width = texture->width;
+        frame->buffer.height = texture->height;
+        frame->buffer.pitch = texture->pitch;
+        frame->buffer.layout = texture->layout;
+    }
+
+    pipeline->bufferCount = bufferCount;
+    pipeline->writeIndex = 0;
+    pipeline->hasPendingFrame = false;
+    pipeline->isStopping = false;
+    sem_init(&pipeline->jobReady, 0, 0);
+    sem_init(&pipeline->jobDone, 0, 0);
+
+    pipeline->thread = std::thread(gameThreadProc, pipeline);
+}
+
+//NOTE: Only between frames, with no job running.  A finished frame that
+//      wasn't presented yet is dropped.
+static void stopPresentPipeline(PresentPipeline* pipeline) {
+    if(pipeline->bufferCount == 0) {
+        return;
+    }
+
+    pipeline->isStopping = true;
+    sem_post(&pipeline->jobReady);
+    pipeline->thread.join();
+
+    for(uint32_t i = 0; i < pipeline->bufferCount; i++) {
+        munmap(pipeline->frames[i].buffer.pixels, pipeline->frames[i].sizeInBytes);
+        pipeline->frames[i] = {};
+    }
+
+    sem_destroy(&pipeline->jobReady);
+    sem_destroy(&pipeline->jobDone);
+    pipeline->bufferCount = 0;
+    pipeline->hasPendingFrame = false;
+}
 
-    Sample* region1 = dest->samples + start;
-    uint32_t region1Len = (start <= end) ? end - start : ARRAY_SIZE(dest->samples) - start ;
-    Sample* region2 = dest->samples;
-    uint32_t region2Len = (start <= end) ? 0 : end;
+//NOTE: Buffers are reservation sized, the frame uses the current render
+//      size inside it
+static OffScreenBuffer* acquirePresentFrame(PresentPipeline* pipeline, const Texture* texture) {
+    OffScreenBuffer* buffer = &pipeline->frames[pipeline->writeIndex].buffer;
+    buffer->width = texture->renderWidth;
+    buffer->height = texture->renderHeight;
+    buffer->pitch = texture->renderPitch;
+    return buffer;
+}
+
+static void startGameFrame(PresentPipeline* pipeline, const GameFrameJob* job) {
+    pipeline->job = *job;
+    sem_post(&pipeline->jobReady);
+}
+
+//NOTE: Waits for the game thread, the buffer it drew is presented next frame
+static void finishGameFrame(PresentPipeline* pipeline, GameFrameJob* job) {
+    TIMED_BLOCK("waitForGameThread");
+    sem_wait(&pipeline->jobDone);
+    *job = pipeline->job;
+    pipeline->writeIndex = (pipeline->writeIndex + 1) % pipeline->bufferCount;
+    pipeline->hasPendingFrame = true;
+}
+
+//NOTE: Main thread, while the game thread draws into the other buffer.
+//      Returns how many bytes went to SDL, 0 if there was nothing to present
+//      yet.  Latency is from the game finishing the frame to
+//      SDL_RenderPresent returning.
+static uint32_t presentPendingFrame(PresentPipeline* pipeline, SDL_Window* window, Texture* texture,
+        uint32_t* uploadMicroseconds, uint32_t* latencyMicroseconds) {
+    *uploadMicroseconds = 0;
+    *latencyMicroseconds = 0;
+
+    if(!pipeline->hasPendingFrame) {
+        return 0;
+    }
+
+    TIMED_BLOCK("presentFrame");
+    PresentFrame* frame = &pipeline->frames[(pipeline->writeIndex + 1) % pipeline->bufferCount];
+    SDL_Renderer* renderer = SDL_GetRenderer(window);
+    SDL_RenderClear(renderer);
+
+    {
+        TIMED_BLOCK("textureUpload");
+        uint64_t uploadStart = SDL_GetPerformanceCounter();
+        SDL_Rect rect = getRenderRect(frame->buffer.width, frame->buffer.height);
+        if(SDL_UpdateTexture(texture->sdlTexture, &rect, frame->buffer.pixels,
+                    frame->buffer.pitch) != 0) {
+            printSDLErrorAndExit();
+        }
+        *uploadMicroseconds = (uint32_t)(secondsForCountRange(uploadStart, SDL_GetPerformanceCounter()) * 1e6f);
+    }
+
+    SDL_Rect source = getRenderRect(frame->buffer.width, frame->buffer.height);
+    if(SDL_RenderCopy(renderer, texture->sdlTexture, &source, NULL) != 0) {
+        printSDLErrorAndExit();
+    }
+
+    {
+        TIMED_BLOCK("renderPresent");
+        SDL_RenderPresent(renderer);
+    }
+
+    *latencyMicroseconds = (uint32_t)(secondsForCountRange(frame->submitCount, SDL_GetPerformanceCounter()) * 1e6f);
+    pipeline->hasPendingFrame = false;
+    return frame->buffer.pitch * frame->buffer.height;
+}
+
+#if HANDMADE_INTERNAL
+//NOTE: Runs on its own thread, see ProfileCaptureWriter
+static void writeProfileCapture(Profiler* profiler, ProfileCaptureWriter* writer) {
+    printProfileTable(profiler, stdout);
+    fflush(stdout);
+
+    if(writeChromeTrace(profiler, PROFILE_TRACE_PATH)) {
+        LOG_INFO("Wrote %u frames to %s", profiler->captureFrameCount, PROFILE_TRACE_PATH);
+    }
+    else {
+        LOG_ERROR("Could not write %s", PROFILE_TRACE_PATH);
+    }
+
+    writer->isBusy.store(false, std::memory_order_release);
+}
+#endif
+
+static void cleanUp(PlatformState* state, GameCode* gameCode, GameMemory* gameMemory) {
+    stopGameCodeWatcher(&gGameCodeWatcher);
+    stopPresentPipeline(&gPipeline);
+    if(gProfileWriter.thread.joinable()) {
+        gProfileWriter.thread.join();
+    }
+    if(state->isRecording) {
+        //NOTE: Quitting mid recording still leaves a file with an index
+        stopInputRecording(&state->inputRecorder);
+    }
+    releaseInputRecorder(&state->inputRecorder);
+    if(gameMemory->renderQueue) {
+        destroyWorkQueue(gameMemory->renderQueue);
+    }
+    closeGameCode(gameCode);
+    munmap(state->memoryBlock, state->gameMemorySize);
+    if(state->memoryFd >= 0) {
+        close(state->memoryFd);
+    }
+    SDL_CloseAudio();
+    SDL_Quit();
+    stopLogger(&gLogger);
+}
+
+//NOTE: Points osb at the memory the game draws into this frame.  In lock mode
+//      that is the streaming texture itself, so presenting copies nothing.
+//      Locked memory is write only and starts out undefined, so the game has
+//      to draw every pixel, and SDL picks the pitch.  If the lock fails, or the
+//      rows don't start on cache lines the way Texture::pitch promises the
+//      render tiles, this frame falls back to copy mode.
+static void beginFrame(Texture* texture, OffScreenBuffer* osb, PresentMode mode) {
+    osb->pixels = texture->pixels;
+    osb->width = texture->renderWidth;
+    osb->height = texture->renderHeight;
+    osb->pitch = texture->renderPitch;
+
+    if(mode != PresentMode_Lock || texture->isLockUnaligned) {
+        return;
+    }
+
+    void* pixels;
+    int pitch;
+
+    SDL_Rect rect = getRenderRect(texture->renderWidth, texture->renderHeight);
+    if(SDL_LockTexture(texture->sdlTexture, &rect, &pixels, &pitch) != 0) {
+        LOG_WARNING("Could not lock the texture, copying instead: %s", SDL_GetError());
+        return;
+    }
+
+    if(pitch % sizeof(Pixel) != 0 || (uint32_t)pitch < texture->renderWidth * sizeof(Pixel)) {
+        LOG_WARNING("Locked texture pitch %d does not fit a %u pixel row, copying instead", pitch, texture->renderWidth);
+        SDL_UnlockTexture(texture->sdlTexture);
+        return;
+    }
+
+    //NOTE: The renderer hands out the same kind of memory every time, so
+    //      this sticks until the texture is recreated.  Unlocking uploads, a
+    //      lock we don't draw into would cost a second upload every frame.
+    if(pitch % CACHE_LINE_SIZE != 0 || (uintptr_t)pixels % CACHE_LINE_SIZE != 0) {
+        LOG_WARNING("Locked texture pitch %d at %p is not cache line aligned, copying from now on", pitch, pixels);
+        SDL_UnlockTexture(texture->sdlTexture);
+        texture->isLockUnaligned = true;
+        return;
+    }
+
+    texture->isLocked = true;
+    osb->pixels = (Pixel*)pixels;
+    osb->pitch = pitch;
+}
+
+//NOTE: Returns how many bytes we copied to get the frame to SDL.  Upload is
+//      the unlock or SDL_UpdateTexture on its own.
+static uint32_t updateWindow(SDL_Window* window, Texture* texture, uint32_t* uploadMicroseconds) {
+    TIMED_BLOCK("updateWindow");
+    SDL_Renderer* renderer = SDL_GetRenderer(window);
+    uint32_t bytesCopied = 0;
+
+    SDL_RenderClear(renderer);
+    uint64_t uploadStart = SDL_GetPerformanceCounter();
+
+    if(texture->isLocked) {
+        TIMED_BLOCK("textureUpload");
+        SDL_UnlockTexture(texture->sdlTexture);
+        texture->isLocked = false;
+    }
+    else {
+        TIMED_BLOCK("textureUpload");
+        SDL_Rect rect = getRenderRect(texture->renderWidth, texture->renderHeight);
+        if(SDL_UpdateTexture(texture->sdlTexture, &rect, texture->pixels,
+                    texture->renderPitch) != 0) {
+            printSDLErrorAndExit();
+        }
+
+        bytesCopied = texture->renderPitch * texture->renderHeight;
+    }
+
+    *uploadMicroseconds = (uint32_t)(secondsForCountRange(uploadStart, SDL_GetPerformanceCounter()) * 1e6f);
+
+    SDL_Rect source = getRenderRect(texture->renderWidth, texture->renderHeight);
+    if(SDL_RenderCopy(renderer, texture->sdlTexture, &source, NULL) != 0) {
+        printSDLErrorAndExit();
+    }
+
+    {
+        TIMED_BLOCK("renderPresent");
+        SDL_RenderPresent(renderer);
+    }
+
+    return bytesCopied;
+}
+
+
+//NOTE: Dragging an edge sends dozens of these a second, only the last size
+//      matters and applyPendingResize picks it up once per frame
+static void processWindowEvent(SDL_WindowEvent* we){
+    switch (we->event) {
+        case SDL_WINDOWEVENT_RESIZED:
+            LOG_DEBUG("SDL_WINDOWEVENT_RESIZED (%d, %d)", we->data1, we->data2);
+            gResize.isPending = true;
+            gResize.pendingWidth = (we->data1 > 1) ? we->data1 : 1;
+            gResize.pendingHeight = (we->data2 > 1) ? we->data2 : 1;
+            gResize.isStorm = true;
+            gResize.lastEventCount = SDL_GetPerformanceCounter();
+            gResize.events++;
+            break;
+    }
+}
+
+//NOTE: Called between frames, while the game thread sleeps.  Inside the
+//      texture this touches no memory and no SDL state at all.  A frame still
+//      waiting to be presented keeps its old size and is stretched once.
+static void applyPendingResize(ResizeState* resize, SDL_Window* window, Texture* texture,
+        OffScreenBuffer* osb, PresentPipeline* pipeline) {
+    if(!resize->isPending) {
+        return;
+    }
+
+    TIMED_BLOCK("applyPendingResize");
+    resize->isPending = false;
+    uint32_t width = resize->pendingWidth;
+    uint32_t height = resize->pendingHeight;
+
+    if(width == texture->width && height == texture->height) {
+        return;
+    }
+
+    SDL_Renderer* renderer = SDL_GetRenderer(window);
+    bool isGrown;
+
+    if(width > texture->reservedWidth || height > texture->reservedHeight) {
+        //NOTE: Bigger than any display said it was.  Rare, so the slow way.
+        LOG_WARNING("Window %ux%u outgrew the %ux%u reservation", width, height,
+                texture->reservedWidth, texture->reservedHeight);
+
+        uint32_t bufferCount = pipeline->bufferCount;
+        stopPresentPipeline(pipeline);
+        reserveBackbuffer(texture, (width > texture->reservedWidth) ? width : texture->reservedWidth,
+                (height > texture->reservedHeight) ? height : texture->reservedHeight);
+        isGrown = resizeTexture(texture, osb, width, height, renderer);
+
+        if(bufferCount) {
+            startPresentPipeline(pipeline, bufferCount, texture);
+        }
+    }
+    else {
+        isGrown = resizeTexture(texture, osb, width, height, renderer);
+    }
+
+    resize->rebuilds++;
+    if(isGrown) {
+        resize->textureGrows++;
+        LOG_DEBUG("Texture grown to %ux%u", texture->capacityWidth, texture->capacityHeight);
+    }
+}
+
+//NOTE: Frame times from the first resize event of a storm until it has been
+//      quiet for RESIZE_STORM_QUIET_SECONDS, then one line for all of it.  Only
+//      frames that rebuilt, and the one right after, count towards the storm;
+//      the frames in between and the quiet wait at the end are reported on
+//      their own so they don't water the storm's mean down.
+static void recordResizeFrame(ResizeState* resize, real32_t frameMilliseconds, uint64_t frameEndCount) {
+    if(!resize->isStorm) {
+        return;
+    }
+
+    bool isRebuildFrame = resize->rebuilds != resize->recordedRebuilds;
+    resize->recordedRebuilds = resize->rebuilds;
+
+    if(isRebuildFrame || resize->wasRebuildFrame) {
+        resize->frames++;
+        resize->totalFrameMilliseconds += frameMilliseconds;
+        if(frameMilliseconds > resize->maxFrameMilliseconds) {
+            resize->maxFrameMilliseconds = frameMilliseconds;
+        }
+    }
+    else {
+        resize->quietFrames++;
+        resize->totalQuietMilliseconds += frameMilliseconds;
+        if(frameMilliseconds > resize->maxQuietMilliseconds) {
+            resize->maxQuietMilliseconds = frameMilliseconds;
+        }
+    }
+    resize->wasRebuildFrame = isRebuildFrame;
+
+    if(secondsForCountRange(resize->lastEventCount, frameEndCount) < RESIZE_STORM_QUIET_SECONDS) {
+        return;
+    }
+
+    LOG_INFO("Resize storm: %u events, %u rebuilds, %u texture grows over %u frames, frame max %.2fms mean %.2fms, "
+            "%u quiet frames max %.2fms mean %.2fms",
+            resize->events, resize->rebuilds, resize->textureGrows, resize->frames,
+            resize->maxFrameMilliseconds, resize->frames ? resize->totalFrameMilliseconds / resize->frames : 0.f,
+            resize->quietFrames, resize->maxQuietMilliseconds,
+            resize->quietFrames ? resize->totalQuietMilliseconds / resize->quietFrames : 0.f);
+
+    resize->isStorm = false;
+    resize->events = 0;
+    resize->rebuilds = 0;
+    resize->textureGrows = 0;
+    resize->recordedRebuilds = 0;
+    resize->wasRebuildFrame = false;
+    resize->frames = 0;
+    resize->maxFrameMilliseconds = 0;
+    resize->totalFrameMilliseconds = 0;
+    resize->quietFrames = 0;
+    resize->maxQuietMilliseconds = 0;
+    resize->totalQuietMilliseconds = 0;
+}
+
+static void processKeyPress(ButtonState* buttonThatKeyCorrespondsTo, bool isDown) {
+    buttonThatKeyCorrespondsTo->isEndedDown = isDown;
+    buttonThatKeyCorrespondsTo->halfTransitionCount += (isDown) ? 1 : 0; 
+}
+
+#if !defined(MAP_FIXED_NOREPLACE)
+    #define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#if !defined(MADV_POPULATE_WRITE)
+    #define MADV_POPULATE_WRITE 23
+#endif
+
+static const char* hugePageModeNames[HugePages_Count] = {
+    "off",
+    "transparent",
+    "explicit",
+};
+
+//NOTE: Whether shmem (and so a memfd) can get transparent huge pages at all
+static bool isShmemHugePageEnabled() {
+    char setting[128] = {};
+    FILE* file = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+
+    if(!file) {
+        return false;
+    }
+
+    size_t length = fread(setting, 1, sizeof(setting) - 1, file);
+    setting[length] = 0;
+    fclose(file);
+
+    return !strstr(setting, "[never]") && !strstr(setting, "[deny]");
+}
+
+//NOTE: An address with room for size at the given alignment.  Nothing else
+//      maps memory while we start up, and MAP_FIXED_NOREPLACE catches it if
+//      something did.
+static void* findAlignedAddress(uint64_t size, uint64_t alignment) {
+    void* reservation = mmap(nullptr, size + alignment, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+
+    if(reservation == MAP_FAILED) {
+        return nullptr;
+    }
+
+    munmap(reservation, size + alignment);
+    return (void*)(((uint64_t)reservation + alignment - 1) & ~(alignment - 1));
+}
+
+static void* mapGameMemory(PlatformState* state, void* address, bool prefault) {
+    int flags = (state->memoryFd >= 0) ? MAP_SHARED : MAP_ANONYMOUS | MAP_PRIVATE;
+
+    if(address) {
+        flags |= MAP_FIXED_NOREPLACE;
+    }
+
+    //NOTE: Transparent huge pages have to be asked for before the first
+    //      fault, those get prefaulted after the madvise instead
+    if(prefault && state->hugePages != HugePages_Transparent) {
+        flags |= MAP_POPULATE;
+    }
+
+    void* result = mmap(address, state->gameMemorySize, PROT_READ | PROT_WRITE, flags, state->memoryFd, 0);
+
+    if(result != MAP_FAILED && address && result != address) {
+        //NOTE: Kernels before 4.17 take MAP_FIXED_NOREPLACE as a hint
+        munmap(result, state->gameMemorySize);
+        result = MAP_FAILED;
+    }
+
+    return result;
+}
+
+static int createGameMemoryFd(uint64_t size, unsigned int flags) {
+    int fd = memfd_create("handmade_game_memory", MFD_CLOEXEC | flags);
+
+    if(fd >= 0 && ftruncate(fd, size) != 0) {
+        LOG_WARNING("Could not size game memory fd: %s", strerror(errno));
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+static void resetGameMemoryBacking(PlatformState* state) {
+    if(state->memoryFd >= 0) {
+        close(state->memoryFd);
+    }
+
+    state->memoryFd = -1;
+    state->hugePages = HugePages_Off;
+    state->memoryPageSize = sysconf(_SC_PAGESIZE);
+}
+
+//NOTE: Game memory is a memfd so the kernel can tell us which pages the game
+//      has ever touched.  Snapshots only move those, which for a 128MB block
+//      that is mostly untouched is a few pages instead of the whole thing.
+//      Whatever the options ask for that the system can't do falls back to
+//      small pages or a kernel picked address, with a warning.
+static void allocateGameMemory(PlatformState* state, const PlatformOptions* options) {
+    void* address = options->fixedAddress ? (void*)GAME_MEMORY_BASE_ADDRESS : nullptr;
+    if(!address && options->hugePages != HugePages_Off) {
+        address = findAlignedAddress(state->gameMemorySize, HUGE_PAGE_SIZE);
+    }
+
+    resetGameMemoryBacking(state);
+    state->memoryBlock = MAP_FAILED;
+
+    if(options->hugePages == HugePages_Explicit) {
+        state->hugePages = HugePages_Explicit;
+        state->memoryPageSize = HUGE_PAGE_SIZE;
+
+        //NOTE: hugetlb takes the pages from the pool when mapping, so a short
+        //      pool shows up here and not as a SIGBUS later
+        if((state->memoryFd = createGameMemoryFd(state->gameMemorySize, MFD_HUGETLB)) >= 0) {
+            state->memoryBlock = mapGameMemory(state, address, options->prefault);
+        }
+
+        if(state->memoryBlock == MAP_FAILED) {
+            LOG_WARNING("Not enough explicit huge pages reserved, using small pages");
+            resetGameMemoryBacking(state);
+        }
+    }
+
+    bool isAnonymous = false;
+    if(options->hugePages == HugePages_Transparent) {
+        state->hugePages = HugePages_Transparent;
+        state->memoryPageSize = HUGE_PAGE_SIZE;
+
+        if(!isShmemHugePageEnabled()) {
+            //NOTE: Only anonymous memory can have them, snapshots then copy the whole block
+            LOG_WARNING("Shmem huge pages are disabled, game memory is anonymous");
+            isAnonymous = true;
+        }
+    }
+
+    if(state->memoryBlock == MAP_FAILED) {
+        if(!isAnonymous) {
+            //NOTE: Without a memfd this is plain anonymous memory too
+            state->memoryFd = createGameMemoryFd(state->gameMemorySize, 0);
+        }
+
+        state->memoryBlock = mapGameMemory(state, address, options->prefault);
+
+        if(state->memoryBlock == MAP_FAILED && address) {
+            LOG_WARNING("Could not map game memory at %p", address);
+            state->memoryBlock = mapGameMemory(state, nullptr, options->prefault);
+        }
+    }
+
+    if(state->memoryBlock == MAP_FAILED) {
+        printGeneralErrorAndExit("Cannot allocate game memory");
+    }
+
+    state->isFixedAddress = state->memoryBlock == (void*)GAME_MEMORY_BASE_ADDRESS;
+
+    if(state->hugePages == HugePages_Transparent) {
+        madvise(state->memoryBlock, state->gameMemorySize, MADV_HUGEPAGE);
+
+        if(options->prefault && madvise(state->memoryBlock, state->gameMemorySize, MADV_POPULATE_WRITE) != 0) {
+            //NOTE: Before 5.14, touch every page ourselves
+            for(uint64_t offset = 0; offset < state->gameMemorySize; offset += state->memoryPageSize) {
+                ((volatile uint8_t*)state->memoryBlock)[offset] = 0;
+            }
+        }
+    }
+}
+
+static void openPerfCounters(PerfCounters* counters) {
+    struct perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+    counters->pageFaultFd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    counters->tlbMissFd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void closePerfCounters(PerfCounters* counters) {
+    if(counters->pageFaultFd >= 0) {
+        close(counters->pageFaultFd);
+    }
+    if(counters->tlbMissFd >= 0) {
+        close(counters->tlbMissFd);
+    }
+
+    counters->pageFaultFd = counters->tlbMissFd = -1;
+}
+
+static uint64_t readPerfCounter(int fd) {
+    uint64_t value = 0;
+
+    if(fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value)) {
+        value = 0;
+    }
+
+    return value;
+}
+
+//NOTE: Appends to a line being built in text
+static void formatPerfCounterDelta(char* text, size_t size, int fd, uint64_t start, const char* name) {
+    size_t used = strlen(text);
+    if(fd >= 0) {
+        snprintf(text + used, size - used, ", %llu %s", (unsigned long long)(readPerfCounter(fd) - start), name);
+    }
+    else {
+        snprintf(text + used, size - used, ", %s unavailable", name);
+    }
+}
+
+//NOTE: Whole process, from /proc/self/smaps_rollup, the game block is most of it
+static uint64_t getHugePageBytes() {
+    const char* fields[] = {"AnonHugePages:", "ShmemPmdMapped:", "Shared_Hugetlb:", "Private_Hugetlb:"};
+    uint64_t total = 0;
+    char line[256];
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+
+    if(!file) {
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), file)) {
+        for(uint32_t i = 0; i < ARRAY_SIZE(fields); i++) {
+            unsigned long long kilobytes;
+            if(!strncmp(line, fields[i], strlen(fields[i])) && sscanf(line + strlen(fields[i]), "%llu", &kilobytes) == 1) {
+                total += kilobytes * 1024;
+            }
+        }
+    }
+
+    fclose(file);
+    return total;
+}
+
+//NOTE: Finds the next populated range of fd at or after offset.  When fd
+//      doesn't support SEEK_DATA everything counts as populated.
+static bool getNextDataExtent(int fd, uint64_t size, uint64_t* offset, uint64_t* length) {
+    off_t start = (fd >= 0) ? lseek(fd, *offset, SEEK_DATA) : -1;
+
+    if(start < 0) {
+        if(fd >= 0 && errno == ENXIO) {
+            return false; //nothing but holes from here on
+        }
+        start = *offset;
+    }
+
+    if((uint64_t)start >= size) {
+        return false;
+    }
+
+    off_t end = (fd >= 0) ? lseek(fd, start, SEEK_HOLE) : -1;
+    if(end < 0 || (uint64_t)end > size) {
+        end = size;
+    }
+
+    *offset = start;
+    *length = end - start;
+    return true;
+}
+
+static DirtyPageTracker* gDirtyPageTracker;
+
+//NOTE: The last page can be short when the block isn't a multiple of DIRTY_PAGE_SIZE
+inline uint64_t getDirtyPageLength(DirtyPageTracker* tracker, uint32_t page) {
+    uint64_t offset = (uint64_t)page * tracker->pageSize;
+    return (offset + tracker->pageSize > tracker->size) ? tracker->size - offset : tracker->pageSize;
+}
+
+inline void markDirtyPage(DirtyPageList* list, uint32_t page) {
+    if(__atomic_exchange_n(&list->isDirty[page], 1, __ATOMIC_ACQ_REL) == 0) {
+        uint32_t index = __atomic_fetch_add(&list->count, 1, __ATOMIC_ACQ_REL);
+        list->pages[index] = page;
+    }
+}
+
+static void dirtyPageFaultHandler(int signal, siginfo_t* info, void* context) {
+    DirtyPageTracker* tracker = gDirtyPageTracker;
+    uint8_t* address = (uint8_t*)info->si_addr;
+
+    if(tracker && tracker->isArmed && address >= tracker->base && address < tracker->base + tracker->size) {
+        uint32_t page = (address - tracker->base) / tracker->pageSize;
+
+        markDirtyPage(&tracker->sinceSnapshot, page);
+        markDirtyPage(&tracker->sinceCapture, page);
+
+        mprotect(tracker->base + (uint64_t)page * tracker->pageSize, getDirtyPageLength(tracker, page), PROT_READ | PROT_WRITE);
+        return;
+    }
+
+    //NOTE: A real crash, put back whoever had it before and let the access fault again
+    sigaction(SIGSEGV, &tracker->previousAction, nullptr);
+}
+
+static void allocateDirtyPageList(DirtyPageList* list, uint32_t pageCount) {
+    uint64_t size = pageCount * (sizeof(uint8_t) + sizeof(uint32_t));
+    uint8_t* memory = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if(memory == MAP_FAILED) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+
+    list->pages = (uint32_t*)memory;
+    list->isDirty = memory + pageCount * sizeof(uint32_t);
+    list->count = 0;
+}
+
+//NOTE: Protects the whole block and forgets every page recorded so far
+static void armDirtyPageTracker(DirtyPageTracker* tracker) {
+    memset(tracker->sinceSnapshot.isDirty, 0, tracker->pageCount);
+    memset(tracker->sinceCapture.isDirty, 0, tracker->pageCount);
+    tracker->sinceSnapshot.count = 0;
+    tracker->sinceCapture.count = 0;
+
+    mprotect(tracker->base, tracker->size, PROT_READ);
+    tracker->isArmed = true;
+}
+
+//NOTE: For the rare whole block rewrite, which arms again afterwards
+static void disarmDirtyPageTracker(DirtyPageTracker* tracker) {
+    tracker->isArmed = false;
+    mprotect(tracker->base, tracker->size, PROT_READ | PROT_WRITE);
+}
+
+//NOTE: Writes one byte into each of a few protected scratch pages through the
+//      real handler, after it is installed.  The pages are populated first, so only the protection
+//      fault is timed.
+static real64_t measureWriteFaultSeconds(DirtyPageTracker* tracker) {
+    DirtyPageTracker probe;
+    probe.pageSize = tracker->pageSize;
+    probe.pageCount = DIRTY_FAULT_PROBE_PAGES;
+    probe.size = probe.pageSize * probe.pageCount;
+    probe.base = (uint8_t*)mmap(nullptr, probe.size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if(probe.base == MAP_FAILED) {
+        return 0;
+    }
+
+    memset(probe.base, 0, probe.size);
+    allocateDirtyPageList(&probe.sinceSnapshot, probe.pageCount);
+    allocateDirtyPageList(&probe.sinceCapture, probe.pageCount);
+    mprotect(probe.base, probe.size, PROT_READ);
+    probe.isArmed = true;
+    gDirtyPageTracker = &probe;
+
+    uint64_t startCount = SDL_GetPerformanceCounter();
+    for(uint32_t i = 0; i < probe.pageCount; i++) {
+        ((volatile uint8_t*)probe.base)[(uint64_t)i * probe.pageSize] = 1;
+    }
+    real64_t seconds = secondsForCountRange(startCount, SDL_GetPerformanceCounter());
+
+    gDirtyPageTracker = tracker;
+    munmap(probe.base, probe.size);
+    munmap(probe.sinceSnapshot.pages, probe.pageCount * (sizeof(uint8_t) + sizeof(uint32_t)));
+    munmap(probe.sinceCapture.pages, probe.pageCount * (sizeof(uint8_t) + sizeof(uint32_t)));
+
+    return seconds / probe.pageCount;
+}
+
+//NOTE: backingPageSize is what the block is mapped with, tracking pages are
+//      never smaller so protecting one never splits a huge page
+static void initDirtyPageTracker(DirtyPageTracker* tracker, void* base, uint64_t size, uint64_t backingPageSize) {
+    tracker->base = (uint8_t*)base;
+    tracker->size = size;
+    tracker->pageSize = alignPow2(DIRTY_PAGE_SIZE, backingPageSize);
+    tracker->pageCount = (size + tracker->pageSize - 1) / tracker->pageSize;
+
+    allocateDirtyPageList(&tracker->sinceSnapshot, tracker->pageCount);
+    allocateDirtyPageList(&tracker->sinceCapture, tracker->pageCount);
+
+    struct sigaction action = {};
+    action.sa_sigaction = dirtyPageFaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    gDirtyPageTracker = tracker;
+    sigaction(SIGSEGV, &action, &tracker->previousAction);
+
+    armDirtyPageTracker(tracker);
+}
+
+static int comparePageIndices(const void* a, const void* b) {
+    uint32_t pageA = *(const uint32_t*)a;
+    uint32_t pageB = *(const uint32_t*)b;
+    return (pageA > pageB) - (pageA < pageB);
+}
+
+//NOTE: Starts a new tracking period for one list.  Only its pages are
+//      protected again, everything else never stopped being protected.
+//      Sorted first so each run of adjacent pages is one mprotect.
+static void resetDirtyPages(DirtyPageTracker* tracker, DirtyPageList* list) {
+    qsort(list->pages, list->count, sizeof(uint32_t), comparePageIndices);
+
+    for(uint32_t i = 0; i < list->count; ) {
+        uint32_t first = list->pages[i];
+        uint32_t last = first;
+        list->isDirty[first] = 0;
+
+        while(++i < list->count && list->pages[i] == last + 1) {
+            last++;
+            list->isDirty[last] = 0;
+        }
+
+        uint64_t offset = (uint64_t)first * tracker->pageSize;
+        uint64_t length = (uint64_t)(last - first + 1) * tracker->pageSize;
+        length = (offset + length > tracker->size) ? tracker->size - offset : length;
+        mprotect(tracker->base + offset, length, PROT_READ);
+    }
+
+    list->count = 0;
+}
+
+//NOTE: Moves every run of adjacent dirty pages between memory and fd with one
+//      syscall, in the direction given.  Cost follows what the game wrote.
+static bool copyDirtyPages(PlatformState* state, int fd, bool toFile, uint64_t* bytesCopied) {
+    DirtyPageTracker* tracker = &state->dirtyPages;
+    DirtyPageList* list = &tracker->sinceSnapshot;
+    qsort(list->pages, list->count, sizeof(uint32_t), comparePageIndices);
+
+    *bytesCopied = 0;
+
+    for(uint32_t i = 0; i < list->count; ) {
+        uint32_t first = list->pages[i];
+        uint32_t last = first;
+
+        while(++i < list->count && list->pages[i] == last + 1) {
+            last++;
+        }
+
+        uint64_t offset = (uint64_t)first * tracker->pageSize;
+        uint64_t length = (uint64_t)(last - first + 1) * tracker->pageSize;
+        length = (offset + length > state->trackedMemorySize) ? state->trackedMemorySize - offset : length;
+        uint8_t* memory = (uint8_t*)state->memoryBlock + offset;
+
+        //NOTE: A rewind capture may have protected these again since they were
+        //      written, and read() won't fault them in for us
+        if(!toFile) {
+            mprotect(memory, length, PROT_READ | PROT_WRITE);
+        }
+
+        ssize_t copied = toFile ?
+            pwrite(fd, memory, length, offset) :
+            pread(fd, memory, length, offset);
+
+        if(copied != (ssize_t)length) {
+            return false;
+        }
+
+        *bytesCopied += length;
+    }
+
+    return true;
+}
+
+//NOTE: The dirty pages are only enough if fd is the snapshot we last synced
+//      with, nobody else wrote it since
+static bool isSnapshotBaseline(PlatformState* state, int fd) {
+    struct stat fileStats;
+
+    return state->hasSnapshotBaseline && fstat(fd, &fileStats) == 0 &&
+        fileStats.st_dev == state->snapshotStats.st_dev &&
+        fileStats.st_ino == state->snapshotStats.st_ino &&
+        fileStats.st_size == state->snapshotStats.st_size &&
+        fileStats.st_mtim.tv_sec == state->snapshotStats.st_mtim.tv_sec &&
+        fileStats.st_mtim.tv_nsec == state->snapshotStats.st_mtim.tv_nsec;
+}
+
+static void rememberSnapshotBaseline(PlatformState* state, int fd, bool succeeded) {
+    state->hasSnapshotBaseline = succeeded && fstat(fd, &state->snapshotStats) == 0;
+
+    if(state->hasSnapshotBaseline) {
+        resetDirtyPages(&state->dirtyPages, &state->dirtyPages.sinceSnapshot);
+    }
+}
+
+//NOTE: Punching out the old snapshot turns it into one big hole, so only the
+//      pages the game has touched get written.  A hole rather than truncating
+//      to zero, since ext4 flushes a file to disk on close after that.
+static bool writePopulatedExtents(PlatformState* state, int fd, uint64_t* bytesCopied) {
+    bool succeeded = ftruncate(fd, state->trackedMemorySize) == 0;
+
+    if(succeeded && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, state->trackedMemorySize) != 0) {
+        succeeded = ftruncate(fd, 0) == 0 && ftruncate(fd, state->trackedMemorySize) == 0;
+    }
+
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    *bytesCopied = 0;
+
+    while(succeeded && getNextDataExtent(state->memoryFd, state->trackedMemorySize, &offset, &length)) {
+        succeeded = pwrite(fd, (uint8_t*)state->memoryBlock + offset, length, offset) == (ssize_t)length;
+        *bytesCopied += length;
+        offset += length;
+    }
+
+    return succeeded;
+}
+
+//NOTE: Punching a hole over the whole memfd zeroes it without touching a page,
+//      then only the populated parts of the snapshot are read back in
+static bool readPopulatedExtents(PlatformState* state, int fd, uint64_t* bytesCopied) {
+    if(state->memoryFd < 0 || fallocate(state->memoryFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, state->trackedMemorySize) != 0) {
+        memset(state->memoryBlock, 0, state->trackedMemorySize);
+    }
+
+    bool succeeded = true;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    *bytesCopied = 0;
+
+    while(succeeded && getNextDataExtent(fd, state->trackedMemorySize, &offset, &length)) {
+        succeeded = pread(fd, (uint8_t*)state->memoryBlock + offset, length, offset) == (ssize_t)length;
+        *bytesCopied += length;
+        offset += length;
+    }
+
+    return succeeded;
+}
+
+//NOTE: After the first full snapshot memory and file only differ by the
+//      pages written since, in either direction, so later snapshots and
+//      restores just move those
+static bool snapshotGameMemory(PlatformState* state, const char* path, uint64_t* bytesCopied) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+
+    bool succeeded;
+    if(isSnapshotBaseline(state, fd)) {
+        succeeded = copyDirtyPages(state, fd, true, bytesCopied);
+    }
+    else {
+        succeeded = writePopulatedExtents(state, fd, bytesCopied);
+    }
+
+    rememberSnapshotBaseline(state, fd, succeeded);
+    close(fd);
+
+    return succeeded;
+}
+
+static bool restoreGameMemory(PlatformState* state, const char* path, uint64_t* bytesCopied) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+
+    bool succeeded;
+    if(isSnapshotBaseline(state, fd)) {
+        succeeded = copyDirtyPages(state, fd, false, bytesCopied);
+    }
+    else {
+        disarmDirtyPageTracker(&state->dirtyPages);
+        succeeded = readPopulatedExtents(state, fd, bytesCopied);
+        armDirtyPageTracker(&state->dirtyPages);
+    }
+
+    rememberSnapshotBaseline(state, fd, succeeded);
+    close(fd);
+
+    return succeeded;
+}
+
+#define REWIND_MAX_RUN_WORDS 0xFFFF
+
+//NOTE: Most a page can encode to, see encodeRewindDelta
+static uint64_t getRewindDeltaBound(uint64_t pageSize) {
+    return pageSize + 2 * sizeof(uint16_t) * (pageSize / sizeof(uint64_t) / REWIND_MAX_RUN_WORDS + 2);
+}
+
+static void initRewindBuffer(RewindBuffer* rewind, uint64_t gameMemorySize, uint64_t pageSize) {
+    //NOTE: The shadow is as big as game memory but only pages the game
+    //      writes ever get backed
+    rewind->ring = (uint8_t*)mmap(nullptr, REWIND_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    rewind->shadow = (uint8_t*)mmap(nullptr, gameMemorySize, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    rewind->scratch = (uint8_t*)mmap(nullptr, sizeof(RewindPageHeader) + getRewindDeltaBound(pageSize),
+            PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if(rewind->ring == MAP_FAILED || rewind->shadow == MAP_FAILED || rewind->scratch == MAP_FAILED) {
+        printGeneralErrorAndExit("Cannot allocate memory");
+    }
+}
+
+static void clearRewindHistory(RewindBuffer* rewind) {
+    rewind->readCursor = rewind->writeCursor = 0;
+    rewind->firstFrame = 0;
+    rewind->frameCount = 0;
+    rewind->historySeconds = 0;
+}
+
+//NOTE: For when game memory was rewritten behind the tracker's back, the
+//      history no longer leads anywhere and the shadow has to match again.
+//      Copies every populated extent, returns how much that was.
+static uint64_t resetRewindBuffer(RewindBuffer* rewind, PlatformState* state) {
+    clearRewindHistory(rewind);
+    madvise(rewind->shadow, state->trackedMemorySize, MADV_DONTNEED);
+
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint64_t bytesCopied = 0;
+    while(getNextDataExtent(state->memoryFd, state->trackedMemorySize, &offset, &length)) {
+        memcpy(rewind->shadow + offset, (uint8_t*)state->memoryBlock + offset, length);
+        offset += length;
+        bytesCopied += length;
+    }
+
+    resetDirtyPages(&state->dirtyPages, &state->dirtyPages.sinceCapture);
+    return bytesCopied;
+}
 
-    memcpy(region1, src->samples, region1Len * sizeof(Sample));  
-    memcpy(region2, src->samples + region1Len, region2Len * sizeof(Sample));
+//NOTE: Same split at the wrap as copyToRing/copyFromRing for sound
+static void copyToRewindRing(RewindBuffer* rewind, uint64_t cursor, const void* src, uint32_t size) {
+    uint64_t start = cursor % REWIND_BUFFER_SIZE;
+    uint32_t region1Len = (size < REWIND_BUFFER_SIZE - start) ? size : REWIND_BUFFER_SIZE - start;
 
-    dest->runningIndex += region1Len + region2Len;
+    memcpy(rewind->ring + start, src, region1Len);
+    memcpy(rewind->ring, (const uint8_t*)src + region1Len, size - region1Len);
+}
 
+static void copyFromRewindRing(void* dest, RewindBuffer* rewind, uint64_t cursor, uint32_t size) {
+    uint64_t start = cursor % REWIND_BUFFER_SIZE;
+    uint32_t region1Len = (size < REWIND_BUFFER_SIZE - start) ? size : REWIND_BUFFER_SIZE - start;
 
+    memcpy(dest, rewind->ring + start, region1Len);
+    memcpy((uint8_t*)dest + region1Len, rewind->ring, size - region1Len);
 }
 
-static void SDLAudioCallBack(void* userData, uint8_t* stream, int len) {
-
-    SDLSoundRingBuffer* buf = (SDLSoundRingBuffer*)userData;
+//NOTE: XOR of a page against its previous contents as a run of
+//      [zero words][literal words][literals...] tokens, 8 byte words with
+//      16 bit counts.  Frame to frame deltas are nearly all zero, which is
+//      where an LZ would find almost everything anyway.  Never more than the
+//      page plus a token per REWIND_MAX_RUN_WORDS and one more.
+static uint32_t encodeRewindDelta(const uint64_t* current, const uint64_t* previous, uint32_t wordCount, uint8_t* out) {
+    uint8_t* at = out;
+    uint32_t i = 0;
+
+    while(i < wordCount) {
+        uint32_t zeroStart = i;
+        while(i < wordCount && i - zeroStart < REWIND_MAX_RUN_WORDS && current[i] == previous[i]) {
+            i++;
+        }
 
+        uint32_t literalStart = i;
+        while(i < wordCount && i - literalStart < REWIND_MAX_RUN_WORDS && current[i] != previous[i]) {
+            i++;
+        }
 
-    static Sample firstSample = {};
-    firstSample = *buf->samples;
-    uint32_t samplesRequested = len / sizeof(Sample);
-    uint32_t ringBufferLen = ARRAY_SIZE(buf->samples);
+        uint16_t counts[2] = {(uint16_t)(literalStart - zeroStart), (uint16_t)(i - literalStart)};
+        memcpy(at, counts, sizeof(counts));
+        at += sizeof(counts);
 
-    assert(len % sizeof(Sample) == 0);
+        for(uint32_t j = literalStart; j < i; j++) {
+            uint64_t delta = current[j] ^ previous[j];
+            memcpy(at, &delta, sizeof(delta));
+            at += sizeof(delta);
+        }
+    }
 
-    uint32_t region1Len = samplesRequested; 
-    uint32_t region2Len = 0; 
+    return at - out;
+}
 
-    if (ringBufferLen - buf->sampleToPlay < samplesRequested) {
-        region1Len = ringBufferLen - buf->sampleToPlay;
-        region2Len = samplesRequested - region1Len;
+//NOTE: XORs the delta into both copies, which steps each of them one frame
+static void applyRewindDelta(const uint8_t* encoded, uint32_t encodedSize, uint64_t* memory, uint64_t* shadow) {
+    const uint8_t* at = encoded;
+    uint32_t word = 0;
+
+    while(at < encoded + encodedSize) {
+        uint16_t counts[2];
+        memcpy(counts, at, sizeof(counts));
+        at += sizeof(counts);
+        word += counts[0];
+
+        for(uint32_t j = 0; j < counts[1]; j++, word++) {
+            uint64_t delta;
+            memcpy(&delta, at, sizeof(delta));
+            at += sizeof(delta);
+            memory[word] ^= delta;
+            shadow[word] ^= delta;
+        }
     }
+}
 
-    assert((region1Len + region2Len) * sizeof(Sample) == len);
+static void dropOldestRewindFrame(RewindBuffer* rewind) {
+    RewindFrame* oldest = &rewind->frames[rewind->firstFrame];
 
-    memcpy(stream, buf->samples + buf->sampleToPlay, region1Len * sizeof(Sample));
-    memcpy(stream + (region1Len * sizeof(Sample)), buf->samples, region2Len * sizeof(Sample));
+    rewind->readCursor = oldest->offset + oldest->size;
+    rewind->historySeconds -= oldest->seconds;
+    rewind->firstFrame = (rewind->firstFrame + 1) % REWIND_MAX_FRAMES;
+    rewind->frameCount--;
+}
 
-#ifndef NDEBUG
-    //TODO: Take out eventually
-    for(size_t i = 0; i < len / sizeof(Sample); i++){
-        assert(((Sample*)stream)[i].rightChannel == buf->samples[(i + buf->sampleToPlay) % ringBufferLen].rightChannel);
-    }
-#endif
+//NOTE: Runs every frame after the game.  Stores what the game changed this
+//      frame and brings the shadow up to date.
+static void captureRewindFrame(RewindBuffer* rewind, PlatformState* state, const InputContext* input, real32_t seconds) {
+    TIMED_BLOCK("captureRewindFrame");
+    uint64_t startCount = SDL_GetPerformanceCounter();
+    DirtyPageTracker* tracker = &state->dirtyPages;
+    DirtyPageList* list = &tracker->sinceCapture;
 
-    buf->sampleToPlay = (buf->sampleToPlay + region1Len + region2Len) % ringBufferLen;
+    uint64_t worstCase = sizeof(RewindFrameHeader) +
+        (uint64_t)list->count * (sizeof(RewindPageHeader) + getRewindDeltaBound(tracker->pageSize));
+    bool keepFrame = worstCase <= REWIND_BUFFER_SIZE / 2;
 
-}
+    if(keepFrame) {
+        if(rewind->frameCount == REWIND_MAX_FRAMES) {
+            dropOldestRewindFrame(rewind);
+        }
+        //NOTE: By time, how many frames that is depends on the refresh rate
+        while(rewind->frameCount && rewind->historySeconds + seconds > REWIND_HISTORY_SECONDS) {
+            dropOldestRewindFrame(rewind);
+        }
+        while(rewind->frameCount && rewind->writeCursor + worstCase - rewind->readCursor > REWIND_BUFFER_SIZE) {
+            dropOldestRewindFrame(rewind);
+        }
+    }
+    else {
+        //NOTE: Too much changed at once to be worth keeping, history restarts here
+        clearRewindHistory(rewind);
+    }
 
-static void initAudio(SDLSoundRingBuffer* srb) {
-    SDL_AudioSpec desiredAudio;
-    desiredAudio.channels = NUM_CHANNELS;
-    desiredAudio.samples = 2048;
-    desiredAudio.freq = SOUND_FREQ;
-    desiredAudio.format = AUDIO_S16LSB;
-    desiredAudio.callback = SDLAudioCallBack;
-    desiredAudio.userdata = srb; 
+    uint64_t frameStart = rewind->writeCursor;
+    uint64_t cursor = frameStart + sizeof(RewindFrameHeader);
 
+    for(uint32_t i = 0; i < list->count; i++) {
+        uint32_t page = list->pages[i];
+        uint64_t offset = (uint64_t)page * tracker->pageSize;
+        uint64_t length = getDirtyPageLength(tracker, page);
+        uint8_t* memory = tracker->base + offset;
 
+        if(keepFrame) {
+            RewindPageHeader* pageHeader = (RewindPageHeader*)rewind->scratch;
+            pageHeader->page = page;
+            pageHeader->encodedSize = encodeRewindDelta((uint64_t*)memory, (uint64_t*)(rewind->shadow + offset),
+                    length / sizeof(uint64_t), rewind->scratch + sizeof(RewindPageHeader));
 
-    if (SDL_OpenAudio(&desiredAudio, NULL) < 0) {
-        printSDLErrorAndExit();
+            uint32_t recordSize = sizeof(RewindPageHeader) + pageHeader->encodedSize;
+            copyToRewindRing(rewind, cursor, rewind->scratch, recordSize);
+            cursor += recordSize;
+        }
+
+        memcpy(rewind->shadow + offset, memory, length);
     }
-}
 
-static void initInput(SDLInputContext* sdlIC) {
-    for (int i = 0; i < MAX_SDL_CONTROLLERS; i++) {
-        if (SDL_IsGameController(i)) {
-            if(!(sdlIC->controllers[i] = SDL_GameControllerOpen(i))){
-                printSDLErrorAndExit();
-            }
-        }
+    if(keepFrame) {
+        RewindFrameHeader header;
+        header.size = cursor - frameStart;
+        header.pageCount = list->count;
+        header.seconds = seconds;
+        header.input = *input;
+        copyToRewindRing(rewind, frameStart, &header, sizeof(header));
+
+        RewindFrame* frame = &rewind->frames[(rewind->firstFrame + rewind->frameCount) % REWIND_MAX_FRAMES];
+        frame->offset = frameStart;
+        frame->size = header.size;
+        frame->seconds = seconds;
+
+        rewind->frameCount++;
+        rewind->writeCursor = cursor;
+        rewind->historySeconds += seconds;
     }
+
+    real32_t faultCount = (real32_t)list->count;
+    uint64_t protectStartCount = SDL_GetPerformanceCounter();
+    resetDirtyPages(tracker, list);
+
+    uint64_t endCount = SDL_GetPerformanceCounter();
+    real32_t captureSeconds = secondsForCountRange(startCount, endCount);
+    real32_t protectSeconds = secondsForCountRange(protectStartCount, endCount);
+    rewind->captureSeconds += REWIND_CAPTURE_SMOOTHING * (captureSeconds - rewind->captureSeconds);
+    rewind->protectSeconds += REWIND_CAPTURE_SMOOTHING * (protectSeconds - rewind->protectSeconds);
+    rewind->faultCount += REWIND_CAPTURE_SMOOTHING * (faultCount - rewind->faultCount);
 }
 
-static void initSDL(SDL_Window** window, SDL_Renderer** renderer, OffScreenBuffer* osb, SDLInputContext* sdlIC, SDLSoundRingBuffer* srb) {
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
-        printSDLErrorAndExit();
+//NOTE: Undoes the newest frame and forgets it.  input gets what the game was
+//      given on the frame before, so button transitions line up on resume.
+static bool rewindOneFrame(RewindBuffer* rewind, PlatformState* state, InputContext* input) {
+    TIMED_BLOCK("rewindOneFrame");
+    if(rewind->frameCount == 0) {
+        return false;
     }
 
-    if(!(*window = SDL_CreateWindow("Handmade Hero",
-                    SDL_WINDOWPOS_UNDEFINED,
-                    SDL_WINDOWPOS_UNDEFINED,
-                    SCREEN_WIDTH,
-                    SCREEN_HEIGHT,
-                    SDL_WINDOW_RESIZABLE))) {
-        printSDLErrorAndExit();
-    }
+    DirtyPageTracker* tracker = &state->dirtyPages;
+    RewindFrame* frame = &rewind->frames[(rewind->firstFrame + rewind->frameCount - 1) % REWIND_MAX_FRAMES];
 
-    if(!(*renderer = SDL_CreateRenderer(*window, -1, 0))) {
-        printSDLErrorAndExit();
+    RewindFrameHeader header;
+    copyFromRewindRing(&header, rewind, frame->offset, sizeof(header));
+    uint64_t cursor = frame->offset + sizeof(header);
+
+    for(uint32_t i = 0; i < header.pageCount; i++) {
+        RewindPageHeader pageHeader;
+        copyFromRewindRing(&pageHeader, rewind, cursor, sizeof(pageHeader));
+        copyFromRewindRing(rewind->scratch, rewind, cursor + sizeof(pageHeader), pageHeader.encodedSize);
+        cursor += sizeof(pageHeader) + pageHeader.encodedSize;
+
+        uint64_t offset = (uint64_t)pageHeader.page * tracker->pageSize;
+        applyRewindDelta(rewind->scratch, pageHeader.encodedSize,
+                (uint64_t*)(tracker->base + offset), (uint64_t*)(rewind->shadow + offset));
     }
 
-    resizeTexture(&gTexture, osb, SCREEN_WIDTH, SCREEN_HEIGHT, *renderer);
+    rewind->writeCursor = frame->offset;
+    rewind->historySeconds -= frame->seconds;
+    rewind->frameCount--;
 
-    initAudio(srb);
-    initInput(sdlIC);
+    if(rewind->frameCount) {
+        RewindFrame* previous = &rewind->frames[(rewind->firstFrame + rewind->frameCount - 1) % REWIND_MAX_FRAMES];
+        copyFromRewindRing(&header, rewind, previous->offset, sizeof(header));
+        *input = header.input;
+    }
 
-}
+    //NOTE: Memory and shadow moved together, nothing new to capture
+    resetDirtyPages(tracker, &tracker->sinceCapture);
 
-static void cleanUp(PlatformState* state, GameCode* gameCode) {
-    closeGameCode(gameCode);
-    munmap(state->memoryBlock, state->gameMemorySize);
-    SDL_CloseAudio();
-    SDL_Quit();
+    return true;
 }
 
-static void updateWindow(SDL_Window* window, Texture texture) {
-    SDL_Renderer* renderer = SDL_GetRenderer(window);
-    SDL_RenderClear(renderer);
-
-    if(SDL_UpdateTexture(texture.sdlTexture, NULL, texture.pixels, 
-                texture.width * sizeof(Pixel)) != 0) {
-        printSDLErrorAndExit();
-    }
+//NOTE: While rewinding the game still runs to draw the frame we landed on,
+//      then whatever it changed is put back from the shadow
+static void discardFrameChanges(RewindBuffer* rewind, PlatformState* state) {
+    DirtyPageTracker* tracker = &state->dirtyPages;
+    DirtyPageList* list = &tracker->sinceCapture;
 
-    if(SDL_RenderCopy(renderer, texture.sdlTexture, NULL, NULL) != 0) {
-        printSDLErrorAndExit();
+    for(uint32_t i = 0; i < list->count; i++) {
+        uint64_t offset = (uint64_t)list->pages[i] * tracker->pageSize;
+        memcpy(tracker->base + offset, rewind->shadow + offset, getDirtyPageLength(tracker, list->pages[i]));
     }
 
-    SDL_RenderPresent(renderer);
+    resetDirtyPages(tracker, list);
 }
 
+static void runGameFrame(GameFrameJob* job) {
+    TIMED_BLOCK("runGameFrame");
+    PlatformState* state = job->state;
+    uint64_t gameStartCount = SDL_GetPerformanceCounter();
 
-static void processWindowEvent(SDL_WindowEvent* we){
-    switch (we->event) {
-        case SDL_WINDOWEVENT_RESIZED:
-            printf("SDL_WINDOWEVENT_RESIZED (%d, %d)\n", we->data1, we->data2);
-            resizeTexture(&gTexture, &gOsb, we->data1, we->data2,
-                    SDL_GetRenderer(SDL_GetWindowFromID(we->windowID)));
-            break;
+    if(state->isRewinding) {
+        //NOTE: One frame back per frame, the game only draws where we
+        //      landed and keeps none of what it did
+        rewindOneFrame(&state->rewind, state, job->oldInput);
+
+        InputContext idleInput = {};
+        job->gameCode->guarf(job->gameMemory, job->buffer, job->sound, &idleInput, job->secsSinceLastFrame);
+
+        discardFrameChanges(&state->rewind, state);
+        memset((void*)job->sound->samples, 0, job->sound->numSamples * sizeof(Sample));
+    }
+    else {
+        job->gameCode->guarf(job->gameMemory, job->buffer, job->sound, job->input, job->secsSinceLastFrame);
+        captureRewindFrame(&state->rewind, state, job->input, job->secsSinceLastFrame);
     }
-}
 
-static void processKeyPress(ButtonState* buttonThatKeyCorrespondsTo, bool isDown) {
-    buttonThatKeyCorrespondsTo->isEndedDown = isDown;
-    buttonThatKeyCorrespondsTo->halfTransitionCount += (isDown) ? 1 : 0; 
+    job->gameSeconds = secondsForCountRange(gameStartCount, SDL_GetPerformanceCounter());
 }
 
 static void beginRecording(PlatformState* state) {
-
+    uint64_t startCount = SDL_GetPerformanceCounter();
+    uint64_t bytesCopied;
 
     //write out the state
-    FILE* stateFile;
-
-    if((stateFile = fopen(GAME_STATE_PATH, "w"))) {
-        if(fwrite(state->memoryBlock, state->gameMemorySize, 1, stateFile) == 1) {
-            fclose(stateFile);
+    if(snapshotGameMemory(state, GAME_STATE_PATH, &bytesCopied)) {
+        LOG_INFO("Snapshot: %.2fms, %lluKB", secondsForCountRange(startCount, SDL_GetPerformanceCounter()) * 1000,
+                (unsigned long long)bytesCopied / 1024);
 
-            //set isRecording to true
+        if(beginInputRecording(&state->inputRecorder, GAME_INPUT_PATH)){
             state->isRecording = true;
-
-            if((state->inputRecordFile = fopen(GAME_INPUT_PATH, "w"))){
-                //NOTE: Opened game input file succesfully
-            }
-            else {
-                assert(false);
-                //TODO: Logging
-            }
         }
         else {
-            assert(false);
-            //TODO: Logging
+            LOG_ERROR("Could not start recording input to %s", GAME_INPUT_PATH);
         }
-
     }
     else {
-        assert(false);
-        //TODO: Logging
-    }
-
-
-}
-
-static void recordInput(InputContext* inputToRecord, FILE* fileToRecordTo) {
-    if(fwrite(inputToRecord, sizeof(InputContext), 1, fileToRecordTo) != 1) {
-        //TODO: Logging
+        LOG_ERROR("Could not snapshot game memory to %s", GAME_STATE_PATH);
     }
 }
 
 static void stopRecording(PlatformState* state) {
-    if(fclose(state->inputRecordFile) != 0) {
-        //TODO: Logging
+    if(!stopInputRecording(&state->inputRecorder)) {
+        LOG_ERROR("Input recording in %s is incomplete", GAME_INPUT_PATH);
     }
 
-    state->isRecording = false;
-    state->inputRecordFile = nullptr;
+    LOG_INFO("Input: %u frames, %lluB", state->inputRecorder.frameCount,
+            (unsigned long long)state->inputRecorder.fileOffset);
 
+    state->isRecording = false;
 }
 
 static void beginPlayback(PlatformState* state) {
-    FILE* stateFile;
+    uint64_t startCount = SDL_GetPerformanceCounter();
+    uint64_t bytesCopied;
 
-    if((stateFile = fopen(GAME_STATE_PATH, "r"))) {
-        if(fread(state->memoryBlock, state->gameMemorySize, 1, stateFile) == 1) { //read state
+    if(restoreGameMemory(state, GAME_STATE_PATH, &bytesCopied)) { //read state
+        uint64_t resetStartCount = SDL_GetPerformanceCounter();
+        uint64_t shadowBytes = resetRewindBuffer(&state->rewind, state);
+        uint64_t endCount = SDL_GetPerformanceCounter();
+        LOG_INFO("Restore: %.2fms, %lluKB, rewind shadow %.2fms, %lluKB",
+                secondsForCountRange(startCount, resetStartCount) * 1000, (unsigned long long)bytesCopied / 1024,
+                secondsForCountRange(resetStartCount, endCount) * 1000, (unsigned long long)shadowBytes / 1024);
 
+        if(openInputPlayback(&state->inputPlayer, GAME_INPUT_PATH)){
             state->isPlayingBack = true;
-            fclose(stateFile);
-
-            if((state->inputRecordFile = fopen(GAME_INPUT_PATH, "r"))){
-                //NOTE: Opened game input file succesfully
-            }
-            else {
-                assert(false);
-                //TODO: Logging
-            }
-
         }
         else {
-            assert(false);
-            //TODO: Logging
+            LOG_ERROR("Could not open %s for playback", GAME_INPUT_PATH);
         }
-
     }
     else {
         //We didn't record anything.  don't quit
-        
-        //TODO: Logging
+        LOG_WARNING("Nothing to play back, could not restore %s", GAME_STATE_PATH);
     }
 
 }
 
-static void playInput(InputContext* inputToRecord, FILE* fileToPlay) {
-    if(fread(inputToRecord, sizeof(InputContext), 1, fileToPlay) != 1) {
-        rewind(fileToPlay);
-    }
-}
-
 static void stopPlayback(PlatformState* state) {
-    if(fclose(state->inputRecordFile) != 0) {
-        //TODO: Logging
-    }
-
+    closeInputPlayback(&state->inputPlayer);
     state->isPlayingBack = false;
-    state->inputRecordFile = nullptr;
-
 }
 
 static ControllerInput* getContoller(InputContext* sdlIC, uint32_t index) {
@@ -422,6 +2062,29 @@ static void processEvent(SDL_Event* e, InputContext* inputState, PlatformState*
                             }
                         }
                         break;
+                    case SDLK_o: //show/hide the performance overlay
+                        if(isDown) {
+                            gFrameStats.isOverlayVisible = !gFrameStats.isOverlayVisible;
+                        }
+                        break;
+                    case SDLK_t: //capture a profile of the next few frames
+                        if(isDown) {
+                            state->isProfileCaptureRequested = true;
+                        }
+                        break;
+                    case SDLK_r: //hold to rewind
+                        state->isRewinding = isDown && !state->isRecording && !state->isPlayingBack;
+                        break;
+                    case SDLK_m: //switch between lock and copy present
+                        if(isDown) {
+                            state->presentMode = (state->presentMode == PresentMode_Lock) ? PresentMode_Copy : PresentMode_Lock;
+                        }
+                        break;
+                    case SDLK_b: //switch between serial and pipelined frames
+                        if(isDown) {
+                            state->presentBufferCount = (state->presentBufferCount == 0) ? PRESENT_BUFFER_COUNT : 0;
+                        }
+                        break;
                     case SDLK_p: //start/stop playback
                         if(isDown && !state->isRecording) {
                             if(state->isPlayingBack) {
@@ -483,7 +2146,7 @@ static uint32_t getRefreshRate(SDL_Window* window) {
     int displayIndex = SDL_GetWindowDisplayIndex(window);
     SDL_DisplayMode displayMode; //stores refresh rate
 
-    if(SDL_GetDesktopDisplayMode(displayIndex, &displayMode) != 0 
+    if(SDL_GetDesktopDisplayMode(displayIndex, &displayMode) == 0
             && displayMode.refresh_rate != 0) {
 
         return displayMode.refresh_rate;
@@ -492,13 +2155,261 @@ static uint32_t getRefreshRate(SDL_Window* window) {
     return DEFAULT_REFRESH_RATE;
 }
 
-static real32_t secondsForCountRange(uint64_t start, uint64_t end) {
-    uint64_t countFreq = SDL_GetPerformanceFrequency();
-    return (real32_t)(end - start) / countFreq;
+
+static const char* pacingModeNames[Pacing_Count] = {
+    "sleep",
+    "vsync",
+    "uncapped",
+};
+
+static uint64_t getMonotonicNanoseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t getThreadCpuNanoseconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
+static void sleepUntil(uint64_t nanoseconds) {
+    timespec ts;
+    ts.tv_sec = nanoseconds / 1000000000ull;
+    ts.tv_nsec = nanoseconds % 1000000000ull;
 
-int main(void) {
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        //NOTE: Absolute deadline, so just go back to sleep
+    }
+}
+
+static void updateSpinMargin(FramePacer* pacer) {
+    real64_t margin = pacer->wakeLatenessMean + PACING_WAKE_DEVIATIONS * pacer->wakeLatenessDeviation;
+    pacer->spinMarginSeconds = (margin < PACING_MIN_SPIN_MARGIN) ? PACING_MIN_SPIN_MARGIN :
+        (margin > PACING_MAX_SPIN_MARGIN) ? PACING_MAX_SPIN_MARGIN : margin;
+}
+
+//NOTE: Sleep mode starts with a few 1ms sleeps to see how late this machine
+//      wakes up, so the first frames already spin about the right amount
+static void initFramePacer(FramePacer* pacer, PacingMode mode, real64_t targetSeconds) {
+    *pacer = FramePacer();
+    pacer->mode = mode;
+    pacer->targetSeconds = targetSeconds;
+
+    if(mode == Pacing_Sleep) {
+        real64_t lateness[PACING_CALIBRATION_SLEEPS];
+        real64_t mean = 0;
+
+        for(uint32_t i = 0; i < PACING_CALIBRATION_SLEEPS; i++) {
+            uint64_t wakeAt = getMonotonicNanoseconds() + 1000000;
+            sleepUntil(wakeAt);
+            lateness[i] = (getMonotonicNanoseconds() - wakeAt) / 1e9;
+            mean += lateness[i] / PACING_CALIBRATION_SLEEPS;
+        }
+
+        real64_t deviation = 0;
+        for(uint32_t i = 0; i < PACING_CALIBRATION_SLEEPS; i++) {
+            deviation += fabs(lateness[i] - mean) / PACING_CALIBRATION_SLEEPS;
+        }
+
+        pacer->wakeLatenessMean = mean;
+        pacer->wakeLatenessDeviation = deviation;
+        updateSpinMargin(pacer);
+    }
+
+    pacer->lastFrameEnd = getMonotonicNanoseconds();
+    pacer->deadline = pacer->lastFrameEnd + (uint64_t)(targetSeconds * 1e9);
+}
+
+//NOTE: Ends the frame.  Deadlines follow on from each other so small
+//      overshoots don't add up, a missed one starts over from now.
+static void waitForNextFrame(FramePacer* pacer) {
+    TIMED_BLOCK("waitForNextFrame");
+    uint64_t waitStart = getMonotonicNanoseconds();
+    uint64_t cpuStart = getThreadCpuNanoseconds();
+    uint64_t targetNanoseconds = (uint64_t)(pacer->targetSeconds * 1e9);
+
+    if(pacer->mode == Pacing_Sleep) {
+        if(waitStart < pacer->deadline) {
+            uint64_t margin = (uint64_t)(pacer->spinMarginSeconds * 1e9);
+
+            if(pacer->deadline - waitStart > margin) {
+                uint64_t wakeAt = pacer->deadline - margin;
+                sleepUntil(wakeAt);
+
+                real64_t lateness = (getMonotonicNanoseconds() - wakeAt) / 1e9;
+                real64_t error = lateness - pacer->wakeLatenessMean;
+                pacer->wakeLatenessMean += PACING_WAKE_SMOOTHING * error;
+                pacer->wakeLatenessDeviation += PACING_WAKE_SMOOTHING * (fabs(error) - pacer->wakeLatenessDeviation);
+                updateSpinMargin(pacer);
+            }
+
+            while(getMonotonicNanoseconds() < pacer->deadline) {
+                _mm_pause();
+            }
+        }
+        else {
+            pacer->missedDeadlines++;
+        }
+    }
+
+    uint64_t frameEnd = getMonotonicNanoseconds();
+    real64_t frameSeconds = (frameEnd - pacer->lastFrameEnd) / 1e9;
+    real64_t waitCpuSeconds = (getThreadCpuNanoseconds() - cpuStart) / 1e9;
+
+    if(pacer->mode != Pacing_Uncapped) {
+        pacer->jitterSeconds += PACING_STATS_SMOOTHING * (fabs(frameSeconds - pacer->targetSeconds) - pacer->jitterSeconds);
+    }
+    pacer->waitCpuSeconds += PACING_STATS_SMOOTHING * (waitCpuSeconds - pacer->waitCpuSeconds);
+    pacer->waitSeconds += PACING_STATS_SMOOTHING * ((frameEnd - waitStart) / 1e9 - pacer->waitSeconds);
+
+    pacer->lastFrameEnd = frameEnd;
+    pacer->deadline += targetNanoseconds;
+    if(pacer->deadline < frameEnd) {
+        pacer->deadline = frameEnd + targetNanoseconds;
+    }
+}
+
+static void initDynamicResolution(DynamicResolution* dynres, real32_t minScale, real32_t maxScale) {
+    dynres->minScale = minScale;
+    dynres->maxScale = maxScale;
+    dynres->scale = maxScale;
+    dynres->framesAtScale = 0;
+    dynres->changes = 0;
+}
+
+//NOTE: Cost goes with the pixel count, so the scale that would just fit the
+//      budget is scale * sqrt(budget / load).  Down uses the best of the last
+//      few frames so one hitch does not drop the resolution; up uses the worst
+//      of the whole history.
+static void updateDynamicResolution(DynamicResolution* dynres, real32_t loadSeconds, real32_t targetSeconds) {
+    dynres->loadSeconds[dynres->framesAtScale % DYNRES_HISTORY] = loadSeconds;
+    dynres->framesAtScale++;
+
+    if(dynres->minScale >= dynres->maxScale || dynres->framesAtScale < DYNRES_DROP_FRAMES) {
+        return;
+    }
+
+    real32_t budget = targetSeconds * DYNRES_BUDGET;
+    real32_t recentBest = loadSeconds;
+    for(uint32_t i = 1; i < DYNRES_DROP_FRAMES; i++) {
+        real32_t load = dynres->loadSeconds[(dynres->framesAtScale - 1 - i) % DYNRES_HISTORY];
+        recentBest = (load < recentBest) ? load : recentBest;
+    }
+
+    real32_t scale = dynres->scale;
+    if(recentBest > budget) {
+        real32_t fit = dynres->scale * sqrtf(budget / recentBest);
+        scale = floorf(fit / DYNRES_STEP) * DYNRES_STEP;
+        scale = (scale < dynres->scale - DYNRES_STEP) ? scale : dynres->scale - DYNRES_STEP;
+    }
+    else if(dynres->framesAtScale >= DYNRES_HISTORY) {
+        real32_t worst = 0;
+        for(uint32_t i = 0; i < DYNRES_HISTORY; i++) {
+            worst = (dynres->loadSeconds[i] > worst) ? dynres->loadSeconds[i] : worst;
+        }
+
+        real32_t up = dynres->scale + DYNRES_STEP;
+        real32_t predicted = worst * (up * up) / (dynres->scale * dynres->scale);
+        if(predicted < targetSeconds * DYNRES_RAISE_BUDGET) {
+            scale = up;
+        }
+    }
+
+    scale = (scale < dynres->minScale) ? dynres->minScale : (scale > dynres->maxScale) ? dynres->maxScale : scale;
+    if(scale != dynres->scale) {
+        LOG_DEBUG("Render scale %.3f -> %.3f, load %.2fms budget %.2fms", dynres->scale, scale, recentBest * 1000, budget * 1000);
+        dynres->scale = scale;
+        dynres->framesAtScale = 0;
+        dynres->changes++;
+    }
+}
+
+static void parseOptions(PlatformOptions* options, int argc, char** argv) {
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-pacing") && i + 1 < argc) {
+            i++;
+            uint32_t mode = 0;
+            while(mode < Pacing_Count && strcmp(argv[i], pacingModeNames[mode])) {
+                mode++;
+            }
+
+            if(mode == Pacing_Count) {
+                printGeneralErrorAndExit("-pacing takes sleep, vsync or uncapped");
+            }
+            options->pacing = (PacingMode)mode;
+        }
+        else if(!strcmp(argv[i], "-log") && i + 1 < argc) {
+            i++;
+            uint32_t level = 0;
+            while(level < LogLevel_Count && strcmp(argv[i], logLevelNames[level])) {
+                level++;
+            }
+
+            if(level == LogLevel_Count) {
+                printGeneralErrorAndExit("-log takes debug, info, warning or error");
+            }
+            options->logLevel = (LogLevel)level;
+        }
+        else if(!strcmp(argv[i], "-hugepages") && i + 1 < argc) {
+            i++;
+            uint32_t mode = 0;
+            while(mode < HugePages_Count && strcmp(argv[i], hugePageModeNames[mode])) {
+                mode++;
+            }
+
+            if(mode == HugePages_Count) {
+                printGeneralErrorAndExit("-hugepages takes off, transparent or explicit");
+            }
+            options->hugePages = (HugePageMode)mode;
+        }
+        else if(!strcmp(argv[i], "-format") && i + 1 < argc) {
+            i++;
+            uint32_t mode = 0;
+            while(mode < TextureFormat_Count && strcmp(argv[i], textureFormatModeNames[mode])) {
+                mode++;
+            }
+
+            if(mode == TextureFormat_Count) {
+                printGeneralErrorAndExit("-format takes native or rgba");
+            }
+            options->textureFormat = (TextureFormatMode)mode;
+        }
+        else if(!strcmp(argv[i], "-scale") && i + 2 < argc) {
+            options->minScale = strtof(argv[++i], nullptr);
+            options->maxScale = strtof(argv[++i], nullptr);
+
+            if(!(options->minScale >= DYNRES_MIN_SCALE && options->minScale <= options->maxScale && options->maxScale <= 1.f)) {
+                printGeneralErrorAndExit("-scale takes min and max with .25 <= min <= max <= 1");
+            }
+        }
+        else if(!strcmp(argv[i], "-prefault")) {
+            options->prefault = true;
+        }
+        else if(!strcmp(argv[i], "-fixed")) {
+            options->fixedAddress = true;
+        }
+        else if(!strcmp(argv[i], "-nofixed")) {
+            options->fixedAddress = false;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-pacing sleep|vsync|uncapped] [-log debug|info|warning|error] [-hugepages off|transparent|explicit] [-format native|rgba] [-scale min max] [-prefault] [-fixed|-nofixed]\n", argv[0]);
+            fprintf(stderr, "  -hugepages: rewind and snapshots only cover permanent storage, in 2MB pages, so one written byte\n"
+                    "             costs a 2MB rewind delta.  With -prefault all %lluMB of it counts as data, every\n"
+                    "             full snapshot and restore copies it all.\n", (unsigned long long)PERMANENT_STORAGE_SIZE / MB(1));
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    PlatformOptions options;
+    parseOptions(&options, argc, argv);
+
+    if(!startLogger(&gLogger, options.logLevel)) {
+        LOG_WARNING("Could not start the log thread, logging synchronously");
+    }
 
     PlatformState state;
     SDL_Event e;
@@ -506,6 +2417,7 @@ int main(void) {
     SDL_Renderer *renderer;
     SDLInputContext sdlIC;
     SDLSoundRingBuffer srb;
+    SDLAudioLatency audioLatency;
     GameSoundOutput sb;
     GameMemory gameMemory;
 
@@ -518,82 +2430,148 @@ int main(void) {
 
     sb.volume = 2500;
 
-    gameMemory.permanentStorageSize = MB(64);
-    gameMemory.transientStorageSize = MB(64);
+    gameMemory.permanentStorageSize = PERMANENT_STORAGE_SIZE;
+    gameMemory.transientStorageSize = TRANSIENT_STORAGE_SIZE;
     state.gameMemorySize = gameMemory.transientStorageSize + gameMemory.permanentStorageSize;
-    state.memoryBlock = mmap(nullptr, state.gameMemorySize, PROT_READ | PROT_WRITE,
-            MAP_ANONYMOUS | MAP_PRIVATE ,
-            -1,
-            0);
+
+    //NOTE: What the memory options cost up front and on the first frame
+    PerfCounters perfCounters;
+    openPerfCounters(&perfCounters);
+    uint64_t perfStartCount = SDL_GetPerformanceCounter();
+    uint64_t startPageFaults = readPerfCounter(perfCounters.pageFaultFd);
+    uint64_t startTlbMisses = readPerfCounter(perfCounters.tlbMissFd);
+
+    allocateGameMemory(&state, &options);
+
+    //NOTE: With huge pages a tracking page is 2MB, so one write to the frame
+    //      scratch would cost a 2MB delta, and a prefaulted block is all data
+    //      to SEEK_DATA.  Transient storage can be thrown away at any time,
+    //      so only permanent storage is tracked, snapshotted and rewound then.
+    state.trackedMemorySize = (state.hugePages == HugePages_Off) ? state.gameMemorySize : gameMemory.permanentStorageSize;
+    initDirtyPageTracker(&state.dirtyPages, state.memoryBlock, state.trackedMemorySize, state.memoryPageSize);
+    initRewindBuffer(&state.rewind, state.trackedMemorySize, state.dirtyPages.pageSize);
+
+    char memoryLine[256];
+    snprintf(memoryLine, sizeof(memoryLine), "Game memory: %lluMB at %p%s (%lluMB tracked), huge pages %s%s, startup %.2fms",
+            (unsigned long long)state.gameMemorySize / MB(1), state.memoryBlock, state.isFixedAddress ? " (fixed)" : "",
+            (unsigned long long)state.trackedMemorySize / MB(1), hugePageModeNames[state.hugePages], options.prefault ? ", prefaulted" : "",
+            secondsForCountRange(perfStartCount, SDL_GetPerformanceCounter()) * 1000);
+    formatPerfCounterDelta(memoryLine, sizeof(memoryLine), perfCounters.pageFaultFd, startPageFaults, "page faults");
+    formatPerfCounterDelta(memoryLine, sizeof(memoryLine), perfCounters.tlbMissFd, startTlbMisses, "dTLB misses");
+    LOG_INFO("%s", memoryLine);
+
+    //NOTE: After the startup numbers above, the probe touches memory of its own
+    state.dirtyPages.faultSeconds = measureWriteFaultSeconds(&state.dirtyPages);
+    LOG_INFO("Write tracking: %lluKB pages, %.2fus per write fault",
+            (unsigned long long)state.dirtyPages.pageSize / 1024, state.dirtyPages.faultSeconds * 1e6);
     gameMemory.permanentStorage = state.memoryBlock;
-    gameMemory.transientStorage = (uint8_t*)(gameMemory.transientStorage) + gameMemory.transientStorageSize;
+    gameMemory.frameStats = &gFrameStats;
+    gameMemory.transientStorage = (uint8_t*)state.memoryBlock + gameMemory.permanentStorageSize;
+
+
+#if HANDMADE_INTERNAL
+    if((gProfiler = createProfiler())) {
+        gameMemory.profiler = gProfiler;
+    }
+    else {
+        LOG_WARNING("Could not create the profiler, timed blocks are off");
+    }
+#endif
 
+    if((gameMemory.renderQueue = createWorkQueue(getDefaultWorkerCount()))) {
+        gameMemory.platformAddEntry = platformAddEntry;
+        gameMemory.platformCompleteAllWork = platformCompleteAllWork;
+    }
+    else {
+        //NOTE: Game falls back to rendering on this thread
+        LOG_WARNING("Could not create the render queue, rendering on the main thread");
+    }
 
-    initSDL(&window, &renderer, &gOsb, &sdlIC, &srb);
+    initSDL(&window, &renderer, (options.pacing == Pacing_Vsync) ? SDL_RENDERER_PRESENTVSYNC : 0, options.textureFormat, &gOsb, &sdlIC, &srb);
 
     GameCode gameCode = loadGameCode();
 
-    assert(gameCode.guarf);
+    if(!gameCode.guarf) {
+        printGeneralErrorAndExit("Could not load game code");
+    }
+
+    startGameCodeWatcher(&gGameCodeWatcher);
 
     uint64_t startCount = SDL_GetPerformanceCounter();
     real32_t targetFrameSeconds = 1./getRefreshRate(window);
 
+    FramePacer pacer;
+    initFramePacer(&pacer, options.pacing, targetFrameSeconds);
+
+    DynamicResolution dynres;
+    initDynamicResolution(&dynres, options.minScale, options.maxScale);
+    LOG_INFO("Pacing: %s at %.2fHz, spin margin %.3fms", pacingModeNames[pacer.mode],
+            1. / targetFrameSeconds, pacer.spinMarginSeconds * 1000);
+
+    bool isFirstFrame = true;
+
     SDL_PauseAudio(0);
     while(state.running) {
 
-        if(getCreateTimeOfFile(GAME_LIB_PATH) != gameCode.dateLastModified) {
-            reloadGameCode(&gameCode);
+        uint64_t swapStartCount = SDL_GetPerformanceCounter();
+        bool isReloadFrame = swapInGameCode(&gGameCodeWatcher, &gameCode);
+        if(isReloadFrame) {
+            LOG_INFO("Reloaded game code: %.2fms to load in the background, %.3fms to swap",
+                    gameCode.loadSeconds * 1000, secondsForCountRange(swapStartCount, SDL_GetPerformanceCounter()) * 1000);
         }
 
         //keyboard input
-        ControllerInput* newKeyInput = getContoller(newInputState, 0);
+        {
+            TIMED_BLOCK("pollInput");
+            ControllerInput* newKeyInput = getContoller(newInputState, 0);
 
-        //TODO: figure out why this is special
-        ControllerInput* oldKeyInput = getContoller(oldInputState, 0);
-        *newKeyInput = {};
+            //TODO: figure out why this is special
+            ControllerInput* oldKeyInput = getContoller(oldInputState, 0);
+            *newKeyInput = {};
 
-        for(size_t i = 0; i < ARRAY_SIZE(oldKeyInput->buttons); i++) {
-            newKeyInput->buttons[i] = oldKeyInput->buttons[i];
-        }
-        while(SDL_PollEvent(&e)) {
-            processEvent(&e, newInputState, &state);
-        }
+            for(size_t i = 0; i < ARRAY_SIZE(oldKeyInput->buttons); i++) {
+                newKeyInput->buttons[i] = oldKeyInput->buttons[i];
+            }
+            while(SDL_PollEvent(&e)) {
+                processEvent(&e, newInputState, &state);
+            }
 
 
-        //controller input
-        for(int i = 0; i < MAX_SDL_CONTROLLERS; i++) {
-            if(sdlIC.controllers[i] != nullptr && SDL_GameControllerGetAttached(sdlIC.controllers[i])) {
+            //controller input
+            for(int i = 0; i < MAX_SDL_CONTROLLERS; i++) {
+                if(sdlIC.controllers[i] != nullptr && SDL_GameControllerGetAttached(sdlIC.controllers[i])) {
 
-                ControllerInput* newCIState = getContoller(newInputState, i+1);
-                ControllerInput* oldCIState = getContoller(oldInputState, i+1);
+                    ControllerInput* newCIState = getContoller(newInputState, i+1);
+                    ControllerInput* oldCIState = getContoller(oldInputState, i+1);
 
 
-                int16_t xVal = SDL_GameControllerGetAxis(sdlIC.controllers[i], SDL_CONTROLLER_AXIS_LEFTX);
-                int16_t yVal = SDL_GameControllerGetAxis(sdlIC.controllers[i], SDL_CONTROLLER_AXIS_LEFTY);
+                    int16_t xVal = SDL_GameControllerGetAxis(sdlIC.controllers[i], SDL_CONTROLLER_AXIS_LEFTX);
+                    int16_t yVal = SDL_GameControllerGetAxis(sdlIC.controllers[i], SDL_CONTROLLER_AXIS_LEFTY);
 
-                newCIState->avgX = normalizeStickInput(xVal, LEFT_THUMB_DEADZONE);
-                newCIState->avgY = normalizeStickInput(yVal, LEFT_THUMB_DEADZONE);
+                    newCIState->avgX = normalizeStickInput(xVal, LEFT_THUMB_DEADZONE);
+                    newCIState->avgY = normalizeStickInput(yVal, LEFT_THUMB_DEADZONE);
 
-                if(newCIState->avgX != 0 || newCIState->avgY != 0) {
-                    newCIState->isAnalog = true;
-                }
+                    if(newCIState->avgX != 0 || newCIState->avgY != 0) {
+                        newCIState->isAnalog = true;
+                    }
 
-                processControllerButtonInput(&newCIState->actionDown, &oldCIState->actionDown, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_A);
-                processControllerButtonInput(&newCIState->actionUp, &oldCIState->actionUp, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_Y);
-                processControllerButtonInput(&newCIState->actionLeft, &oldCIState->actionLeft, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_X);
-                processControllerButtonInput(&newCIState->actionRight, &oldCIState->actionRight, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_B);
+                    processControllerButtonInput(&newCIState->actionDown, &oldCIState->actionDown, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_A);
+                    processControllerButtonInput(&newCIState->actionUp, &oldCIState->actionUp, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_Y);
+                    processControllerButtonInput(&newCIState->actionLeft, &oldCIState->actionLeft, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_X);
+                    processControllerButtonInput(&newCIState->actionRight, &oldCIState->actionRight, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_B);
 
-                processControllerButtonInput(&newCIState->directionDown, &oldCIState->directionDown, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_DOWN);
-                processControllerButtonInput(&newCIState->directionUp, &oldCIState->directionUp, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_UP);
-                processControllerButtonInput(&newCIState->directionLeft, &oldCIState->directionLeft, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_LEFT);
-                processControllerButtonInput(&newCIState->directionRight, &oldCIState->directionRight, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_RIGHT);
+                    processControllerButtonInput(&newCIState->directionDown, &oldCIState->directionDown, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_DOWN);
+                    processControllerButtonInput(&newCIState->directionUp, &oldCIState->directionUp, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_UP);
+                    processControllerButtonInput(&newCIState->directionLeft, &oldCIState->directionLeft, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_LEFT);
+                    processControllerButtonInput(&newCIState->directionRight, &oldCIState->directionRight, &newCIState->isAnalog, sdlIC.controllers[i], SDL_CONTROLLER_BUTTON_DPAD_RIGHT);
 
-                oldCIState->isAnalog = newCIState->isAnalog;
+                    oldCIState->isAnalog = newCIState->isAnalog;
 
 
-            }
-            else {
-                //TODO: Logging
+                }
+                else if(sdlIC.controllers[i] != nullptr) {
+                    LOG_DEBUG("Controller %d is no longer attached", i);
+                }
             }
         }
 
@@ -602,67 +2580,175 @@ int main(void) {
         //process recording/playback
         assert(!(state.isRecording && state.isPlayingBack));
 
-        if(state.isRecording) {
-            recordInput(newInputState, state.inputRecordFile);
+        if(state.isRecording && !recordInputFrame(&state.inputRecorder, newInputState)) {
+            LOG_ERROR("Input recording stopped at %u frames, it is full or could not be written",
+                    state.inputRecorder.frameCount);
+            stopRecording(&state);
         }
 
         if(state.isPlayingBack) {
-            playInput(newInputState, state.inputRecordFile);
+            playInputFrame(&state.inputPlayer, newInputState);
+        }
+
+        //calculate how many samples to get from the game, no lock needed
+        updateAudioLatency(&srb, &audioLatency);
+        sb.numSamples = getSamplesToWrite(&srb, &audioLatency, (secsSinceLastFrame > 0) ? secsSinceLastFrame : targetFrameSeconds);
+
+
+
+        if(state.presentBufferCount != gPipeline.bufferCount) {
+            stopPresentPipeline(&gPipeline);
+            if(state.presentBufferCount) {
+                startPresentPipeline(&gPipeline, state.presentBufferCount, &gTexture);
+            }
+        }
+
+        applyPendingResize(&gResize, window, &gTexture, &gOsb, &gPipeline);
+        setRenderScale(&gTexture, dynres.scale);
+
+        OffScreenBuffer* frameBuffer = &gOsb;
+        if(gPipeline.bufferCount) {
+            frameBuffer = acquirePresentFrame(&gPipeline, &gTexture);
+        }
+        else {
+            beginFrame(&gTexture, &gOsb, state.presentMode);
         }
 
-        //calculate audio buffers' indicies and sizes
-        SDL_LockAudioDevice(1);
-        uint32_t startIndex = srb.runningIndex % ARRAY_SIZE(srb.samples);
-        uint32_t endIndex = (srb.sampleToPlay + SOUND_LATENCY) % ARRAY_SIZE(srb.samples);
-        uint32_t samplesToGetFromGame = (startIndex <= endIndex) ? endIndex - startIndex : (ARRAY_SIZE(srb.samples) - startIndex) + endIndex; 
-        sb.numSamples = samplesToGetFromGame;
-        SDL_UnlockAudioDevice(1);
+        if(isFirstFrame) {
+            perfStartCount = SDL_GetPerformanceCounter();
+            startPageFaults = readPerfCounter(perfCounters.pageFaultFd);
+            startTlbMisses = readPerfCounter(perfCounters.tlbMissFd);
+        }
 
+        GameFrameJob job;
+        job.gameCode = &gameCode;
+        job.gameMemory = &gameMemory;
+        job.state = &state;
+        job.buffer = frameBuffer;
+        job.sound = &sb;
+        job.input = newInputState;
+        job.oldInput = oldInputState;
+        job.secsSinceLastFrame = secsSinceLastFrame;
+
+        //NOTE: Present latency is from the game finishing a frame to SDL_RenderPresent returning
+        uint32_t presentLatencyMicroseconds;
+        uint32_t uploadMicroseconds;
+        if(gPipeline.bufferCount) {
+            //NOTE: The last frame goes out while the game draws this one
+            startGameFrame(&gPipeline, &job);
+            state.bytesCopied = presentPendingFrame(&gPipeline, window, &gTexture,
+                    &uploadMicroseconds, &presentLatencyMicroseconds);
+            finishGameFrame(&gPipeline, &job);
+        }
+        else {
+            runGameFrame(&job);
+        }
+        real32_t gameSeconds = job.gameSeconds;
+
+        if(isFirstFrame) {
+            char firstFrameLine[256];
+            snprintf(firstFrameLine, sizeof(firstFrameLine), "First frame: %.2fms",
+                    secondsForCountRange(perfStartCount, SDL_GetPerformanceCounter()) * 1000);
+            formatPerfCounterDelta(firstFrameLine, sizeof(firstFrameLine), perfCounters.pageFaultFd, startPageFaults, "page faults");
+            formatPerfCounterDelta(firstFrameLine, sizeof(firstFrameLine), perfCounters.tlbMissFd, startTlbMisses, "dTLB misses");
+            LOG_INFO("%s, %lluMB in huge pages", firstFrameLine, (unsigned long long)getHugePageBytes() / MB(1));
+
+            closePerfCounters(&perfCounters);
+            isFirstFrame = false;
+        }
 
+        updateSDLSoundBuffer(&srb, &sb);
 
-        gameCode.guarf(&gameMemory, &gOsb, &sb, newInputState, secsSinceLastFrame);
+        if(!gPipeline.bufferCount) {
+            uint64_t submitCount = SDL_GetPerformanceCounter();
+            state.bytesCopied = updateWindow(window, &gTexture, &uploadMicroseconds);
+            presentLatencyMicroseconds = (uint32_t)(secondsForCountRange(submitCount, SDL_GetPerformanceCounter()) * 1e6f);
+        }
 
-        updateSDLSoundBuffer(&srb, &sb, startIndex, endIndex);
-        updateWindow(window, gTexture);
+        //NOTE: Rewinding and the first frame of new code don't cost what a
+        //      normal frame at this scale does, so they don't count.
+        //      Pipelined, the upload (the previous frame's) runs alongside the
+        //      game and only the longer of the two holds the frame up.
+        if(!state.isRewinding && !isReloadFrame) {
+            real32_t uploadSeconds = uploadMicroseconds / 1e6f;
+            real32_t loadSeconds = gPipeline.bufferCount ?
+                ((gameSeconds > uploadSeconds) ? gameSeconds : uploadSeconds) :
+                gameSeconds + uploadSeconds;
+            updateDynamicResolution(&dynres, loadSeconds, targetFrameSeconds);
+        }
 
         InputContext* temp = newInputState;
         newInputState = oldInputState;
         oldInputState = temp;
 
+        waitForNextFrame(&pacer);
+
         //benchmark stuff
+        uint64_t endCount = SDL_GetPerformanceCounter();
+        real32_t secsElapsed = secondsForCountRange(startCount, endCount);
+        real32_t fpsCount =  ((1./secsElapsed));
+        real32_t mcPerFrame = (real32_t)(endCount-startCount) / (1000 * 1000 );
 
-        real32_t secsElapsed = secondsForCountRange(startCount, SDL_GetPerformanceCounter());
+        //NOTE: The game draws these over the next frame
+        recordFrameTime(&gFrameStats, secsElapsed * 1000);
+        recordResizeFrame(&gResize, secsElapsed * 1000, endCount);
+        gFrameStats.targetMilliseconds = targetFrameSeconds * 1000;
+        gFrameStats.audioLatencyMilliseconds = audioLatency.latencySamples * 1000.f / SOUND_FREQ;
+        gFrameStats.audioTargetMilliseconds = audioLatency.targetSamples * 1000.f / SOUND_FREQ;
+        gFrameStats.audioUnderruns = srb.underrunCount.load(std::memory_order_relaxed);
+        gFrameStats.renderScale = dynres.scale;
 
-        //sleep to lock frame rate
-        if(secsElapsed < targetFrameSeconds) {
 
+        uint64_t transientPeak = 0;
+#if HANDMADE_INTERNAL
+        transientPeak = gameMemory.arenas[DebugArena_Transient].highWater;
+#endif
 
-            //NOTE: .5 denotes the amount we will spin manually since
-            //      SDL_Delay is not 100% accurate
-            real32_t timeToSleep = (targetFrameSeconds - secsElapsed)*1000 - .5;
-            SDL_Delay(timeToSleep);
-            secsElapsed = secondsForCountRange(startCount, SDL_GetPerformanceCounter());
-            
-            //This assert will fire if the window is moved
-            //assert(secondsForCountRange(startCount, SDL_GetPerformanceCounter()) < targetFrameSeconds); 
-            
-            while(secondsForCountRange(startCount, SDL_GetPerformanceCounter()) < targetFrameSeconds) {
-                //wait
-            }
-            secsElapsed = secondsForCountRange(startCount, SDL_GetPerformanceCounter());
+        if(!gFrameStats.isOverlayVisible) {
+            TIMED_BLOCK("printStats");
+            LOG_UNLIMITED(LogLevel_Info, "TPF: %.2fms FPS: %.2f MCPF: %.2f Latency: %.1fms (target %.1fms) Drift: %.0fppm Callback: %.2fms Underruns: %u Overruns: %u Present: %s %uKB copied Upload: %.3fms %s Scale: %.2f %ux%u changes %u Buffers: %u Present latency: %.2fms Rewind: %.3fms capture (protect %.3fms) %.0f faults ~%.3fms %.1fs %.0fKB Transient peak: %lluKB Pacing: %s jitter %.3fms margin %.3fms wait %.2fms cpu %.2fms (%.0f%%) missed %u",
+                    secsElapsed*1000, fpsCount, mcPerFrame,
+                    audioLatency.latencySamples * 1000.f / SOUND_FREQ, audioLatency.targetSamples * 1000.f / SOUND_FREQ,
+                    audioLatency.driftPpm, audioLatency.callbackSeconds * 1000,
+                    srb.underrunCount.load(std::memory_order_relaxed), srb.overrunCount.load(std::memory_order_relaxed),
+                    state.bytesCopied ? "copy" : "lock", state.bytesCopied / 1024,
+                    uploadMicroseconds / 1000.f, SDL_GetPixelFormatName(gTexture.format),
+                    dynres.scale, frameBuffer->width, frameBuffer->height, dynres.changes,
+                    gPipeline.bufferCount ? gPipeline.bufferCount : 1, presentLatencyMicroseconds / 1000.f,
+                    state.rewind.captureSeconds * 1000, state.rewind.protectSeconds * 1000,
+                    state.rewind.faultCount, state.rewind.faultCount * state.dirtyPages.faultSeconds * 1000,
+                    state.rewind.historySeconds,
+                    (state.rewind.writeCursor - state.rewind.readCursor) / 1024.f,
+                    (unsigned long long)transientPeak / 1024,
+                    pacingModeNames[pacer.mode], pacer.jitterSeconds * 1000, pacer.spinMarginSeconds * 1000,
+                    pacer.waitSeconds * 1000, pacer.waitCpuSeconds * 1000,
+                    (pacer.waitSeconds > 0) ? pacer.waitCpuSeconds / pacer.waitSeconds * 100 : 0., pacer.missedDeadlines);
         }
-        uint64_t endCount = SDL_GetPerformanceCounter();
-        real32_t fpsCount =  ((1./secsElapsed));
-        real32_t mcPerFrame = (real32_t)(endCount-startCount) / (1000 * 1000 );
 
+#if HANDMADE_INTERNAL
+        if(gProfiler) {
+            if(state.isProfileCaptureRequested && !gProfileWriter.isBusy.load(std::memory_order_acquire)) {
+                if(gProfileWriter.thread.joinable()) {
+                    gProfileWriter.thread.join();
+                }
+                if(!beginProfileCapture(gProfiler, PROFILE_CAPTURE_FRAMES)) {
+                    LOG_ERROR("Cannot allocate memory for a profile capture");
+                }
+                state.isProfileCaptureRequested = false;
+            }
 
-        printf("TPF: %.2fms FPS: %.2f MCPF: %.2f\n", secsElapsed*1000, fpsCount, mcPerFrame);
+            if(endProfileFrame(gProfiler)) {
+                gProfileWriter.isBusy.store(true, std::memory_order_relaxed);
+                gProfileWriter.thread = std::thread(writeProfileCapture, gProfiler, &gProfileWriter);
+            }
+        }
+#endif
 
         startCount = endCount;
         secsSinceLastFrame = secsElapsed;
     }
 
-    cleanUp(&state, &gameCode);
+    cleanUp(&state, &gameCode, &gameMemory);
     return 0;
 }
 
@@ -681,13 +2767,13 @@ FileContents debugFileRead(const char* fileName) {
 
     if((f = fopen(fileName, "rb"))) {
         if(fread(contents.contents, contents.contentsSize, 1, f) < 1) {
-            //TODO logging
+            LOG_ERROR("Could not read %s", fileName);
         }
 
         fclose(f);
     }
     else {
-        //TODO logging
+        LOG_ERROR("Could not open %s: %s", fileName, strerror(errno));
     }
 
 
@@ -701,13 +2787,13 @@ void debugFileWrite(const char* fileName, void* dataToWrite, uint64_t numBytesTo
 
     if((f = fopen(fileName, "wb"))) {
         if(fwrite(dataToWrite, numBytesToWrite, 1, f) < 1) {
-            //TODO logging
+            LOG_ERROR("Could not write %s", fileName);
         }
 
         fclose(f);
     }
     else {
-        //TODO logging
+        LOG_ERROR("Could not open %s: %s", fileName, strerror(errno));
     }
 
 }
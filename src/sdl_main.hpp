@@ -1,6 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include "handmade.hpp"
+#include "input_recording.hpp"
 #include <SDL.h>
 
 #if !defined(MAP_ANONYMOUS)
@@ -15,13 +21,134 @@
 #define DEFAULT_REFRESH_RATE 60
 
 
+enum PresentMode {
+    PresentMode_Copy,   //game draws into pixels, SDL_UpdateTexture copies them over every frame
+    PresentMode_Lock,   //game draws straight into the memory SDL_LockTexture hands back
+};
+
 //TODO: get rid of this struct
 struct Texture {
     Pixel* pixels = nullptr;
-    uint32_t sizeInBytes = 0; //size of pixels in bytes
+    uint32_t sizeInBytes = 0; //reserved for pixels, only the part frames touch is committed
+    uint32_t reservedWidth = 0;     //largest frame pixels and the present buffers fit
+    uint32_t reservedHeight = 0;
     SDL_Texture* sdlTexture = nullptr;
-    uint32_t width = 0;
+    uint32_t capacityWidth = 0;     //what sdlTexture was created with, only ever grows
+    uint32_t capacityHeight = 0;
+    uint32_t width = 0;             //the window
     uint32_t height = 0;
+    uint32_t pitch = 0; //bytes per row, rounded up to a cache line so render tiles never share one
+    bool isLocked = false;
+    bool isLockUnaligned = false;   //locking gave rows off cache lines, present by copying
+    Uint32 format = SDL_PIXELFORMAT_RGBA8888;   //picked once by chooseTextureFormat
+    PixelLayout layout = PixelLayout_RGBA;      //what format is to the game
+
+    //the top left part the game draws this frame, see DynamicResolution
+    uint32_t renderWidth = 0;
+    uint32_t renderHeight = 0;
+    uint32_t renderPitch = 0;
+};
+
+//NOTE: Native asks for the window's own format so SDL_UpdateTexture is a
+//      straight copy; rgba is the old fixed SDL_PIXELFORMAT_RGBA8888, kept to
+//      compare upload times against
+enum TextureFormatMode {
+    TextureFormat_Native,
+    TextureFormat_RGBA,
+    TextureFormat_Count
+};
+
+//NOTE: Pipelined frames.  SDL only supports a renderer on the thread that
+//      created it, so every SDL call stays on the main thread and the game
+//      moves instead.  The game thread updates and draws frame N into one
+//      buffer while the main thread uploads and presents frame N-1 from the
+//      other, then the main thread waits for the game before it goes on.
+//      Input, audio, code reloads, snapshots and resizes all happen while the
+//      game thread sleeps, so none of them need locks.
+#define PRESENT_BUFFER_COUNT 2
+
+#define PROFILE_CAPTURE_FRAMES 120
+#define PROFILE_TRACE_PATH "profile_trace.json"
+
+//NOTE: A finished capture is printed and written to PROFILE_TRACE_PATH on a
+//      thread of its own, the frame loop only starts it.  The capture buffers
+//      aren't touched again until the next capture begins, which waits for
+//      the writer.
+struct ProfileCaptureWriter {
+    std::thread thread;
+    std::atomic<bool> isBusy;
+
+    ProfileCaptureWriter()
+    :isBusy(false)
+    {
+    }
+};
+
+//NOTE: Resizes.  Window events only record the size they ask for and the
+//      main loop applies the last one once per frame.  Pixel memory is
+//      reserved for the largest display and the texture is grown in steps, so
+//      a resize inside both only changes width, height and pitch.  A storm is
+//      a run of resize events, reported once it has been quiet for a while.
+#define TEXTURE_GROW_GRANULARITY 256        //texture sizes are rounded up to this
+#define RESIZE_STORM_QUIET_SECONDS .25f
+
+struct ResizeState {
+    bool isPending = false;
+    uint32_t pendingWidth = 0;
+    uint32_t pendingHeight = 0;
+
+    //current storm
+    bool isStorm = false;
+    uint64_t lastEventCount = 0;    //performance counter at the last resize event
+    uint32_t events = 0;
+    uint32_t rebuilds = 0;          //frames that applied a new size
+    uint32_t textureGrows = 0;      //of those, how many had to recreate the texture
+    uint32_t recordedRebuilds = 0;  //rebuilds when the last frame was recorded
+    bool wasRebuildFrame = false;
+
+    //frames that rebuilt and the one after each, the rest are the quiet tail
+    uint32_t frames = 0;
+    real32_t maxFrameMilliseconds = 0;
+    real32_t totalFrameMilliseconds = 0;
+    uint32_t quietFrames = 0;
+    real32_t maxQuietMilliseconds = 0;
+    real32_t totalQuietMilliseconds = 0;
+};
+
+struct PresentFrame {
+    OffScreenBuffer buffer;
+    uint32_t sizeInBytes = 0;
+    uint64_t submitCount = 0;   //performance counter when the game finished it
+};
+
+struct GameCode;
+struct PlatformState;
+
+//NOTE: Everything one game frame needs, run by runGameFrame on the game
+//      thread or, serial, on the main thread
+struct GameFrameJob {
+    GameCode* gameCode = nullptr;
+    GameMemory* gameMemory = nullptr;
+    PlatformState* state = nullptr;
+    OffScreenBuffer* buffer = nullptr;
+    GameSoundOutput* sound = nullptr;
+    InputContext* input = nullptr;
+    InputContext* oldInput = nullptr;   //rewinding steps this back
+    real32_t secsSinceLastFrame = 0;
+    real32_t gameSeconds = 0;           //out, how long the game took
+};
+
+struct PresentPipeline {
+    PresentFrame frames[PRESENT_BUFFER_COUNT];
+    uint32_t bufferCount = 0;       //0 when the game runs on the main thread
+    uint32_t writeIndex = 0;        //the buffer the game draws into, the other one is presented
+    bool hasPendingFrame = false;   //the other buffer holds a finished frame nobody presented yet
+    GameFrameJob job;               //main thread writes it before jobReady, reads it after jobDone
+
+    std::thread thread;
+    sem_t jobReady;
+    sem_t jobDone;
+    bool isStopping = false;        //a jobReady with this set ends the thread
 };
 
 struct SDLInputContext {
@@ -30,28 +157,281 @@ struct SDLInputContext {
 
 typedef void GameUpdateAndRenderFunc(GameMemory* memory, OffScreenBuffer *buffer, GameSoundOutput* sb, const InputContext* ci, real32_t secsSinceLastFrame);
 
+//NOTE: Single producer (main loop) single consumer (audio callback) ring.
+//      The cursors count samples since startup and are only masked when
+//      indexing, so writeCursor - readCursor is always the queued amount.
+//      Each cursor has its own cache line so the two threads don't fight
+//      over it.
+#define SOUND_RING_BUFFER_SIZE (1 << 16) //must be a power of two, ~1.4s at 48kHz
+#define SOUND_RING_BUFFER_MASK (SOUND_RING_BUFFER_SIZE - 1)
+
 struct SDLSoundRingBuffer {
-    uint32_t sampleToPlay = 0;
-    uint32_t runningIndex = 0;
-    Sample samples[SOUND_FREQ];
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> readCursor;    //written by the audio callback
+    std::atomic<uint32_t> underrunCount;                          //callbacks that ran out of samples
+    std::atomic<uint32_t> callbackCount;
+    std::atomic<uint32_t> callbackSamples;                        //samples the device asked for last callback
+    std::atomic<uint32_t> minHeadroom;                            //fewest samples left over after a callback, the main loop resets it
+    std::atomic<uint64_t> lastCallbackCount;                      //performance counter at the last callback
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> writeCursor;   //written by the main loop
+    std::atomic<uint32_t> overrunCount;                           //frames that had more samples than room
+
+    alignas(CACHE_LINE_SIZE) Sample samples[SOUND_RING_BUFFER_SIZE];
+
+    SDLSoundRingBuffer()
+    :readCursor(0), underrunCount(0), callbackCount(0), callbackSamples(0), minHeadroom(UINT32_MAX),
+    lastCallbackCount(0), writeCursor(0), overrunCount(0)
+    {
+    }
 };
 
+//NOTE: Main loop side of the audio latency controller.  Latency is the
+//      distance from the estimated play cursor to the write cursor right after
+//      the game's samples went in.  Every window the target shrinks towards
+//      the smallest value the callbacks got through without running dry and
+//      grows quickly again on an underrun.
+#define AUDIO_DEVICE_SAMPLES 256                    //requested callback size, ~5ms
+#define AUDIO_MIN_LATENCY (SOUND_FREQ / 200)        //5ms
+#define AUDIO_MAX_LATENCY (SOUND_FREQ / 5)          //200ms
+#define AUDIO_LATENCY_MARGIN (SOUND_FREQ / 1000)    //headroom we keep on top of the worst callback, 1ms
+#define AUDIO_LATENCY_WINDOW_SECONDS .5f
+#define AUDIO_LATENCY_SETTLE_WINDOWS 4              //clean windows after an underrun before shrinking again
+#define AUDIO_STEER_GAIN .25f                       //fraction of the latency error corrected per frame
+#define AUDIO_DRIFT_SMOOTHING .01f
+
+struct SDLAudioLatency {
+    uint32_t targetSamples = SOUND_LATENCY;
+    uint32_t deviceSamples = AUDIO_DEVICE_SAMPLES;
+
+    //live stats
+    real32_t latencySamples = 0;    //after the last write
+    real32_t driftPpm = 0;          //audio clock relative to the frame clock, positive when audio runs fast
+    real32_t callbackSeconds = 0;   //measured time between callbacks, underruns live in the ring
 
-#define GAME_LIB_PATH "./game.so" 
+    uint64_t windowStartCount = 0;
+    uint32_t windowStartCallbacks = 0;
+    uint32_t windowStartUnderruns = 0;
+    uint32_t cleanWindows = 0;      //windows since the last underrun
+};
 
 struct GameCode {
-    time_t dateLastModified = 0;  //time the library file was last modified
     void* libraryHandle = nullptr;
     GameUpdateAndRenderFunc* guarf = nullptr;
+    real32_t loadSeconds = 0;     //copy and dlopen, off the frame thread for reloads
+};
+
+//NOTE: Hot reload.  A background thread waits on inotify for the build to
+//      move a new library into place, loads a private copy of it and parks
+//      the result in pendingCode.  The main loop swaps it in between frames
+//      and hands the old library back to the thread to be closed.
+struct GameCodeWatcher {
+    std::thread thread;
+    int inotifyFd = -1;
+    int wakeFd = -1;                            //eventfd, wakes the thread to close retired code or stop
+    std::atomic<GameCode*> pendingCode;         //loaded, waiting for a frame boundary
+    std::atomic<void*> retiredLibrary;          //swapped out, waiting for dlclose
+    std::atomic<bool> running;
+
+    GameCodeWatcher()
+    :pendingCode(nullptr), retiredLibrary(nullptr), running(false)
+    {
+    }
+};
+
+//NOTE: Write tracking for incremental snapshots and rewind.  The whole game
+//      memory block is read only from startup; the first write to each page
+//      faults, the SIGSEGV handler records the page and makes it writable
+//      again.  Pages are recorded in two lists, one since the last snapshot
+//      sync and one since the last rewind capture, and each list re-protects
+//      only its own pages when it is reset.  Under gdb use
+//      "handle SIGSEGV nostop noprint".
+//
+//      Pages here are DIRTY_PAGE_SIZE, a multiple of the system page size.
+//      Every unprotected page splits the mapping, and with 4K pages scattered
+//      writes could run into vm.max_map_count.
+//
+//      The cost is one fault per page the game writes each frame, plus
+//      re-protecting them after the capture.  What a fault costs is measured
+//      once at startup on DIRTY_FAULT_PROBE_PAGES scratch pages.
+#define DIRTY_PAGE_SIZE (64 * 1024)
+#define DIRTY_FAULT_PROBE_PAGES 64
+
+struct DirtyPageList {
+    uint8_t* isDirty = nullptr;     //one flag per page
+    uint32_t* pages = nullptr;      //indices in the order they were first written
+    uint32_t count = 0;             //only touched with atomics, the handler can run on any thread
+};
+
+struct DirtyPageTracker {
+    uint8_t* base = nullptr;
+    uint64_t size = 0;
+    uint64_t pageSize = 0;
+    uint32_t pageCount = 0;
+    DirtyPageList sinceSnapshot;
+    DirtyPageList sinceCapture;
+    bool isArmed = false;
+    real64_t faultSeconds = 0;      //one write fault, trap, handler and mprotect
+    struct sigaction previousAction;
+};
+
+//NOTE: Rewind history.  Every frame the pages the game wrote are stored as
+//      the XOR against their contents a frame earlier, kept in shadow, so
+//      applying a record again steps memory back one frame.  Records live
+//      back to back in a byte ring with monotonic cursors like the sound ring;
+//      the oldest frames fall off when it fills up or the history gets longer
+//      than REWIND_HISTORY_SECONDS of frame time.
+#define REWIND_BUFFER_SIZE MB(64)
+#define REWIND_HISTORY_SECONDS 30.f
+#define REWIND_MAX_FRAMES (240 * 30)    //enough for the whole history up to 240Hz
+#define REWIND_CAPTURE_SMOOTHING .05f
+
+struct RewindFrameHeader {
+    uint32_t size;          //including this header and the pages after it
+    uint32_t pageCount;
+    real32_t seconds;       //how long the frame took
+    InputContext input;     //what the game was given for this frame
+};
+
+struct RewindPageHeader {
+    uint32_t page;
+    uint32_t encodedSize;
+};
+
+struct RewindFrame {
+    uint64_t offset;        //ring cursor of the header
+    uint32_t size;
+    real32_t seconds;
+};
+
+struct RewindBuffer {
+    uint8_t* ring = nullptr;
+    uint8_t* shadow = nullptr;      //game memory as of the last capture, only touched pages are backed
+    uint8_t* scratch = nullptr;     //one encoded page
+    uint64_t readCursor = 0;        //start of the oldest frame
+    uint64_t writeCursor = 0;       //end of the newest frame
+    RewindFrame frames[REWIND_MAX_FRAMES];
+    uint32_t firstFrame = 0;
+    uint32_t frameCount = 0;
+    real32_t historySeconds = 0;
+    real32_t captureSeconds = 0;    //smoothed cost of a capture
+    real32_t protectSeconds = 0;    //smoothed, the part of it re-protecting pages
+    real32_t faultCount = 0;        //smoothed write faults per frame, one per page written
+};
+
+//NOTE: How the game memory block is backed, picked on the command line.
+//      Huge pages make the dirty page tracker work in HUGE_PAGE_SIZE pages,
+//      since protecting part of one would split it back into small pages.
+//      Prefaulting makes every page count as touched, so the first snapshot
+//      after it copies the whole block.
+enum HugePageMode {
+    HugePages_Off,
+    HugePages_Transparent,  //madvise(MADV_HUGEPAGE), whatever the kernel can give us
+    HugePages_Explicit,     //MFD_HUGETLB, needs vm.nr_hugepages reserved up front
+    HugePages_Count
+};
+
+#define HUGE_PAGE_SIZE MB(2)
+
+//NOTE: Frame pacing.  Sleep waits on clock_nanosleep against an absolute
+//      deadline and spins only the last spinMarginSeconds, which follows how
+//      late this machine actually wakes up.  Vsync leaves it to
+//      SDL_RenderPresent blocking, uncapped doesn't wait at all.
+enum PacingMode {
+    Pacing_Sleep,
+    Pacing_Vsync,
+    Pacing_Uncapped,
+    Pacing_Count
+};
+
+#define PACING_MIN_SPIN_MARGIN .00005  //seconds, floor for the spin margin
+#define PACING_MAX_SPIN_MARGIN .002
+#define PACING_CALIBRATION_SLEEPS 20
+#define PACING_WAKE_SMOOTHING .05       //for the wake up lateness average and deviation
+#define PACING_WAKE_DEVIATIONS 4        //margin is mean lateness plus this many deviations
+#define PACING_STATS_SMOOTHING .05
+
+struct FramePacer {
+    PacingMode mode = Pacing_Sleep;
+    real64_t targetSeconds = 0;
+    uint64_t deadline = 0;              //CLOCK_MONOTONIC nanoseconds the current frame should end at
+    uint64_t lastFrameEnd = 0;
+
+    real64_t wakeLatenessMean = 0;      //how late clock_nanosleep returns, seconds
+    real64_t wakeLatenessDeviation = 0;
+    real64_t spinMarginSeconds = PACING_MAX_SPIN_MARGIN;
+
+    real64_t jitterSeconds = 0;         //smoothed |frame time - target|
+    real64_t waitCpuSeconds = 0;        //smoothed cpu time burned per frame waiting
+    real64_t waitSeconds = 0;           //smoothed wall time per frame waiting
+    uint32_t missedDeadlines = 0;       //frames that were already late when it came to waiting
+};
+
+//NOTE: Dynamic resolution.  The game draws into the top left of the texture
+//      at scale times the window size and SDL_RenderCopy stretches that over
+//      the window.  Memory and texture are sized for the window once, a new
+//      scale only changes width, height and pitch inside them.  Load is the
+//      game's update and render plus the texture upload (the longer of the two
+//      when pipelined), the part of the frame that grows with the pixel count.
+//      Going down is quick, going up waits for a whole history at the current
+//      scale and goes one step at a time.
+#define DYNRES_HISTORY 16           //frames of load at the current scale
+#define DYNRES_DROP_FRAMES 4        //frames over budget in a row before going down
+#define DYNRES_BUDGET .75f          //share of the target frame time load may take
+#define DYNRES_RAISE_BUDGET .6f     //load a step up has to stay under, as a share of the target
+#define DYNRES_STEP .0625f          //scales are multiples of this
+#define DYNRES_MIN_SCALE .25f
+
+struct DynamicResolution {
+    real32_t minScale = .5f;
+    real32_t maxScale = 1.f;
+    real32_t scale = 1.f;
+    real32_t loadSeconds[DYNRES_HISTORY] = {};
+    uint32_t framesAtScale = 0;
+    uint32_t changes = 0;
+};
+
+struct PlatformOptions {
+    PacingMode pacing = Pacing_Sleep;
+    LogLevel logLevel = LogLevel_Info;
+    HugePageMode hugePages = HugePages_Off;
+    TextureFormatMode textureFormat = TextureFormat_Native;
+    real32_t minScale = .5f;
+    real32_t maxScale = 1.f;
+    bool prefault = false;
+#if HANDMADE_INTERNAL
+    bool fixedAddress = true;   //saved pointers stay valid from run to run
+#else
+    bool fixedAddress = false;
+#endif
+};
+
+//NOTE: Counters for the calling thread only, -1 when perf events are not
+//      available (perf_event_paranoid, no PMU in a VM)
+struct PerfCounters {
+    int pageFaultFd = -1;
+    int tlbMissFd = -1;
 };
-#define GAME_INPUT_PATH "game_input.bin"
-#define GAME_STATE_PATH "game_state.bin"
 
 struct PlatformState {
     bool running = true;
     bool isRecording = false;
     bool isPlayingBack = false;
-    FILE* inputRecordFile = nullptr;
+    InputRecorder inputRecorder;
+    InputPlayer inputPlayer;
     uint64_t gameMemorySize = 0;
+    uint64_t trackedMemorySize = 0;     //from the start of memoryBlock, what snapshots, rewind and write tracking cover
     void* memoryBlock;
+    int memoryFd = -1;  //memfd behind memoryBlock, -1 if it is plain anonymous memory
+    uint64_t memoryPageSize = 0;        //what memoryBlock is actually backed with
+    HugePageMode hugePages = HugePages_Off; //what we got, which may be less than asked for
+    bool isFixedAddress = false;
+    DirtyPageTracker dirtyPages;
+    RewindBuffer rewind;
+    bool isRewinding = false;
+    bool hasSnapshotBaseline = false; //memory matches snapshotStats' file apart from dirtyPages.sinceSnapshot
+    struct stat snapshotStats;
+    PresentMode presentMode = PresentMode_Lock;
+    uint32_t bytesCopied = 0; //by us to get the last frame to SDL
+    uint32_t presentBufferCount = 0; //requested pipeline buffers, 0 is serial
+    bool isProfileCaptureRequested = false;
 };
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <thread>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <assert.h>
+#include <immintrin.h>
+#include "handmade.hpp"
+
+//NOTE: Platform job system handed to the game through GameMemory.  Every
+//      thread that touches the queue (the main thread is index 0) owns a
+//      fixed-size Chase-Lev deque.  Owners push and pop at the bottom, idle
+//      threads steal from the top of everybody else's deque.  Only the sdl
+//      platform and the bench driver include this; the game sees the opaque
+//      PlatformWorkQueue and the function pointers in GameMemory.
+
+#define WORK_DEQUE_SIZE 4096 //must be a power of two
+#define MAX_WORKER_THREADS 63
+
+struct WorkQueueEntry {
+    std::atomic<PlatformWorkQueueCallback*> callback;
+    std::atomic<void*> data;
+};
+
+struct alignas(CACHE_LINE_SIZE) WorkDeque {
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top;     //thieves take from here
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom;  //owner pushes and pops here
+    alignas(CACHE_LINE_SIZE) WorkQueueEntry entries[WORK_DEQUE_SIZE];
+};
+
+struct PlatformWorkQueue {
+    WorkDeque deques[MAX_WORKER_THREADS + 1];
+    std::thread threads[MAX_WORKER_THREADS];
+    uint32_t threadCount = 0; //including the main thread
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> pendingCount;
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> running;
+    sem_t semaphore;
+};
+
+static thread_local uint32_t workQueueThreadIndex = 0;
+
+static bool pushWork(WorkDeque* deque, PlatformWorkQueueCallback* callback, void* data) {
+    int64_t b = deque->bottom.load(std::memory_order_relaxed);
+    int64_t t = deque->top.load(std::memory_order_acquire);
+
+    if(b - t >= WORK_DEQUE_SIZE) {
+        return false;
+    }
+
+    WorkQueueEntry* entry = &deque->entries[b & (WORK_DEQUE_SIZE - 1)];
+    entry->callback.store(callback, std::memory_order_relaxed);
+    entry->data.store(data, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    deque->bottom.store(b + 1, std::memory_order_relaxed);
+
+    return true;
+}
+
+static bool popWork(WorkDeque* deque, PlatformWorkQueueCallback** callback, void** data) {
+    int64_t b = deque->bottom.load(std::memory_order_relaxed) - 1;
+    deque->bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = deque->top.load(std::memory_order_relaxed);
+
+    if(t > b) {
+        //empty
+        deque->bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    WorkQueueEntry* entry = &deque->entries[b & (WORK_DEQUE_SIZE - 1)];
+    *callback = entry->callback.load(std::memory_order_relaxed);
+    *data = entry->data.load(std::memory_order_relaxed);
+
+    if(t == b) {
+        //last entry, race the thieves for it
+        bool won = deque->top.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+        deque->bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    return true;
+}
+
+static bool stealWork(WorkDeque* deque, PlatformWorkQueueCallback** callback, void** data) {
+    int64_t t = deque->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = deque->bottom.load(std::memory_order_acquire);
+
+    if(t >= b) {
+        return false;
+    }
+
+    WorkQueueEntry* entry = &deque->entries[t & (WORK_DEQUE_SIZE - 1)];
+    *callback = entry->callback.load(std::memory_order_relaxed);
+    *data = entry->data.load(std::memory_order_relaxed);
+
+    return deque->top.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+//NOTE: Returns false only when every deque looked empty
+static bool doNextWorkQueueEntry(PlatformWorkQueue* queue, uint32_t threadIndex) {
+    PlatformWorkQueueCallback* callback = nullptr;
+    void* data = nullptr;
+    bool found = popWork(&queue->deques[threadIndex], &callback, &data);
+
+    for(uint32_t i = 1; !found && i < queue->threadCount; i++) {
+        found = stealWork(&queue->deques[(threadIndex + i) % queue->threadCount], &callback, &data);
+    }
+
+    if(found) {
+        callback(queue, data);
+        queue->pendingCount.fetch_sub(1, std::memory_order_release);
+    }
+
+    return found;
+}
+
+static void platformAddEntry(PlatformWorkQueue* queue, PlatformWorkQueueCallback* callback, void* data) {
+    queue->pendingCount.fetch_add(1, std::memory_order_relaxed);
+
+    if(!pushWork(&queue->deques[workQueueThreadIndex], callback, data)) {
+        //NOTE: Our deque is full, doing the work right here is the cheapest back pressure
+        callback(queue, data);
+        queue->pendingCount.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    sem_post(&queue->semaphore);
+}
+
+static void platformCompleteAllWork(PlatformWorkQueue* queue) {
+    while(queue->pendingCount.load(std::memory_order_acquire) != 0) {
+        if(!doNextWorkQueueEntry(queue, workQueueThreadIndex)) {
+            _mm_pause();
+        }
+    }
+}
+
+static void workerThreadProc(PlatformWorkQueue* queue, uint32_t threadIndex) {
+    workQueueThreadIndex = threadIndex;
+
+    while(queue->running.load(std::memory_order_relaxed)) {
+        if(!doNextWorkQueueEntry(queue, threadIndex)) {
+            sem_wait(&queue->semaphore);
+        }
+    }
+}
+
+//NOTE: workerCount does not include the calling thread, which becomes index 0
+//      and helps out in platformCompleteAllWork.  The queue is mmapped since
+//      new does not honour its cache line alignment before C++17.
+static PlatformWorkQueue* createWorkQueue(uint32_t workerCount) {
+    if(workerCount > MAX_WORKER_THREADS) {
+        workerCount = MAX_WORKER_THREADS;
+    }
+
+    void* memory = mmap(nullptr, sizeof(PlatformWorkQueue), PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if(memory == MAP_FAILED) {
+        return nullptr;
+    }
+
+    PlatformWorkQueue* queue = new (memory) PlatformWorkQueue;
+
+    for(uint32_t i = 0; i < ARRAY_SIZE(queue->deques); i++) {
+        queue->deques[i].top.store(0, std::memory_order_relaxed);
+        queue->deques[i].bottom.store(0, std::memory_order_relaxed);
+    }
+
+    queue->threadCount = workerCount + 1;
+    queue->pendingCount.store(0, std::memory_order_relaxed);
+    queue->running.store(true, std::memory_order_relaxed);
+    sem_init(&queue->semaphore, 0, 0);
+
+    workQueueThreadIndex = 0;
+
+    for(uint32_t i = 0; i < workerCount; i++) {
+        queue->threads[i] = std::thread(workerThreadProc, queue, i + 1);
+    }
+
+    return queue;
+}
+
+static void destroyWorkQueue(PlatformWorkQueue* queue) {
+    platformCompleteAllWork(queue);
+    queue->running.store(false, std::memory_order_relaxed);
+
+    for(uint32_t i = 1; i < queue->threadCount; i++) {
+        sem_post(&queue->semaphore);
+    }
+
+    for(uint32_t i = 1; i < queue->threadCount; i++) {
+        queue->threads[i - 1].join();
+    }
+
+    sem_destroy(&queue->semaphore);
+    queue->~PlatformWorkQueue();
+    munmap(queue, sizeof(PlatformWorkQueue));
+}
+
+static uint32_t getDefaultWorkerCount() {
+    uint32_t cores = std::thread::hardware_concurrency();
+    return (cores > 1) ? cores - 1 : 0;
+}